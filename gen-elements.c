@@ -0,0 +1,206 @@
+/*
+ * gen-elements.c: Generate the element table of odt2txt
+ *
+ * Reads elements.def from stdin and writes elements.h to stdout: a
+ * table of the elements and their handlers, and a perfect hash
+ * function which finds a name in it with a single comparison.  The
+ * hash is
+ *
+ *   (len * a + name[pos] * b + name[len - 1]) & mask
+ *
+ * with the smallest mask and then the first a, b and pos for which
+ * no two names collide.  This runs on the build host.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ELEMENTS 256
+#define MAX_NAME 64
+#define MAX_MASK 1023
+#define MAX_FACTOR 64
+
+struct element {
+	char name[MAX_NAME];
+	char handler[MAX_NAME];
+	size_t len;
+};
+
+static struct element elements[MAX_ELEMENTS];
+static size_t nelements;
+static size_t min_len = (size_t)-1, max_len;
+
+static size_t hash(const struct element *e, size_t a, size_t b, size_t pos,
+		   size_t mask)
+{
+	return (e->len * a + (unsigned char)e->name[pos] * b +
+		(unsigned char)e->name[e->len - 1]) & mask;
+}
+
+static int read_def(FILE *in)
+{
+	char line[256];
+	int lineno = 0;
+	struct element *e;
+
+	while (fgets(line, sizeof(line), in)) {
+		lineno++;
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+
+		if (nelements == MAX_ELEMENTS) {
+			fprintf(stderr, "gen-elements: too many elements\n");
+			return -1;
+		}
+		e = &elements[nelements];
+		if (sscanf(line, "%63s %63s", e->name, e->handler) != 2) {
+			fprintf(stderr, "gen-elements: line %d: expected an "
+				"element and a handler\n", lineno);
+			return -1;
+		}
+		e->len = strlen(e->name);
+		if (e->len < min_len)
+			min_len = e->len;
+		if (e->len > max_len)
+			max_len = e->len;
+		nelements++;
+	}
+
+	if (!nelements) {
+		fprintf(stderr, "gen-elements: no elements\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Finds the parameters of a perfect hash.  Returns -1 if there are
+ * none, e.g. because a name is listed twice.
+ */
+static int find_hash(size_t *a, size_t *b, size_t *pos, size_t *mask)
+{
+	unsigned char used[MAX_MASK + 1];
+	size_t i;
+
+	for (*mask = 1; *mask <= MAX_MASK; *mask = *mask * 2 + 1) {
+		if (*mask + 1 < nelements)
+			continue;
+		for (*a = 0; *a < MAX_FACTOR; (*a)++)
+		for (*b = 1; *b < MAX_FACTOR; (*b)++)
+		for (*pos = 0; *pos < min_len; (*pos)++) {
+			memset(used, 0, *mask + 1);
+			for (i = 0; i < nelements; i++) {
+				size_t h = hash(&elements[i], *a, *b, *pos, *mask);
+
+				if (used[h])
+					break;
+				used[h] = 1;
+			}
+			if (i == nelements)
+				return 0;
+		}
+	}
+	return -1;
+}
+
+static int is_declared(size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (!strcmp(elements[i].handler, elements[n].handler))
+			return 1;
+	}
+	return 0;
+}
+
+static void write_header(size_t a, size_t b, size_t pos, size_t mask)
+{
+	struct element *slots[MAX_MASK + 1];
+	char len_term[32] = "";
+	size_t i;
+
+	memset(slots, 0, sizeof(slots));
+	for (i = 0; i < nelements; i++)
+		slots[hash(&elements[i], a, b, pos, mask)] = &elements[i];
+
+	printf("/*\n"
+	       " * elements.h: Generated by gen-elements from elements.def,"
+	       " do not edit\n"
+	       " */\n\n"
+	       "#ifndef ELEMENTS_H\n"
+	       "#define ELEMENTS_H\n\n"
+	       "struct fmt;\n"
+	       "struct tag;\n\n");
+
+	for (i = 0; i < nelements; i++) {
+		if (!is_declared(i))
+			printf("static const char *%s(struct fmt *f, "
+			       "const struct tag *t);\n", elements[i].handler);
+	}
+
+	printf("\n"
+	       "struct element {\n"
+	       "\tconst char *name;\n"
+	       "\tsize_t len;\n"
+	       "\tconst char *(*handler)(struct fmt *f, const struct tag *t);\n"
+	       "};\n\n"
+	       "static const struct element element_table[%lu] = {\n",
+	       (unsigned long)mask + 1);
+	for (i = 0; i <= mask; i++) {
+		if (slots[i])
+			printf("\t{ \"%s\", %lu, %s },\n", slots[i]->name,
+			       (unsigned long)slots[i]->len, slots[i]->handler);
+		else
+			printf("\t{ NULL, 0, NULL },\n");
+	}
+	printf("};\n\n");
+
+	if (a)
+		snprintf(len_term, sizeof(len_term), "len * %lu + ",
+			 (unsigned long)a);
+
+	printf("/*\n"
+	       " * Returns the element whose name is the len bytes at name,"
+	       " or NULL if\n"
+	       " * it isn't in the table.\n"
+	       " */\n"
+	       "static const struct element *element_lookup(const char *name,"
+	       " size_t len)\n"
+	       "{\n"
+	       "\tconst struct element *e;\n\n"
+	       "\tif (len < %lu || len > %lu)\n"
+	       "\t\treturn NULL;\n\n"
+	       "\te = &element_table[(%s(unsigned char)name[%lu] * %lu +\n"
+	       "\t\t\t    (unsigned char)name[len - 1]) & %lu];\n"
+	       "\tif (e->len != len || memcmp(e->name, name, len))\n"
+	       "\t\treturn NULL;\n"
+	       "\treturn e;\n"
+	       "}\n\n"
+	       "#endif /* ELEMENTS_H */\n",
+	       (unsigned long)min_len, (unsigned long)max_len,
+	       len_term, (unsigned long)pos, (unsigned long)b,
+	       (unsigned long)mask);
+}
+
+int main(void)
+{
+	size_t a, b, pos, mask;
+
+	if (read_def(stdin) == -1)
+		return EXIT_FAILURE;
+
+	if (find_hash(&a, &b, &pos, &mask) == -1) {
+		fprintf(stderr, "gen-elements: can't find a perfect hash, "
+			"is an element listed twice?\n");
+		return EXIT_FAILURE;
+	}
+
+	write_header(a, b, pos, mask);
+	return fflush(stdout) == EOF ? EXIT_FAILURE : EXIT_SUCCESS;
+}
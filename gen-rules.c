@@ -0,0 +1,572 @@
+/*
+ * gen-rules.c: Generate the automata of the fixed regular expressions
+ *
+ * Reads rules.def from stdin and writes rules.h to stdout: for each
+ * pattern a deterministic automaton, with which regex_subst() finds
+ * the leftmost-longest match like regexec() does, but without
+ * compiling the pattern at run time and without backtracking.
+ *
+ * Only a subset of the extended syntax is supported: bytes, escaped
+ * bytes, bracket expressions of ascii characters, the repetitions
+ * "*", "+", "?" and "{m,n}" of a single atom, "^" at the beginning
+ * and "$" at the end.  A pattern is then a sequence of byte sets,
+ * each repeated a number of times, and a state of the automaton is
+ * the set of positions in that sequence which may come next.  The
+ * bytes are matched one by one, so a negated bracket expression also
+ * matches a single byte of a multibyte character.
+ *
+ * This runs on the build host.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_RULES 256
+#define MAX_PATTERN 256
+#define MAX_ITEMS 64
+#define MAX_POS 256		/* positions of a pattern, a bit each */
+#define MAX_STATES 1024
+#define INF -1
+
+struct item {
+	unsigned char set[256];
+	int min, max;
+};
+
+struct rule {
+	char pattern[MAX_PATTERN];
+	size_t len;
+	int line;
+};
+
+enum node { NODE_ONE, NODE_OPT, NODE_LOOP };
+
+struct dfa {
+	int bol, eol;
+	unsigned char classes[256];
+	int nclasses;
+	int first;		/* the only byte a match starts with, or -1 */
+
+	/* positions: node[k] matches set[k] */
+	enum node node[MAX_POS];
+	const unsigned char *set[MAX_POS];
+	int npos;
+
+	unsigned char states[MAX_STATES][MAX_POS / 8];
+	int nstates;
+	int next[MAX_STATES][256];	/* by class */
+	unsigned char accept[MAX_STATES];
+};
+
+static struct rule rules[MAX_RULES];
+static size_t nrules;
+static struct dfa dfa;
+static struct item items[MAX_ITEMS];
+static int nitems;
+
+static int hexval(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/*
+ * Reads the C string literal at p into r.  Returns -1 if it is
+ * malformed.
+ */
+static int read_literal(const char *p, struct rule *r)
+{
+	int v;
+
+	p += strspn(p, " \t");
+	if (*p++ != '"')
+		return -1;
+
+	r->len = 0;
+	while (*p != '"') {
+		int c = (unsigned char)*p++;
+
+		if (c == '\0' || c == '\n' || r->len == MAX_PATTERN - 1)
+			return -1;
+		if (c == '\\') {
+			c = (unsigned char)*p++;
+			switch (c) {
+			case 'n':  c = '\n'; break;
+			case 't':  c = '\t'; break;
+			case 'r':  c = '\r'; break;
+			case '\\':
+			case '"':
+				break;
+			case 'x':
+				if ((v = hexval(*p)) == -1)
+					return -1;
+				c = v;
+				p++;
+				if ((v = hexval(*p)) != -1) {
+					c = c * 16 + v;
+					p++;
+				}
+				break;
+			default:
+				return -1;
+			}
+		}
+		if (c == '\0')
+			return -1;
+		r->pattern[r->len++] = (char)c;
+	}
+	r->pattern[r->len] = '\0';
+	p++;
+
+	p += strspn(p, " \t\r\n");
+	return *p == '\0' ? 0 : -1;
+}
+
+static int read_def(FILE *in)
+{
+	char line[1024];
+	int lineno = 0;
+	size_t i;
+
+	while (fgets(line, sizeof(line), in)) {
+		lineno++;
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+
+		if (nrules == MAX_RULES) {
+			fprintf(stderr, "gen-rules: too many rules\n");
+			return -1;
+		}
+		if (read_literal(line, &rules[nrules]) == -1) {
+			fprintf(stderr, "gen-rules: line %d: expected a string "
+				"literal\n", lineno);
+			return -1;
+		}
+		rules[nrules].line = lineno;
+
+		for (i = 0; i < nrules; i++) {
+			if (!strcmp(rules[i].pattern, rules[nrules].pattern)) {
+				fprintf(stderr, "gen-rules: line %d: pattern "
+					"of line %d repeated\n", lineno,
+					rules[i].line);
+				return -1;
+			}
+		}
+		nrules++;
+	}
+	return 0;
+}
+
+static int parse_count(const char **p, int *n)
+{
+	if (**p < '0' || **p > '9')
+		return -1;
+	for (*n = 0; **p >= '0' && **p <= '9'; (*p)++) {
+		*n = *n * 10 + (**p - '0');
+		if (*n > MAX_POS)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Parses the bracket expression behind the '[' at *p into set.
+ */
+static int parse_bracket(const char **p, unsigned char *set)
+{
+	const char *s = *p;
+	int neg = 0, c, hi, i;
+
+	if (*s == '^') {
+		neg = 1;
+		s++;
+	}
+	do {
+		c = (unsigned char)*s++;
+		if (c == '\0' || c >= 0x80 || c == '[' || c == '\\')
+			return -1;
+		hi = c;
+		if (s[0] == '-' && s[1] != ']' && s[1] != '\0') {
+			hi = (unsigned char)s[1];
+			if (hi >= 0x80 || hi < c)
+				return -1;
+			s += 2;
+		}
+		for (i = c; i <= hi; i++)
+			set[i] = 1;
+	} while (*s != ']');
+	*p = s + 1;
+
+	if (neg) {
+		for (i = 0; i < 256; i++)
+			set[i] = !set[i];
+	}
+	return 0;
+}
+
+/*
+ * Parses pattern into dfa.bol, dfa.eol and the items.  Returns -1 if
+ * it uses syntax which isn't supported.
+ */
+static int parse(const struct rule *r)
+{
+	const char *p = r->pattern;
+	const char *end = p + r->len;
+	struct item *it;
+
+	dfa.bol = dfa.eol = 0;
+	nitems = 0;
+
+	if (*p == '^') {
+		dfa.bol = 1;
+		p++;
+	}
+	while (p < end) {
+		if (*p == '$' && p + 1 == end) {
+			dfa.eol = 1;
+			break;
+		}
+		if (nitems == MAX_ITEMS)
+			return -1;
+		it = &items[nitems++];
+		memset(it->set, 0, sizeof(it->set));
+		it->min = it->max = 1;
+
+		switch (*p) {
+		case '\\':
+			if (++p == end)
+				return -1;
+			it->set[(unsigned char)*p++] = 1;
+			break;
+		case '[':
+			p++;
+			if (parse_bracket(&p, it->set) == -1)
+				return -1;
+			break;
+		case '.': case '(': case ')': case '|': case '^': case '$':
+		case '*': case '+': case '?': case '{': case '}':
+			return -1;
+		default:
+			it->set[(unsigned char)*p++] = 1;
+			break;
+		}
+
+		switch (*p) {
+		case '*':
+			it->min = 0;
+			it->max = INF;
+			p++;
+			break;
+		case '+':
+			it->max = INF;
+			p++;
+			break;
+		case '?':
+			it->min = 0;
+			p++;
+			break;
+		case '{':
+			p++;
+			if (parse_count(&p, &it->min) == -1)
+				return -1;
+			it->max = it->min;
+			if (*p == ',') {
+				p++;
+				it->max = INF;
+				if (*p != '}' && parse_count(&p, &it->max) == -1)
+					return -1;
+			}
+			if (*p++ != '}' || (it->max != INF && it->max < it->min))
+				return -1;
+			break;
+		}
+		if (*p == '*' || *p == '+' || *p == '?' || *p == '{')
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Expands the items into positions: the required repetitions, then
+ * either one which loops or the optional ones.
+ */
+static int expand(void)
+{
+	int i, k;
+
+	dfa.npos = 0;
+	for (i = 0; i < nitems; i++) {
+		int n = items[i].max == INF ? items[i].min + 1 : items[i].max;
+
+		if (dfa.npos + n > MAX_POS - 1)
+			return -1;
+		for (k = 0; k < n; k++) {
+			dfa.set[dfa.npos] = items[i].set;
+			if (k < items[i].min)
+				dfa.node[dfa.npos] = NODE_ONE;
+			else if (items[i].max == INF)
+				dfa.node[dfa.npos] = NODE_LOOP;
+			else
+				dfa.node[dfa.npos] = NODE_OPT;
+			dfa.npos++;
+		}
+	}
+	return 0;
+}
+
+#define HAS(s, k) ((s)[(k) / 8] & (1 << ((k) % 8)))
+#define ADD(s, k) ((s)[(k) / 8] |= (unsigned char)(1 << ((k) % 8)))
+
+/*
+ * Adds the positions which can be skipped to, behind optional ones.
+ */
+static void closure(unsigned char *s)
+{
+	int k;
+
+	for (k = 0; k < dfa.npos; k++) {
+		if (HAS(s, k) && dfa.node[k] != NODE_ONE)
+			ADD(s, k + 1);
+	}
+}
+
+/*
+ * Returns the number of state s, adding it if it is new.  State 0 is
+ * the empty set, the dead state.
+ */
+static int add_state(const unsigned char *s)
+{
+	int i;
+
+	for (i = 0; i < dfa.nstates; i++) {
+		if (!memcmp(dfa.states[i], s, MAX_POS / 8))
+			return i;
+	}
+	if (dfa.nstates == MAX_STATES)
+		return -1;
+	memcpy(dfa.states[dfa.nstates], s, MAX_POS / 8);
+	dfa.accept[dfa.nstates] = HAS(s, dfa.npos) ? 1 : 0;
+	return dfa.nstates++;
+}
+
+/*
+ * Puts bytes which no position tells apart into the same class.
+ */
+static void make_classes(void)
+{
+	int c, d, k;
+
+	dfa.nclasses = 0;
+	for (c = 0; c < 256; c++) {
+		for (d = 0; d < c; d++) {
+			for (k = 0; k < dfa.npos; k++) {
+				if (dfa.set[k][c] != dfa.set[k][d])
+					break;
+			}
+			if (k == dfa.npos)
+				break;
+		}
+		dfa.classes[c] = d < c ? dfa.classes[d] :
+			(unsigned char)dfa.nclasses++;
+	}
+}
+
+static int build(void)
+{
+	unsigned char s[MAX_POS / 8];
+	int i, c, k, n, cls;
+
+	make_classes();
+
+	dfa.nstates = 0;
+	memset(s, 0, sizeof(s));
+	(void)add_state(s);
+	ADD(s, 0);
+	closure(s);
+	(void)add_state(s);
+
+	for (i = 1; i < dfa.nstates; i++) {
+		for (cls = 0; cls < dfa.nclasses; cls++) {
+			for (c = 0; dfa.classes[c] != cls; c++)
+				;
+			memset(s, 0, sizeof(s));
+			for (k = 0; k < dfa.npos; k++) {
+				if (!HAS(dfa.states[i], k) || !dfa.set[k][c])
+					continue;
+				ADD(s, dfa.node[k] == NODE_LOOP ? k : k + 1);
+			}
+			closure(s);
+			if ((n = add_state(s)) == -1)
+				return -1;
+			dfa.next[i][cls] = n;
+		}
+	}
+
+	dfa.first = -1;
+	for (c = 0; c < 256; c++) {
+		if (!dfa.next[1][dfa.classes[c]])
+			continue;
+		if (dfa.first != -1) {
+			dfa.first = -1;
+			break;
+		}
+		dfa.first = c;
+	}
+	if (dfa.accept[1])
+		dfa.first = -1;
+	return 0;
+}
+
+static void print_literal(const char *s, size_t len)
+{
+	size_t i;
+
+	putchar('"');
+	for (i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)s[i];
+
+		if (c == '\n')
+			printf("\\n");
+		else if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20 || c >= 0x7f)
+			printf("\\%03o", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+static void write_dfa(size_t n)
+{
+	int i, c;
+
+	printf("\n/* ");
+	print_literal(rules[n].pattern, rules[n].len);
+	printf(" */\n");
+
+	printf("static const unsigned char dfa_classes_%lu[256] = {",
+	       (unsigned long)n);
+	for (c = 0; c < 256; c++)
+		printf("%s%d,", c % 16 ? " " : "\n\t", dfa.classes[c]);
+	printf("\n};\n");
+
+	printf("static const unsigned short dfa_next_%lu[%d] = {",
+	       (unsigned long)n, dfa.nstates * dfa.nclasses);
+	for (i = 0; i < dfa.nstates; i++) {
+		printf("\n\t");
+		for (c = 0; c < dfa.nclasses; c++)
+			printf("%s%d,", c ? " " : "",
+			       i ? dfa.next[i][c] : 0);
+	}
+	printf("\n};\n");
+
+	printf("static const unsigned char dfa_accept_%lu[%d] = {\n\t",
+	       (unsigned long)n, dfa.nstates);
+	for (i = 0; i < dfa.nstates; i++)
+		printf("%s%d,", i ? " " : "", dfa.accept[i]);
+	printf("\n};\n");
+}
+
+static int cmp_rules(const void *a, const void *b)
+{
+	return strcmp(((const struct rule *)a)->pattern,
+		      ((const struct rule *)b)->pattern);
+}
+
+int main(void)
+{
+	int bol[MAX_RULES], eol[MAX_RULES], first[MAX_RULES];
+	int nclasses[MAX_RULES];
+	size_t i;
+
+	if (read_def(stdin) == -1)
+		return EXIT_FAILURE;
+	qsort(rules, nrules, sizeof(rules[0]), cmp_rules);
+
+	printf("/*\n"
+	       " * rules.h: Generated by gen-rules from rules.def,"
+	       " do not edit\n"
+	       " */\n\n"
+	       "#ifndef RULES_H\n"
+	       "#define RULES_H\n\n"
+	       "/*\n"
+	       " * A pattern as an automaton.  Bytes are mapped to classes"
+	       " first, next\n"
+	       " * holds the state behind each state and class.  State 0"
+	       " is dead, a\n"
+	       " * match starts in state 1.\n"
+	       " */\n"
+	       "struct regex_dfa {\n"
+	       "\tconst char *regex;\n"
+	       "\tint bol, eol;\n"
+	       "\tint first;\t/* the only byte a match starts with, or -1 */\n"
+	       "\tconst unsigned char *classes;\n"
+	       "\tunsigned int nclasses;\n"
+	       "\tconst unsigned short *next;\n"
+	       "\tconst unsigned char *accept;\n"
+	       "};\n");
+
+	for (i = 0; i < nrules; i++) {
+		if (parse(&rules[i]) == -1 || expand() == -1) {
+			fprintf(stderr, "gen-rules: line %d: unsupported "
+				"pattern\n", rules[i].line);
+			return EXIT_FAILURE;
+		}
+		if (build() == -1) {
+			fprintf(stderr, "gen-rules: line %d: too many "
+				"states\n", rules[i].line);
+			return EXIT_FAILURE;
+		}
+		bol[i] = dfa.bol;
+		eol[i] = dfa.eol;
+		first[i] = dfa.first;
+		nclasses[i] = dfa.nclasses;
+		write_dfa(i);
+	}
+
+	printf("\n/* sorted by strcmp() */\n"
+	       "static const struct regex_dfa dfa_table[%lu] = {\n",
+	       (unsigned long)nrules);
+	for (i = 0; i < nrules; i++) {
+		printf("\t{ ");
+		print_literal(rules[i].pattern, rules[i].len);
+		printf(", %d, %d, %d, dfa_classes_%lu, %d, dfa_next_%lu, "
+		       "dfa_accept_%lu },\n", bol[i], eol[i], first[i],
+		       (unsigned long)i, nclasses[i], (unsigned long)i,
+		       (unsigned long)i);
+	}
+	printf("};\n\n"
+	       "/*\n"
+	       " * Returns the automaton of regex, or NULL if it isn't in"
+	       " the table.\n"
+	       " */\n"
+	       "static const struct regex_dfa *dfa_lookup(const char *regex)\n"
+	       "{\n"
+	       "\tsize_t lo = 0, hi = %lu;\n\n"
+	       "\twhile (lo < hi) {\n"
+	       "\t\tsize_t mid = (lo + hi) / 2;\n"
+	       "\t\tint r = strcmp(regex, dfa_table[mid].regex);\n\n"
+	       "\t\tif (r == 0)\n"
+	       "\t\t\treturn &dfa_table[mid];\n"
+	       "\t\tif (r < 0)\n"
+	       "\t\t\thi = mid;\n"
+	       "\t\telse\n"
+	       "\t\t\tlo = mid + 1;\n"
+	       "\t}\n"
+	       "\treturn NULL;\n"
+	       "}\n\n"
+	       "#endif /* RULES_H */\n", (unsigned long)nrules);
+
+	return fflush(stdout) == EOF ? EXIT_FAILURE : EXIT_SUCCESS;
+}
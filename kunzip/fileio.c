@@ -1,5 +1,10 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "fileio.h"
+#include "../mem.h"
 
 /*
 
@@ -11,34 +16,128 @@ version 2 as published by the Free Software Foundation
 
 */
 
-int read_int(FILE *in)
+/* either fp is open, or the archive is the len bytes at data */
+struct zfile {
+	FILE *fp;
+	const unsigned char *data;
+	size_t len;
+	size_t pos;
+};
+
+ZFILE *zf_open(const char *filename)
 {
-	int c;
+	ZFILE *in;
+	FILE *fp;
+
+	fp = fopen(filename, "rb");
+	if (fp == 0)
+		return NULL;
+
+	in = ymalloc(sizeof(ZFILE));
+	in->fp = fp;
+	in->data = NULL;
+	in->len = 0;
+	in->pos = 0;
+	return in;
+}
 
-	c = getc(in);
-	c = c | (getc(in) << 8);
-	c = c | (getc(in) << 16);
-	c = c | (getc(in) << 24);
+/* the data is not copied and must stay until zf_close() */
+ZFILE *zf_open_mem(const char *data, size_t len)
+{
+	ZFILE *in = ymalloc(sizeof(ZFILE));
 
-	return c;
+	in->fp = NULL;
+	in->data = (const unsigned char *)data;
+	in->len = len;
+	in->pos = 0;
+	return in;
 }
 
-int read_word(FILE *in)
+void zf_close(ZFILE *in)
 {
-	int c;
+	if (in->fp)
+		fclose(in->fp);
+	yfree(in);
+}
 
-	c = getc(in);
-	c = c | (getc(in) << 8);
+size_t zf_read(ZFILE *in, void *buf, size_t len)
+{
+	if (in->fp)
+		return fread(buf, 1, len, in->fp);
+
+	if (in->pos >= in->len)
+		return 0;
+	if (len > in->len - in->pos)
+		len = in->len - in->pos;
+	memcpy(buf, in->data + in->pos, len);
+	in->pos += len;
+	return len;
+}
+
+int zf_getc(ZFILE *in)
+{
+	if (in->fp)
+		return getc(in->fp);
 
-	return c;
+	return in->pos < in->len ? in->data[in->pos++] : EOF;
 }
 
-int read_chars(FILE *in, char *s, int count)
+int zf_error(ZFILE *in)
+{
+	return in->fp ? ferror(in->fp) : 0;
+}
+
+/* like fseeko(), a position behind the end of the data is allowed */
+int zf_seek(ZFILE *in, off_t offset, int whence)
+{
+	off_t base;
+
+	if (in->fp)
+		return fseeko(in->fp, offset, whence);
+
+	base = whence == SEEK_SET ? 0 :
+		whence == SEEK_CUR ? (off_t)in->pos : (off_t)in->len;
+	if (offset < -base)
+		return -1;
+	in->pos = (size_t)(base + offset);
+	return 0;
+}
+
+off_t zf_tell(ZFILE *in)
+{
+	if (in->fp)
+		return ftello(in->fp);
+
+	return (off_t)in->pos;
+}
+
+/* the readers return -1, or 0xffffffff, at the end of the file */
+unsigned int read_int(ZFILE *in)
+{
+	unsigned char b[4];
+
+	if (read_buffer(in, b, 4) != 4)
+		return 0xffffffff;
+
+	return get_int(b);
+}
+
+int read_word(ZFILE *in)
+{
+	unsigned char b[2];
+
+	if (read_buffer(in, b, 2) != 2)
+		return -1;
+
+	return (int)get_word(b);
+}
+
+int read_chars(ZFILE *in, char *s, int count)
 {
 	int t;
 
 	for (t = 0; t < count; t++) {
-		s[t] = getc(in);
+		s[t] = zf_getc(in);
 	}
 
 	s[t] = 0;
@@ -46,35 +145,54 @@ int read_chars(FILE *in, char *s, int count)
 	return 0;
 }
 
-int read_int_b(FILE *in)
+unsigned int get_word(const unsigned char *s)
+{
+	return (unsigned int)s[0] | (unsigned int)s[1] << 8;
+}
+
+unsigned int get_int(const unsigned char *s)
+{
+	return (unsigned int)s[0] | (unsigned int)s[1] << 8 |
+		(unsigned int)s[2] << 16 | (unsigned int)s[3] << 24;
+}
+
+uint64_t get_int64(const unsigned char *s)
+{
+	return (uint64_t)get_int(s) | (uint64_t)get_int(s + 4) << 32;
+}
+
+unsigned int read_int_b(ZFILE *in)
 {
-	int c;
+	unsigned char b[4];
 
-	c = getc(in);
-	c = (c << 8) + getc(in);
-	c = (c << 8) + getc(in);
-	c = (c << 8) + getc(in);
+	if (read_buffer(in, b, 4) != 4)
+		return 0xffffffff;
 
-	return c;
+	return (unsigned int)b[0] << 24 | (unsigned int)b[1] << 16 |
+		(unsigned int)b[2] << 8 | (unsigned int)b[3];
 }
 
-int read_word_b(FILE *in)
+int read_word_b(ZFILE *in)
 {
-	int c;
+	unsigned char b[2];
 
-	c = getc(in);
-	c = (c << 8) + getc(in);
+	if (read_buffer(in, b, 2) != 2)
+		return -1;
 
-	return c;
+	return b[0] << 8 | b[1];
 }
 
-int read_buffer(FILE *in, unsigned char *buffer, int len)
+int read_buffer(ZFILE *in, unsigned char *buffer, int len)
 {
 	int t;
+	int r;
 
 	t = 0;
 	while (t < len) {
-		t = t + fread(buffer + t, 1, len - t, in);
+		r = (int)zf_read(in, buffer + t, (size_t)(len - t));
+		if (r == 0)
+			break;	/* end of file or error */
+		t = t + r;
 	}
 
 	return t;
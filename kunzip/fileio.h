@@ -1,10 +1,30 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
 
-int read_int(FILE *in);
-int read_word(FILE *in);
+/* an archive, in a file or in memory */
+typedef struct zfile ZFILE;
 
-int read_chars(FILE *in, char *s, int count);
+ZFILE *zf_open(const char *filename);
+ZFILE *zf_open_mem(const char *data, size_t len);
+void zf_close(ZFILE *in);
 
-int read_int_b(FILE *in);
-int read_word_b(FILE *in);
+size_t zf_read(ZFILE *in, void *buf, size_t len);
+int zf_getc(ZFILE *in);
+int zf_error(ZFILE *in);
+int zf_seek(ZFILE *in, off_t offset, int whence);
+off_t zf_tell(ZFILE *in);
 
-int read_buffer(FILE *in, unsigned char *buffer, int len);
+unsigned int read_int(ZFILE *in);
+int read_word(ZFILE *in);
+
+int read_chars(ZFILE *in, char *s, int count);
+
+unsigned int get_word(const unsigned char *s);
+unsigned int get_int(const unsigned char *s);
+uint64_t get_int64(const unsigned char *s);
+
+unsigned int read_int_b(ZFILE *in);
+int read_word_b(ZFILE *in);
+
+int read_buffer(ZFILE *in, unsigned char *buffer, int len);
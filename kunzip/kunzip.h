@@ -1,3 +1,5 @@
+#include <stdio.h>
+#include <sys/types.h>
 #include "../strbuf.h"
 
 /*
@@ -14,7 +16,53 @@ http://www.mikekohn.net/
 
 */
 
-STRBUF *kunzip_next_tobuf(char *zip_filename, int offset);
+/*
+
+Offsets are off_t and sizes are 64 bits wide, so archives and files
+beyond 4 GB work where off_t is 64 bits wide, e.g. on 32 bit Linux with
+_FILE_OFFSET_BITS=64.  Their sizes are read from the ZIP64 extra field
+and the ZIP64 data descriptor.
+
+*/
+
+/*
+
+kunzip_next_tobuf - Uncompress the file at offset in a zip archive into
+                    a new string buffer.  Returns NULL if the archive
+                    is corrupted or truncated or if the file uses an
+                    unsupported compression method.
+
+*/
+
+STRBUF *kunzip_next_tobuf(char *zip_filename, off_t offset);
+
+/*
+
+kunzip_entry_open - Open the file at offset in a zip archive for
+                    reading it piece by piece.  Returns NULL if there
+                    is no file at offset or if it uses an unsupported
+                    compression method.
+
+kunzip_entry_read - Uncompress up to len bytes into buf.  Returns the
+                    number of bytes, 0 at the end of the file or -1
+                    if the archive is corrupted or truncated.
+
+kunzip_entry_close - Close the file and free all resources.
+
+Example:
+
+  entry=kunzip_entry_open("test.zip",offset);
+  while ((len=kunzip_entry_read(entry,buf,sizeof(buf)))>0)
+    fwrite(buf,1,len,stdout);
+  kunzip_entry_close(entry);
+
+*/
+
+typedef struct kunzip_entry KUNZIP_ENTRY;
+
+KUNZIP_ENTRY *kunzip_entry_open(char *zip_filename, off_t offset);
+int kunzip_entry_read(KUNZIP_ENTRY *entry, char *buf, int len);
+void kunzip_entry_close(KUNZIP_ENTRY *entry);
 
 /*
 
@@ -48,8 +96,60 @@ Examples:
 
 */
 
-int kunzip_get_offset_by_name(char *zip_filename, char *compressed_filename,
-			      int match_flags, int skip_offset);
+off_t kunzip_get_offset_by_name(char *zip_filename, char *compressed_filename,
+				int match_flags, off_t skip_offset);
+
+/*
+
+kunzip_open - Open a zip archive for more than one call below.  Returns
+                    NULL if it can't be opened.
+
+kunzip_open_mem - The same for an archive of len bytes in memory, which
+                    is not copied and must stay until kunzip_close().
+                    Nothing is read from the filesystem.
+
+kunzip_archive_offset_by_name, kunzip_archive_tobuf - Like
+                    kunzip_get_offset_by_name() and kunzip_next_tobuf(),
+                    but for an open archive.
+
+kunzip_close - Close the archive and free all resources.
+
+Example:
+
+  zip=kunzip_open_mem(data,len);
+  offset=kunzip_archive_offset_by_name(zip,"mike.c",3,-1);
+  buf=kunzip_archive_tobuf(zip,offset);
+  kunzip_close(zip);
+
+*/
+
+typedef struct zfile KUNZIP_ARCHIVE;
+
+KUNZIP_ARCHIVE *kunzip_open(char *zip_filename);
+KUNZIP_ARCHIVE *kunzip_open_mem(const char *data, size_t len);
+off_t kunzip_archive_offset_by_name(KUNZIP_ARCHIVE *zip,
+				    char *compressed_filename,
+				    int match_flags, off_t skip_offset);
+STRBUF *kunzip_archive_tobuf(KUNZIP_ARCHIVE *zip, off_t offset);
+void kunzip_close(KUNZIP_ARCHIVE *zip);
+
+/*
+
+kunzip_set_limits - Limit the size of the files which are extracted by
+                    kunzip_next_tobuf() and kunzip_entry_read() to
+                    max_len bytes and max_ratio times their compressed
+                    size, see inflate_exceeds() in strbuf.h.  0 means
+                    no limit, which is the default.  Larger files
+                    fail with errno set to EFBIG, already when the
+                    header announces them.
+
+Example:
+
+  kunzip_set_limits(100<<20,1000);
+
+*/
+
+void kunzip_set_limits(size_t max_len, unsigned long max_ratio);
 
 /*
 
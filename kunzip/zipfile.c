@@ -1,3 +1,5 @@
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,11 +29,40 @@ version 2 as published by the Free Software Foundation
 
 /* #define _GNU_SOURCE */
 
-unsigned int copy_file_tobuf(FILE *in, STRBUF *out, int len)
+/* set by kunzip_set_limits() */
+static size_t limit_len;
+static unsigned long limit_ratio;
+
+void kunzip_set_limits(size_t max_len, unsigned long max_ratio)
+{
+	limit_len = max_len;
+	limit_ratio = max_ratio;
+}
+
+/* sizes which don't fit into an unsigned long are over any limit */
+static unsigned long clamp_size(uint64_t size)
+{
+	return size > (unsigned long)-1 ? (unsigned long)-1 : (unsigned long)size;
+}
+
+/* checks the sizes in the header before anything is inflated */
+static int header_exceeds(struct zip_local_file_header_t *local_file_header)
+{
+	if (inflate_exceeds(clamp_size(local_file_header->uncompressed_size),
+			    clamp_size(local_file_header->compressed_size),
+			    limit_len, limit_ratio)) {
+		errno = EFBIG;
+		return 1;
+	}
+	return 0;
+}
+
+unsigned int copy_file_tobuf(ZFILE *in, STRBUF *out, uint64_t len)
 {
 	unsigned char buffer[BUFFER_SIZE];
 	uLong checksum;
-	int t, r;
+	uint64_t t;
+	int r, n;
 
 	checksum = crc32(0L, Z_NULL, 0);
 
@@ -41,21 +72,125 @@ unsigned int copy_file_tobuf(FILE *in, STRBUF *out, int len)
 		if (t + BUFFER_SIZE < len) {
 			r = BUFFER_SIZE;
 		} else {
-			r = len - t;
+			r = (int)(len - t);
 		}
 
-		read_buffer(in, buffer, r);
-		strbuf_append_n(out, (char *)buffer, r);
-		checksum = crc32(checksum, buffer, r);
-		t = t + r;
+		n = read_buffer(in, buffer, r);
+		strbuf_append_n(out, (char *)buffer, n);
+		checksum = crc32(checksum, buffer, n);
+		t = t + n;
+
+		if (n < r)
+			break;	/* truncated */
 	}
 
 	return checksum;
 }
 
-int read_zip_header(FILE *in,
+/* the data descriptor of a bit 3 entry is the first one after the
+   data whose compressed size matches the distance.  Its sizes have
+   8 bytes in ZIP64 archives, 4 otherwise.  The search reads blocks,
+   keeping the last 23 bytes in case a descriptor starts there */
+static int find_descriptor(ZFILE *in, off_t data_start,
+			   struct zip_local_file_header_t *local_file_header)
+{
+	unsigned char buffer[BUFFER_SIZE];
+	unsigned char *p;
+	off_t pos = data_start;	/* file offset of buffer[0] */
+	size_t have = 0, need, r, i;
+	uint64_t dist;
+
+	zf_seek(in, data_start, SEEK_SET);
+
+	do {
+		r = zf_read(in, buffer + have, BUFFER_SIZE - have);
+		have += r;
+
+		/* at the end of the file, the short form may be last */
+		need = r ? 24 : 16;
+		for (i = 0; i + need <= have; i = (size_t)(p - buffer) + 1) {
+			p = memchr(buffer + i, 'P', have - (need - 1) - i);
+			if (p == NULL) {
+				i = have - (need - 1);
+				break;
+			}
+
+			if (p[1] != 'K' || p[2] != 7 || p[3] != 8)
+				continue;
+
+			dist = (uint64_t)(pos + (p - buffer) - data_start);
+			if (p + 24 <= buffer + have && get_int64(p + 8) == dist) {
+				local_file_header->crc_32 = get_int(p + 4);
+				local_file_header->compressed_size = get_int64(p + 8);
+				local_file_header->uncompressed_size = get_int64(p + 16);
+				local_file_header->descriptor_length = 24;
+				return 0;
+			}
+			if (get_int(p + 8) == dist) {
+				local_file_header->crc_32 = get_int(p + 4);
+				local_file_header->compressed_size = get_int(p + 8);
+				local_file_header->uncompressed_size = get_int(p + 12);
+				local_file_header->descriptor_length = 16;
+				return 0;
+			}
+		}
+
+		memmove(buffer, buffer + i, have - i);
+		pos += (off_t)i;
+		have -= i;
+	} while (r > 0);
+
+	return -1;
+}
+
+/* sizes of 0xffffffff are in the ZIP64 extra field, which must have
+   both of them in a local header.  data_start is behind the header */
+static int read_zip64_extra(ZFILE *in, off_t data_start,
+			    struct zip_local_file_header_t *local_file_header)
+{
+	unsigned char *extra, *p, *end;
+	int len = local_file_header->extra_field_length;
+	int r = 0;
+
+	if (len == 0)
+		return 0;
+
+	extra = ymalloc((size_t)len);
+	zf_seek(in, data_start + local_file_header->file_name_length, SEEK_SET);
+	if (read_buffer(in, extra, len) != len) {
+		yfree(extra);
+		return -1;
+	}
+	zf_seek(in, data_start, SEEK_SET);
+
+	end = extra + len;
+	for (p = extra; p + 4 <= end; p += 4 + get_word(p + 2)) {
+		if (get_word(p) != 0x0001)
+			continue;
+
+		local_file_header->zip64 = 1;
+		if (local_file_header->uncompressed_size == 0xffffffff ||
+		    local_file_header->compressed_size == 0xffffffff) {
+			if (p + 4 + 16 > end) {
+				r = -1;
+				break;
+			}
+			local_file_header->uncompressed_size = get_int64(p + 4);
+			local_file_header->compressed_size = get_int64(p + 12);
+		}
+		break;
+	}
+
+	yfree(extra);
+	return r;
+}
+
+int read_zip_header(ZFILE *in,
 		    struct zip_local_file_header_t *local_file_header)
 {
+	int descriptor;
+	off_t data_start;
+
 	local_file_header->signature = read_int(in);
 	if (local_file_header->signature != 0x04034b50)
 		return -1;
@@ -67,55 +202,48 @@ int read_zip_header(FILE *in,
 	local_file_header->last_mod_file_date = read_word(in);
 	local_file_header->crc_32 = read_int(in);
 
-	local_file_header->compressed_size = read_int(in);
-	if (local_file_header->uncompressed_size < 1)
-		return -1;
+	/* if the 4th bit in the general_purpose_bit_flag is set,
+	   crc32, compressed_size and uncompressed_size are written
+	   into a data descriptor that follows the compressed
+	   data */
+	descriptor = local_file_header->general_purpose_bit_flag & 8;
 
+	local_file_header->compressed_size = read_int(in);
 	local_file_header->uncompressed_size = read_int(in);
-	if (local_file_header->uncompressed_size < 1)
-		return -1;
 
 	local_file_header->file_name_length = read_word(in);
 	if (local_file_header->file_name_length < 1)
 		return -1;
 
 	local_file_header->extra_field_length = read_word(in);
-	if (local_file_header->extra_field_length < 1)
+	if (local_file_header->extra_field_length < 0)
 		return -1;
 
 	local_file_header->descriptor_length = 0;
+	local_file_header->zip64 = 0;
+	data_start = zf_tell(in);
 
-	/* if the 4th bit in the general_purpose_bit_flag is set,
-	   crc32, compressed_size and uncompressed_size are written
-	   into a data descriptor that follows the compressed
-	   data */
-	if (local_file_header->general_purpose_bit_flag & 8) {
-		long data_start = ftell(in);
-		unsigned int signature;
-
-		while (1) {
-			signature = read_int(in);
-
-			if (feof(in)) {
-				fseek(in, data_start, SEEK_SET);
-				return -1;
-			}
-
-			if (signature == 0x08074b50) {
-				local_file_header->crc_32 = read_int(in);
-				local_file_header->compressed_size =
-					read_int(in);
-				local_file_header->uncompressed_size =
-					read_int(in);
-				local_file_header->descriptor_length = 16;
-				fseek(in, data_start, SEEK_SET);
-				return 0;
-			}
+	if ((descriptor ||
+	     local_file_header->compressed_size == 0xffffffff ||
+	     local_file_header->uncompressed_size == 0xffffffff) &&
+	    read_zip64_extra(in, data_start, local_file_header) == -1)
+		return -1;
 
-			fseek(in, -3, SEEK_CUR);
-		}
+	if (descriptor) {
+		int r;
 
+		r = find_descriptor(in, data_start +
+				    local_file_header->file_name_length +
+				    local_file_header->extra_field_length,
+				    local_file_header);
+		zf_seek(in, data_start, SEEK_SET);
+		if (r == -1)
+			return -1;
 	}
+
+	if (local_file_header->compressed_size == 0 ||
+	    local_file_header->uncompressed_size == 0)
+		return -1;
 	return 0;
 }
 
@@ -139,8 +267,10 @@ int print_zip_header(struct zip_local_file_header_t *local_file_header)
 	printf("Last Mod File Date: %d\n",
 	       local_file_header->last_mod_file_date);
 	printf("CRC-32: %d\n", local_file_header->crc_32);
-	printf("Compressed Size: %d\n", local_file_header->compressed_size);
-	printf("Uncompressed Size: %d\n", local_file_header->uncompressed_size);
+	printf("Compressed Size: %llu\n",
+	       (unsigned long long)local_file_header->compressed_size);
+	printf("Uncompressed Size: %llu\n",
+	       (unsigned long long)local_file_header->uncompressed_size);
 	printf("File Name Length: %d\n", local_file_header->file_name_length);
 	printf("Extra Field Length: %d\n",
 	       local_file_header->extra_field_length);
@@ -150,12 +280,22 @@ int print_zip_header(struct zip_local_file_header_t *local_file_header)
 }
 #endif
 
-STRBUF *kunzip_file_tobuf(FILE *in)
+/* the input of strbuf_append_inflate_fn() */
+static long read_zfile(void *in, char *buf, size_t len)
+{
+	size_t r = zf_read(in, buf, len);
+
+	if (r < len && zf_error(in))
+		return -1;
+	return (long)r;
+}
+
+STRBUF *kunzip_file_tobuf(ZFILE *in)
 {
 	STRBUF *out;
 	struct zip_local_file_header_t local_file_header;
 	int checksum;
-	long marker;
+	off_t marker;
 
 	if (read_zip_header(in, &local_file_header) == -1)
 		return NULL;
@@ -170,12 +310,18 @@ STRBUF *kunzip_file_tobuf(FILE *in)
 	read_chars(in, (char *)local_file_header.extra_field,
 		   local_file_header.extra_field_length);
 
-	marker = ftell(in);
+	marker = zf_tell(in);
 
 #ifdef DEBUG
 	print_zip_header(&local_file_header);
 #endif
 
+	if (header_exceeds(&local_file_header)) {
+		yfree(local_file_header.file_name);
+		yfree(local_file_header.extra_field);
+		return NULL;
+	}
+
 	out = strbuf_new();
 
 	if (local_file_header.compression_method == 0) {
@@ -183,11 +329,22 @@ STRBUF *kunzip_file_tobuf(FILE *in)
 			copy_file_tobuf(in, out,
 					local_file_header.uncompressed_size);
 	} else if (local_file_header.compression_method == Z_DEFLATED) {
-		(void)strbuf_append_inflate(out, in);
+		/* the header may lie about the size */
+		if (strbuf_append_inflate_fn(out, read_zfile, in, limit_len,
+					     limit_ratio) == (size_t)-1) {
+			yfree(local_file_header.file_name);
+			yfree(local_file_header.extra_field);
+			strbuf_free(out);
+			return NULL;
+		}
 		checksum = strbuf_crc32(out);
 	} else {
 		fprintf(stderr, "Unknown compression method\n");
-		exit(EXIT_FAILURE);
+		yfree(local_file_header.file_name);
+		yfree(local_file_header.extra_field);
+		strbuf_free(out);
+		errno = EINVAL;
+		return NULL;
 	}
 
 	if ((unsigned int)checksum != local_file_header.crc_32
@@ -201,35 +358,181 @@ STRBUF *kunzip_file_tobuf(FILE *in)
 	yfree(local_file_header.file_name);
 	yfree(local_file_header.extra_field);
 
-	fseek(in, marker + local_file_header.compressed_size, SEEK_SET);
-
-	if ((local_file_header.general_purpose_bit_flag & 8) != 0) {
-		read_int(in);
-		read_int(in);
-		read_int(in);
-	}
+	zf_seek(in, marker + (off_t)local_file_header.compressed_size +
+	       local_file_header.descriptor_length, SEEK_SET);
 
 	return out;
 }
 
-STRBUF *kunzip_next_tobuf(char *zip_filename, int offset)
+KUNZIP_ARCHIVE *kunzip_open(char *zip_filename)
+{
+	return zf_open(zip_filename);
+}
+
+KUNZIP_ARCHIVE *kunzip_open_mem(const char *data, size_t len)
+{
+	return zf_open_mem(data, len);
+}
+
+void kunzip_close(KUNZIP_ARCHIVE *zip)
 {
-	FILE *in;
+	zf_close(zip);
+}
+
+STRBUF *kunzip_archive_tobuf(KUNZIP_ARCHIVE *zip, off_t offset)
+{
+	zf_seek(zip, offset, SEEK_SET);
+
+	return kunzip_file_tobuf(zip);
+}
+
+STRBUF *kunzip_next_tobuf(char *zip_filename, off_t offset)
+{
+	ZFILE *in;
 	STRBUF *buf;
 
-	in = fopen(zip_filename, "rb");
+	in = zf_open(zip_filename);
 	if (in == 0) {
 		return NULL;
 	}
 
-	fseek(in, offset, SEEK_SET);
-
-	buf = kunzip_file_tobuf(in);
-	fclose(in);
+	buf = kunzip_archive_tobuf(in, offset);
+	zf_close(in);
 
 	return buf;
 }
 
+struct kunzip_entry {
+	ZFILE *in;
+	struct zip_local_file_header_t header;
+	z_stream strm;
+	uint64_t left;		/* stored bytes not yet read */
+	int done;
+	uLong checksum;
+	unsigned char buffer[BUFFER_SIZE];
+};
+
+KUNZIP_ENTRY *kunzip_entry_open(char *zip_filename, off_t offset)
+{
+	KUNZIP_ENTRY *entry;
+	struct zip_local_file_header_t *header;
+
+	entry = ymalloc(sizeof(KUNZIP_ENTRY));
+	header = &entry->header;
+
+	entry->in = zf_open(zip_filename);
+	if (entry->in == 0) {
+		yfree(entry);
+		return NULL;
+	}
+
+	zf_seek(entry->in, offset, SEEK_SET);
+
+	if (read_zip_header(entry->in, header) == -1 ||
+	    (header->compression_method != 0 &&
+	     header->compression_method != Z_DEFLATED) ||
+	    header_exceeds(header)) {
+		zf_close(entry->in);
+		yfree(entry);
+		return NULL;
+	}
+
+	/* skip file name and extra field */
+	zf_seek(entry->in, header->file_name_length +
+	      header->extra_field_length, SEEK_CUR);
+
+	entry->left = header->uncompressed_size;
+	entry->done = 0;
+	entry->checksum = crc32(0L, Z_NULL, 0);
+
+	if (header->compression_method == Z_DEFLATED) {
+		entry->strm.zalloc   = Z_NULL;
+		entry->strm.zfree    = Z_NULL;
+		entry->strm.opaque   = Z_NULL;
+		entry->strm.next_in  = Z_NULL;
+		entry->strm.avail_in = 0;
+
+		if (inflateInit2(&entry->strm, -15) != Z_OK) {
+			zf_close(entry->in);
+			yfree(entry);
+			return NULL;
+		}
+	}
+
+	return entry;
+}
+
+int kunzip_entry_read(KUNZIP_ENTRY *entry, char *buf, int len)
+{
+	int r;
+
+	if (entry->done || len <= 0)
+		return 0;
+
+	if (entry->header.compression_method == 0) {
+		if ((uint64_t)len > entry->left)
+			len = (int)entry->left;
+		r = (int)zf_read(entry->in, buf, (size_t)len);
+		if (r < len)
+			return -1;
+		entry->left -= r;
+		if (entry->left == 0)
+			entry->done = 1;
+	} else {
+		int z_ret;
+
+		entry->strm.next_out  = (Bytef *)buf;
+		entry->strm.avail_out = (uInt)len;
+
+		do {
+			if (entry->strm.avail_in == 0) {
+				entry->strm.avail_in = (uInt)zf_read(entry->in,
+								     entry->buffer,
+								     BUFFER_SIZE);
+				entry->strm.next_in = entry->buffer;
+				if (entry->strm.avail_in == 0)
+					return -1;	/* truncated */
+			}
+
+			z_ret = inflate(&entry->strm, Z_SYNC_FLUSH);
+			if (z_ret == Z_STREAM_END) {
+				entry->done = 1;
+				break;
+			}
+			if (z_ret != Z_OK && z_ret != Z_BUF_ERROR)
+				return -1;
+		} while (entry->strm.avail_out == (uInt)len);
+
+		if (inflate_exceeds(entry->strm.total_out, entry->strm.total_in,
+				    limit_len, limit_ratio)) {
+			errno = EFBIG;
+			return -1;
+		}
+
+		r = len - (int)entry->strm.avail_out;
+	}
+
+	entry->checksum = crc32(entry->checksum, (Bytef *)buf, r);
+
+	if (entry->done && entry->checksum != entry->header.crc_32
+	    && entry->header.crc_32 != 0) {
+		fprintf(stderr,
+			"Warning: Checksum does not match: %d %d.\nPossibly the file"
+			" is corrupted otr truncated.\n", (int)entry->checksum,
+			entry->header.crc_32);
+	}
+
+	return r;
+}
+
+void kunzip_entry_close(KUNZIP_ENTRY *entry)
+{
+	if (entry->header.compression_method == Z_DEFLATED)
+		(void)inflateEnd(&entry->strm);
+	zf_close(entry->in);
+	yfree(entry);
+}
+
 /*
   Match Flags:
   bit 0: set to 1 if it should be exact filename match
@@ -238,33 +541,27 @@ STRBUF *kunzip_next_tobuf(char *zip_filename, int offset)
   set to 0 if it should be case insensitive
 */
 
-int kunzip_get_offset_by_name(char *zip_filename, char *compressed_filename,
-			      int match_flags, int skip_offset)
+off_t kunzip_archive_offset_by_name(KUNZIP_ARCHIVE *in,
+				    char *compressed_filename,
+				    int match_flags, off_t skip_offset)
 {
-	FILE *in;
 	struct zip_local_file_header_t local_file_header;
-	int i = 0, curr;
+	int i = 0;
+	off_t curr;
 	char *name = 0;
 	int name_size = 0;
-	long marker;
+	off_t marker;
 
-	in = fopen(zip_filename, "rb");
-	if (in == 0) {
-		return -1;
-	}
-
-	if (skip_offset != -1) {
-		fseek(in, skip_offset, SEEK_SET);
-	}
+	zf_seek(in, skip_offset != -1 ? skip_offset : 0, SEEK_SET);
 
 	while (1) {
-		curr = ftell(in);
+		curr = zf_tell(in);
 		i = read_zip_header(in, &local_file_header);
 		if (i == -1)
 			break;
 
 		if (skip_offset < 0 || curr > skip_offset) {
-			marker = ftell(in);	/* nasty code.. please make it nice later */
+			marker = zf_tell(in);	/* nasty code.. please make it nice later */
 
 			if (name_size < local_file_header.file_name_length + 1) {
 				if (name_size != 0)
@@ -278,7 +575,7 @@ int kunzip_get_offset_by_name(char *zip_filename, char *compressed_filename,
 				   local_file_header.file_name_length);
 			name[local_file_header.file_name_length] = 0;
 
-			fseek(in, marker, SEEK_SET);	/* and part 2 of nasty code */
+			zf_seek(in, marker, SEEK_SET);	/* and part 2 of nasty code */
 
 			if ((match_flags & 1) == 1) {
 				if (strcmp(compressed_filename, name) == 0)
@@ -289,21 +586,37 @@ int kunzip_get_offset_by_name(char *zip_filename, char *compressed_filename,
 			}
 		}
 
-		fseek(in, local_file_header.compressed_size +
-		      local_file_header.file_name_length +
-		      local_file_header.extra_field_length +
-		      local_file_header.descriptor_length, SEEK_CUR);
+		zf_seek(in, (off_t)local_file_header.compressed_size +
+		       local_file_header.file_name_length +
+		       local_file_header.extra_field_length +
+		       local_file_header.descriptor_length, SEEK_CUR);
 
 	}
 
 	if (name_size != 0)
 		yfree(name);
 
-	fclose(in);
-
 	if (i != -1) {
 		return curr;
 	} else {
 		return -1;
 	}
 }
+
+off_t kunzip_get_offset_by_name(char *zip_filename, char *compressed_filename,
+				int match_flags, off_t skip_offset)
+{
+	ZFILE *in;
+	off_t r;
+
+	in = zf_open(zip_filename);
+	if (in == 0) {
+		return -1;
+	}
+
+	r = kunzip_archive_offset_by_name(in, compressed_filename,
+					  match_flags, skip_offset);
+	zf_close(in);
+
+	return r;
+}
@@ -10,11 +10,12 @@ struct zip_local_file_header_t {
 	int last_mod_file_time;
 	int last_mod_file_date;
 	unsigned int crc_32;
-	int compressed_size;
-	int uncompressed_size;
+	uint64_t compressed_size;
+	uint64_t uncompressed_size;
 	int file_name_length;
 	int extra_field_length;
 	char *file_name;
 	unsigned char *extra_field;
 	int descriptor_length;
+	int zip64;		/* has a ZIP64 extra field */
 };
@@ -10,7 +10,22 @@
 
 #include "mem.h"
 
+#if defined(MEMCOUNT) && !defined(MEMDEBUG)
+unsigned long mem_allocs;
+#endif
+
 #ifdef MEMDEBUG
+#ifndef NO_PTHREADS
+#include <pthread.h>
+
+/* the bookkeeping is shared by all threads */
+static pthread_mutex_t meminfo_lock = PTHREAD_MUTEX_INITIALIZER;
+#define meminfo_lock()   pthread_mutex_lock(&meminfo_lock)
+#define meminfo_unlock() pthread_mutex_unlock(&meminfo_lock)
+#else
+#define meminfo_lock()
+#define meminfo_unlock()
+#endif
 static void    meminfo_add(void *p, size_t size, const char *file, int line);
 static void    meminfo_rm(void *p, const char *file, int line);
 static MEMINFO *meminfo_getinfo(void *p);
@@ -37,6 +52,7 @@ static unsigned char magic[] = { 0xFE, 0xDC, 0xBA, 0x98,
  */
 static void meminfo_add(void *p, size_t size, const char *file, int line) {
 
+	meminfo_lock();
 	if(!meminfo)
 		if(atexit(print_memory_stats))
 			warn("Memory statistics will not be shown.");
@@ -59,6 +75,7 @@ static void meminfo_add(void *p, size_t size, const char *file, int line) {
 #endif
 	mem_bytes_malloced += size;
 	mem_num_malloced++;
+	meminfo_unlock();
 }
 
 
@@ -70,6 +87,7 @@ static void meminfo_add(void *p, size_t size, const char *file, int line) {
 static void meminfo_rm(void *p, const char *file, int line) {
 	size_t i;
 
+	meminfo_lock();
 	for(i = 0; i < meminfo_count; ++i) {
 		if(p == meminfo[i]->addr) {
 #ifdef MEMINFO_VERBOSE
@@ -83,6 +101,7 @@ static void meminfo_rm(void *p, const char *file, int line) {
 			meminfo[i] = meminfo[meminfo_count - 1];
 			meminfo_count--;
 			mem_num_freed++;
+			meminfo_unlock();
 			return;
 		}
 	}
@@ -96,12 +115,17 @@ static void meminfo_rm(void *p, const char *file, int line) {
  *  Returns the size of a malloc'ed region.
  */
 static MEMINFO *meminfo_getinfo(void *p) {
+	MEMINFO *info = 0;
 	size_t i;
 
+	meminfo_lock();
 	for(i = 0; i < meminfo_count; ++i)
-		if(p == meminfo[i]->addr)
-			return(meminfo[i]);
-	return(0);
+		if(p == meminfo[i]->addr) {
+			info = meminfo[i];
+			break;
+		}
+	meminfo_unlock();
+	return(info);
 }
 
 
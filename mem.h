@@ -41,6 +41,19 @@ void *ycalloc_dbg(size_t number, size_t size, const char *file, int line);
 #define yrealloc(p, size) yrealloc_dbg(p, size, __FILE__, __LINE__)
 void *yrealloc_dbg(void *p, size_t size, const char *file, int line);
 
+#elif defined(MEMCOUNT)
+
+/*
+ * Counts the allocations, for the benchmarks in t/.  The counter is
+ * not synchronized, so it is only exact on a single thread.
+ */
+extern unsigned long mem_allocs;
+
+#define yfree(p)           free(p)
+#define ymalloc(size)      (mem_allocs++, malloc(size))
+#define ycalloc(num, size) (mem_allocs++, calloc(num, size))
+#define yrealloc(p, size)  (mem_allocs++, realloc(p, size))
+
 #else
 #define yfree(p)           free(p)
 #define ymalloc(size)      malloc(size)
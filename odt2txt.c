@@ -12,6 +12,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #ifdef NO_ICONV
@@ -28,14 +29,32 @@
 #include <limits.h>
 #include <locale.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <zlib.h>
+#ifndef NO_PTHREADS
+#  include <pthread.h>
+#endif
+
+/* --recursive and --cache need openat() and the other directory
+   relative functions of POSIX.1-2008 */
+#if defined(_WIN32) && !defined(NO_OPENAT)
+#  define NO_OPENAT
+#endif
 
+#include "elements.h"
 #include "mem.h"
+#include "odt2txt.h"
+#include "pool.h"
+#include "probes.h"
 #include "regex.h"
+#include "ring.h"
+#include "sched.h"
 #include "strbuf.h"
+#include "zipstream.h"
 #ifdef USE_KUNZIP
 #  include "kunzip/kunzip.h"
 #else
@@ -48,15 +67,59 @@ static int opt_raw;
 static int opt_raw_input = 0;
 static char *opt_encoding;
 static int opt_width = 63;
+static int opt_tokens;		/* TOKENS_* flags, 0 for the text */
+#define TOKENS_ON 0x100		/* --tokens or --count */
 static const char *opt_filename;
 static char *opt_output;
+static int opt_compress;	/* zlib level, 0 for none */
+static int opt_recursive;
+static const char *opt_outdir;
+static int opt_json_lines;
+static int opt_offsets;
+static const char *opt_offsets_file;
+static int opt_cache;
+static const char *opt_cache_file;
 
-#define SUBST_NONE 0
-#define SUBST_SOME 1
-#define SUBST_ALL  2
+#define SUBST_NONE ODT2TXT_SUBST_NONE
+#define SUBST_SOME ODT2TXT_SUBST_SOME
+#define SUBST_ALL  ODT2TXT_SUBST_ALL
 
 static int opt_subst = SUBST_SOME;
 
+#define META_NONE ODT2TXT_META_NONE
+#define META_TEXT ODT2TXT_META_TEXT
+#define META_JSON ODT2TXT_META_JSON
+
+static int opt_meta = META_NONE;
+
+#define SECTION_HEADERS ODT2TXT_HEADERS
+#define SECTION_FOOTERS ODT2TXT_FOOTERS
+#define SECTION_NOTES   ODT2TXT_NOTES
+
+/* the parts which are in styles.xml */
+#define SECTION_PAGES (SECTION_HEADERS | SECTION_FOOTERS)
+
+static int opt_sections;	/* behind the text */
+
+#define OBJECTS_NONE    ODT2TXT_OBJECTS_NONE
+#define OBJECTS_INLINE  ODT2TXT_OBJECTS_INLINE
+#define OBJECTS_SECTION ODT2TXT_OBJECTS_SECTION
+
+static int opt_objects = OBJECTS_NONE;
+static const char *opt_skip =
+	"text:tracked-changes,office:annotation,office:binary-data";
+static int opt_jobs = 1;
+static long opt_memory = -1;	/* MB for --recursive, 0 for no limit */
+
+/* limits for untrusted documents, 0 for no limit */
+static size_t opt_max_size;		/* bytes of content.xml */
+static unsigned long opt_max_ratio;	/* of content.xml to its compressed size */
+static size_t opt_max_output;		/* bytes */
+static long opt_timeout;		/* seconds per document */
+
+/* the --timeout of the document which is converted on several threads */
+static struct timespec doc_deadline;
+
 #ifndef ICONV_CHAR
 #define ICONV_CHAR char
 #endif
@@ -70,7 +133,13 @@ static void show_iconvlist();
 #define RS_E(a,b) (void)regex_subst(buf, (a), _REG_EXEC | _REG_GLOBAL, (void*)(b))
 
 static char *guess_encoding(void);
+static const char *conv_encoding;	/* output encoding used by init_conv() */
 static void write_to_file(STRBUF *outbuf, const char *filename);
+#ifndef NO_OPENAT
+static int write_at(int dir_fd, const char *name, STRBUF *outbuf,
+		    const char *path);
+#endif
+static STRBUF *format_meta(STRBUF *buf, int json);
 
 struct subst {
 	int unicode;
@@ -133,13 +202,22 @@ static struct subst substs[] = {
 	{ 0,      NULL,           NULL },
 };
 
+/* which of substs[] are applied by subst_doc(), set by init_subst() */
+static int subst_active[sizeof(substs) / sizeof(substs[0])];
+
 static void usage(void)
 {
 	printf("odt2txt %s\n"
 	       "Converts an OpenDocument or OpenOffice.org XML File to raw text.\n\n"
-	       "Syntax:   odt2txt [options] filename\n\n"
+	       "Syntax:   odt2txt [options] filename\n"
+	       "          odt2txt [options] --recursive dir --outdir outdir\n\n"
+	       "          The document is read from stdin if filename is -.\n\n"
 	       "Options:  --raw         Print raw XML\n"
 	       "          --raw-input   Input file is a raw XML (fodt, fods, ...)\n"
+	       "          --meta        Print the document's metadata (title, author,\n"
+	       "                        dates, statistics...) instead of its text.\n"
+	       "                        Only meta.xml is read from the document.\n"
+	       "          --meta=json   Same as --meta, but print a JSON object\n"
 #ifdef NO_ICONV
 	       "          --encoding=X  Ignored. odt2txt has been built without iconv support.\n"
 	       "                        Output will always be encoded in UTF-8\n"
@@ -155,7 +233,64 @@ static void usage(void)
 #endif
 	       "          --width=X     Wrap text lines after X characters. Default: 65.\n"
 	       "                        If set to -1 then no lines will be broken\n"
-	       "          --output=file Write output to file, instead of STDOUT\n"
+	       "          --tokens[=X]  Print the words one per line, instead of the\n"
+	       "                        wrapped text.  X is lower to lowercase them,\n"
+	       "                        length to put the number of their characters\n"
+	       "                        in front, or both: lower,length\n"
+	       "          --count       Print the numbers of words, characters and\n"
+	       "                        paragraphs, instead of the text\n"
+	       "          --output=file Write output to file, instead of STDOUT.  A\n"
+	       "                        name ending in .gz implies --compress\n"
+	       "          --compress[=N]\n"
+	       "                        Compress the output with gzip, at level N from\n"
+	       "                        1 (fastest) to 9 (smallest).  Default: 6\n"
+	       "          --offsets=file\n"
+	       "                        Write the offsets of the paragraphs and headings\n"
+	       "                        in the output and in content.xml to file, as\n"
+	       "                        JSON.  With --recursive or --json-lines, give\n"
+	       "                        no file: they go next to the text\n"
+	       "          --headers     Append the page headers to the text\n"
+	       "          --footers     Append the page footers to the text\n"
+	       "          --notes       Move the footnotes and endnotes behind the text\n"
+	       "          --objects[=X] Convert the embedded objects, e.g. charts and\n"
+	       "                        formulas, too.  X is inline to put their text\n"
+	       "                        behind their frames, the default, or section\n"
+	       "                        to put it into a section behind the text\n"
+	       "          --skip=list   Drop these elements with everything in them,\n"
+	       "                        separated by commas.  Default:\n"
+	       "                        text:tracked-changes,office:annotation,\n"
+	       "                        office:binary-data\n"
+	       "          --json-lines  Write one JSON object per document, with its\n"
+	       "                        path, status, sizes, type, CRC and text, to\n"
+	       "                        STDOUT or the --output file\n"
+	       "          --recursive   Convert all documents below the directory given\n"
+	       "                        as filename.  Requires --outdir or --json-lines\n"
+	       "          --outdir=dir  Write the output of --recursive to a tree below\n"
+	       "                        dir with the same layout.  Outputs which are\n"
+	       "                        newer than their documents are not rewritten\n"
+	       "          --cache[=file]\n"
+	       "                        Keep the text of each paragraph in file, and\n"
+	       "                        reuse it for the paragraphs which have not\n"
+	       "                        changed when the document is converted again.\n"
+	       "                        With --recursive and --outdir, give no file:\n"
+	       "                        the caches go next to the text\n"
+	       "          --memory=MB   Start no more --recursive conversions than fit\n"
+	       "                        into MB megabytes.  Default: half of the memory\n"
+	       "          --max-size=MB Give up documents whose content is larger than\n"
+	       "                        MB megabytes\n"
+	       "          --max-ratio=N Give up documents whose content is compressed\n"
+	       "                        more than N times, e.g. zip bombs\n"
+	       "          --max-output=MB\n"
+	       "                        Give up documents whose text is larger than\n"
+	       "                        MB megabytes\n"
+	       "          --timeout=S   Give up documents whose conversion takes longer\n"
+	       "                        than S seconds\n"
+#ifdef NO_PTHREADS
+	       "          --jobs=N      Ignored. odt2txt has been built without thread support.\n"
+#else
+	       "          --jobs=N      Format large documents in parallel, using up to N\n"
+	       "                        threads.  0 means one per processor. Default: 1\n"
+#endif
 	       "          --subst=X     Select which non-ascii characters shall be replaced\n"
 	       "                        by ascii look-a-likes:\n"
 	       "                           --subst=all   Substitute all characters for which\n"
@@ -204,16 +339,27 @@ static iconv_t init_conv(const char *input_enc, const char *output_enc)
 	return 0;
 }
 
-static STRBUF *conv(iconv_t ic, STRBUF *buf) {
+static iconv_t open_conv(void)
+{
+	return 0;
+}
+
+static STRBUF *conv(iconv_t ic, STRBUF *buf, struct regex_marks *marks) {
 	STRBUF *output;
 
+	PROBE1(conv_begin, (long)strbuf_len(buf));
 	output = strbuf_new();
 	strbuf_append_n(output, strbuf_get(buf), strbuf_len(buf));
+	PROBE1(conv_end, (long)strbuf_len(output));
 
 	return output;
 }
 
-static void subst_doc(iconv_t ic, STRBUF *buf) {
+static int init_subst(iconv_t ic) {
+	return 0;
+}
+
+static void subst_doc(STRBUF *buf) {
 	return;
 }
 
@@ -224,46 +370,76 @@ static char *guess_encoding(void)
 
 #else
 
+/*
+ * Opens the conversion from input_enc to output_enc, or to us-ascii
+ * if that is not supported.  Returns (iconv_t)-1 on errors.
+ */
 static iconv_t init_conv(const char *input_enc, const char *output_enc)
 {
 	iconv_t ic;
 	ic = iconv_open(output_enc, input_enc);
+	conv_encoding = output_enc;
 	if (ic == (iconv_t)-1) {
 		if (errno == EINVAL) {
 			fprintf(stderr, "warning: Conversion from %s to %s is not supported.\n",
-				input_enc, opt_encoding);
+				input_enc, output_enc);
 			ic = iconv_open("us-ascii", input_enc);
 			if (ic == (iconv_t)-1) {
-				exit(EXIT_FAILURE);
+				fprintf(stderr, "iconv_open returned: %s\n",
+					strerror(errno));
+				return ic;
 			}
+			conv_encoding = "us-ascii";
 			fprintf(stderr, "warning: Using us-ascii as fall-back.\n");
 		} else {
 			fprintf(stderr, "iconv_open returned: %s\n", strerror(errno));
-			exit(EXIT_FAILURE);
 		}
 	}
 	return ic;
 }
 
+/*
+ * Opens another descriptor for the conversion which init_conv() has
+ * chosen, for use on another thread.  Returns (iconv_t)-1 on errors.
+ */
+static iconv_t open_conv(void)
+{
+	iconv_t ic = iconv_open(conv_encoding, "UTF-8");
+	if (ic == (iconv_t)-1)
+		fprintf(stderr, "iconv_open returned: %s\n", strerror(errno));
+	return ic;
+}
+
 static void finish_conv(iconv_t ic)
 {
-	if(iconv_close(ic) == -1) {
-		fprintf(stderr, "iconv_close returned: %s\n", strerror(errno));
-		exit(EXIT_FAILURE);
-	}
+	if(iconv_close(ic) == -1)
+		fprintf(stderr, "warning: iconv_close returned: %s\n",
+			strerror(errno));
 }
 
-static STRBUF *conv(iconv_t ic, STRBUF *buf)
+#define CONV_SEG 64
+
+/*
+ * Converts buf from UTF-8 to the output encoding.  Returns NULL if
+ * that fails, and ic can be used for the next document.  marks, if
+ * not NULL, are moved to the same text in the output.
+ */
+static STRBUF *conv(iconv_t ic, STRBUF *buf, struct regex_marks *marks)
 {
 	/* FIXME: This functionality belongs into strbuf.c */
 	ICONV_CHAR *doc;
 	char *out, *outbuf;
+	const char *data = strbuf_get(buf);
+	size_t len = strbuf_len(buf);
 	size_t inleft, outleft = 0;
+	size_t seg, rest, pos;
+	size_t next = 0;
 	size_t r;
 	size_t outlen = 0;
 	const size_t alloc_step = 4096;
 	STRBUF *output;
 
+	PROBE1(conv_begin, (long)len);
 	inleft = strbuf_len(buf);
 	doc = (ICONV_CHAR*)strbuf_get(buf);
 	outlen = alloc_step; outleft = alloc_step;
@@ -276,14 +452,36 @@ static STRBUF *conv(iconv_t ic, STRBUF *buf)
 			outlen += alloc_step; outleft += alloc_step;
 			yrealloc_buf(&outbuf, &out, outlen);
 		}
-		r = iconv(ic, &doc, &inleft, &out, &outleft);
+
+		/*
+		 * converted up to the next mark, to see where it goes, and
+		 * in pieces of CONV_SEG bytes: after an unknown character,
+		 * glibc converts all the input it was given once more
+		 */
+		seg = inleft;
+		pos = len - inleft;
+		if (marks) {
+			for (; next < marks->n && marks->pos[next] <= pos; next++)
+				marks->pos[next] = (size_t)(out - outbuf);
+			if (next < marks->n)
+				seg = marks->pos[next] - pos;
+		}
+		if (seg > CONV_SEG)
+			seg = CONV_SEG;
+		while (seg < inleft &&
+		       ((unsigned char)data[pos + seg] & 0xC0) == 0x80)
+			seg++;
+		rest = inleft - seg;
+
+		r = iconv(ic, &doc, &seg, &out, &outleft);
+		inleft = seg + rest;
 		if (r == (size_t)-1) {
 			if(errno == E2BIG) {
 				outlen += alloc_step; outleft += alloc_step;
 				if (outlen > (strbuf_len(buf) << 3)) {
 					fprintf(stderr, "Buffer grew to much. "
 						"Corrupted document?\n");
-					exit(EXIT_FAILURE);
+					goto fail;
 				}
 				yrealloc_buf(&outbuf, &out, outlen);
 				continue;
@@ -293,10 +491,16 @@ static STRBUF *conv(iconv_t ic, STRBUF *buf)
 				/* advance in source buffer */
 				if ((unsigned char)*doc > 0x80)
 					skip += utf8_length[(unsigned char)*doc - 0x80];
+				if ((size_t)skip > inleft)
+					skip = (char)inleft;
 				doc += skip;
 				inleft -= skip;
 
 				/* advance in output buffer */
+				if (!outleft) {
+					outlen += alloc_step; outleft += alloc_step;
+					yrealloc_buf(&outbuf, &out, outlen);
+				}
 				*out = '?';
 				out++;
 				outleft--;
@@ -304,10 +508,13 @@ static STRBUF *conv(iconv_t ic, STRBUF *buf)
 				continue;
 			}
 			fprintf(stderr, "iconv returned: %s\n", strerror(errno));
-			exit(EXIT_FAILURE);
+			goto fail;
 		}
 	} while(inleft != 0);
 
+	for (; marks && next < marks->n; next++)
+		marks->pos[next] = (size_t)(out - outbuf);
+
 	if (!outleft) {
 		outbuf = yrealloc(outbuf, outlen + 1);
 	}
@@ -315,10 +522,23 @@ static STRBUF *conv(iconv_t ic, STRBUF *buf)
 
 	output = strbuf_slurp_n(outbuf, (size_t)(out - outbuf));
 	strbuf_setopt(output, STRBUF_NULLOK);
+	PROBE1(conv_end, (long)strbuf_len(output));
 	return output;
+
+fail:
+	/* back to the initial state for the next document */
+	(void)iconv(ic, NULL, NULL, NULL, NULL);
+	yfree(outbuf);
+	PROBE1(conv_end, -1L);
+	return NULL;
 }
 
-static void subst_doc(iconv_t ic, STRBUF *buf)
+/*
+ * Decides which of the known substitutions will be applied by
+ * subst_doc().  This needs the conversion descriptor, so it is done
+ * once, before any document is formatted.  Returns -1 on errors.
+ */
+static int init_subst(iconv_t ic)
 {
 	struct subst *s = substs;
 	ICONV_CHAR *in;
@@ -329,13 +549,14 @@ static void subst_doc(iconv_t ic, STRBUF *buf)
 	size_t outleft;
 	size_t r;
 
+	memset(subst_active, 0, sizeof(subst_active));
 	if (opt_subst == SUBST_NONE)
-		return;
+		return 0;
 
 	outbuf = ymalloc(outbuf_sz);
 	while (s->unicode) {
 		if (opt_subst == SUBST_ALL) {
-			RS_G(s->utf8, s->ascii);
+			subst_active[s - substs] = 1;
 		} else {
 			out = outbuf;
 			outleft = outbuf_sz;
@@ -344,18 +565,30 @@ static void subst_doc(iconv_t ic, STRBUF *buf)
 			r = iconv(ic, &in, &inleft, &out, &outleft);
 			if (r == (size_t)-1) {
 				if ((errno == EILSEQ) || (errno == EINVAL)) {
-					RS_G(s->utf8, s->ascii);
+					subst_active[s - substs] = 1;
 				} else {
 					fprintf(stderr,
 						"iconv returned an unexpected error: %s\n",
 						strerror(errno));
-					exit(EXIT_FAILURE);
+					yfree(outbuf);
+					return -1;
 				}
 			}
 		}
 		s++;
 	}
 	yfree(outbuf);
+	return 0;
+}
+
+static void subst_doc(STRBUF *buf)
+{
+	struct subst *s;
+
+	for (s = substs; s->unicode; s++) {
+		if (subst_active[s - substs])
+			RS_G(s->utf8, s->ascii);
+	}
 }
 
 static char *guess_encoding(void)
@@ -381,28 +614,114 @@ static char *guess_encoding(void)
 
 #endif
 
-static STRBUF *read_from_zip(const char *zipfile, const char *filename)
+/*
+ * Reports that filename could not be extracted from zipfile.  errno
+ * is EFBIG if it exceeds --max-size or --max-ratio.
+ */
+static void extract_failed(const char *zipfile, const char *filename)
+{
+	if (errno == EFBIG)
+		fprintf(stderr,
+			"Can't extract %s from %s: It is larger than "
+			"--max-size or --max-ratio allows.\n", filename, zipfile);
+	else
+		fprintf(stderr,
+			"Can't extract %s from %s.  Maybe the file is corrupted?\n",
+			filename, zipfile);
+}
+
+/*
+ * Moves zs to filename, which is searched among the remaining files
+ * of the package.  Returns -1 if it is not found.
+ */
+static int find_in_stream(ZIPSTREAM *zs, const char *zipfile,
+			  const char *filename)
+{
+	const char *name;
+	int r;
+
+	zipstream_set_limits(zs, opt_max_size, opt_max_ratio);
+
+	errno = 0;
+	while ((r = zipstream_next(zs, &name)) == 1) {
+		if (!strcmp(name, filename)) {
+			PROBE2(entry_found, zipfile, filename);
+			return 0;
+		}
+	}
+
+	if (r == -1 && errno == EFBIG)
+		extract_failed(zipfile, filename);
+	else if (r == -1)
+		fprintf(stderr,
+			"Can't read from %s.  Maybe the file is corrupted?\n",
+			zipfile);
+	else
+		fprintf(stderr,
+			"Can't read from %s: Is it an OpenDocument Text?\n", zipfile);
+	return -1;
+}
+
+/*
+ * Reads filename from a package on stdin.  The package is parsed as
+ * it arrives, so nothing is written to disk.
+ */
+static STRBUF *read_from_stdin(const char *filename)
+{
+	ZIPSTREAM *zs = zipstream_open(stdin);
+	STRBUF *content = NULL;
+	char buf[65536];
+	long len;
+
+	if (find_in_stream(zs, "stdin", filename) == -1)
+		goto done;
+
+	content = strbuf_new();
+	while ((len = zipstream_read(zs, buf, sizeof(buf))) > 0)
+		strbuf_append_n(content, buf, (size_t)len);
+
+	if (len == -1) {
+		extract_failed("stdin", filename);
+		strbuf_free(content);
+		content = NULL;
+	}
+
+done:
+	zipstream_close(zs);
+	return content;
+}
+
+/*
+ * An open document package, in a file or in memory.
+ */
+#ifdef USE_KUNZIP
+typedef KUNZIP_ARCHIVE PACKAGE;
+#else
+typedef struct zip PACKAGE;
+#endif
+
+static STRBUF *read_from_package(PACKAGE *pkg, const char *zipfile,
+				 const char *filename)
 {
 	int r = 0;
 	STRBUF *content = NULL;
 
 #ifdef USE_KUNZIP
-	r = kunzip_get_offset_by_name((char*)zipfile, (char*)filename, 3, -1);
+	off_t offset;
+
+	offset = kunzip_archive_offset_by_name(pkg, (char*)filename, 3, -1);
+	if (offset == -1)
+		r = -1;
 #else
-	int zip_error;
-	struct zip *zip = NULL;
 	struct zip_stat stat;
 	struct zip_file *unzipped = NULL;
 	char *buf = NULL;
 
-	if ( !(zip = zip_open(zipfile, 0, &zip_error)) ||
-	     (r = zip_name_locate(zip, filename, 0)) < 0 ||
-	     (zip_stat_index(zip, r, ZIP_FL_UNCHANGED, &stat) < 0) ||
-	     !(unzipped = zip_fopen_index(zip, r, ZIP_FL_UNCHANGED)) ) {
+	if ( (r = zip_name_locate(pkg, filename, 0)) < 0 ||
+	     (zip_stat_index(pkg, r, ZIP_FL_UNCHANGED, &stat) < 0) ||
+	     !(unzipped = zip_fopen_index(pkg, r, ZIP_FL_UNCHANGED)) ) {
 		if (unzipped)
 			zip_fclose(unzipped);
-		if (zip)
-			zip_close(zip);
 		r = -1;
 	}
 #endif
@@ -410,12 +729,23 @@ static STRBUF *read_from_zip(const char *zipfile, const char *filename)
 	if(-1 == r) {
 		fprintf(stderr,
 			"Can't read from %s: Is it an OpenDocument Text?\n", zipfile);
-		exit(EXIT_FAILURE);
+		return NULL;
 	}
+	PROBE2(entry_found, zipfile, filename);
 
+	errno = 0;
 #ifdef USE_KUNZIP
-	content = kunzip_next_tobuf((char*)zipfile, r);
+	content = kunzip_archive_tobuf(pkg, offset);
 #else
+	/* zip_fread() stops at the size in the directory */
+	if (inflate_exceeds(stat.size, stat.comp_size, opt_max_size,
+			    opt_max_ratio)) {
+		zip_fclose(unzipped);
+		errno = EFBIG;
+		extract_failed(zipfile, filename);
+		return NULL;
+	}
+
 	if ( !(buf = ymalloc(stat.size + 1)) ||
 	     ((zip_uint64_t)zip_fread(unzipped, buf, stat.size) != stat.size) ||
 	     !(content = strbuf_slurp_n(buf, stat.size)) ) {
@@ -424,122 +754,4347 @@ static STRBUF *read_from_zip(const char *zipfile, const char *filename)
 		content = NULL;
 	}
 	zip_fclose(unzipped);
-	zip_close(zip);
 #endif
 
-	if (!content) {
-		fprintf(stderr,
-			"Can't extract %s from %s.  Maybe the file is corrupted?\n",
-			filename, zipfile);
-		exit(EXIT_FAILURE);
-	}
+	if (!content)
+		extract_failed(zipfile, filename);
 
 	return content;
 }
 
-static STRBUF *read_from_xml(const char *xmlfile, const char *filename)
+static STRBUF *read_from_zip(const char *zipfile, const char *filename)
 {
-	FILE *in = fopen(xmlfile, "rb");
-	if (in == 0) {
-		fprintf(stderr, "Can't open %s.\n", filename);
-		exit(EXIT_FAILURE);
-	}
+	PACKAGE *pkg;
+	STRBUF *content;
 
-	STRBUF *content = strbuf_new();
-	strbuf_append_file(content, in);
+	if (!strcmp(zipfile, "-"))
+		return read_from_stdin(filename);
 
-	fclose(in);
+#ifdef USE_KUNZIP
+	pkg = kunzip_open((char *)zipfile);
+#else
+	int zip_error;
+
+	pkg = zip_open(zipfile, 0, &zip_error);
+#endif
+	if (!pkg) {
+		fprintf(stderr,
+			"Can't read from %s: Is it an OpenDocument Text?\n", zipfile);
+		return NULL;
+	}
+
+	content = read_from_package(pkg, zipfile, filename);
 
+#ifdef USE_KUNZIP
+	kunzip_close(pkg);
+#else
+	zip_close(pkg);
+#endif
 	return content;
 }
 
-static void format_doc(STRBUF *buf, int raw_input)
+/*
+ * A file in the document package which is read piece by piece.
+ */
+struct docstream {
+	ZIPSTREAM *zs;  /* if the package is read from stdin */
+#ifdef USE_KUNZIP
+	KUNZIP_ENTRY *entry;
+#else
+	struct zip *zip;
+	struct zip_file *file;
+#endif
+};
+
+/*
+ * Returns NULL if filename can't be read from zipfile.
+ */
+static struct docstream *open_from_zip(const char *zipfile,
+				       const char *filename)
 {
-	/* FIXME: Convert buffer to utf-8 first.  Are there
-	   OpenOffice texts which are not utf8-encoded? */
+	struct docstream *ds = ymalloc(sizeof(struct docstream));
+	int r;
 
-	if (raw_input) {
-		RS_O(".*<office:body>", "<office:body>");                   /* only body */
-		RS_G("<office:binary-data>[^>]*</office:binary-data>", ""); /* remove binary */
+	ds->zs = NULL;
+	if (!strcmp(zipfile, "-")) {
+		ds->zs = zipstream_open(stdin);
+		if (find_in_stream(ds->zs, "stdin", filename) == -1) {
+			zipstream_close(ds->zs);
+			yfree(ds);
+			return NULL;
+		}
+		return ds;
 	}
 
-        /* remove soft-page-breaks. We don't need them and they may disturb later decoding */
-        RS_G("<text:soft-page-break/>", "");
-        /* same for xml-protected spaces */
-        RS_G("<text:s/>", " ");
+#ifdef USE_KUNZIP
+	off_t offset;
 
-	/* headline, first level */
-	RS_E("<text:h[^>]*outline-level=\"1\"[^>]*>([^<]*)<[^>]*>", &h1);
-	RS_E("<text:h[^>]*>([^<]*)<[^>]*>", &h2);  /* other headlines */
-	RS_G("<text:p [^>]*>", "\n\n");            /* normal paragraphs */
-	RS_G("</text:p>", "\n\n");
-	RS_G("<text:tab/>", "  ");                 /* tabs */
-	RS_G("<text:line-break/>", "\n");
+	offset = kunzip_get_offset_by_name((char*)zipfile, (char*)filename, 3, -1);
+	r = offset == -1 ? -1 : 0;
+	errno = 0;
+	if (r != -1 && !(ds->entry = kunzip_entry_open((char*)zipfile, offset))) {
+		if (errno == EFBIG) {
+			extract_failed(zipfile, filename);
+			yfree(ds);
+			return NULL;
+		}
+		r = -1;
+	}
+#else
+	int zip_error;
+	struct zip_stat stat;
 
-	/* images */
-	RS_E("<draw:frame[^>]*draw:name=\"([^\"]*)\"[^>]*>", &image);
+	ds->file = NULL;
+	if ( !(ds->zip = zip_open(zipfile, 0, &zip_error)) ||
+	     (r = zip_name_locate(ds->zip, filename, 0)) < 0 ||
+	     (zip_stat_index(ds->zip, r, ZIP_FL_UNCHANGED, &stat) < 0) ||
+	     !(ds->file = zip_fopen_index(ds->zip, r, ZIP_FL_UNCHANGED)) ) {
+		if (ds->zip)
+			zip_close(ds->zip);
+		r = -1;
+	} else if (inflate_exceeds(stat.size, stat.comp_size, opt_max_size,
+				   opt_max_ratio)) {
+		/* zip_fread() stops at the size in the directory */
+		zip_fclose(ds->file);
+		zip_close(ds->zip);
+		errno = EFBIG;
+		extract_failed(zipfile, filename);
+		yfree(ds);
+		return NULL;
+	}
+#endif
 
+	if (-1 == r) {
+		fprintf(stderr,
+			"Can't read from %s: Is it an OpenDocument Text?\n", zipfile);
+		yfree(ds);
+		return NULL;
+	}
+	PROBE2(entry_found, zipfile, filename);
 
-	RS_G("<[^>]*>", "");     /* replace all remaining tags */
-	RS_G("\n +", "\n");      /* remove indentations, e.g. kword */
-	RS_G("\n{3,}", "\n\n");  /* remove large vertical spaces */
+	return ds;
+}
 
-	RS_G("&apos;", "'");     /* common entities */
-	RS_G("&amp;",  "&");
-	RS_G("&quot;", "\"");
-	RS_G("&gt;",   ">");
-	RS_G("&lt;",   "<");
+/*
+ * Reads up to len uncompressed bytes.  Returns the number of bytes,
+ * 0 at the end of the file or -1 on errors.
+ */
+static long read_stream(struct docstream *ds, char *buf, size_t len)
+{
+	if (ds->zs)
+		return zipstream_read(ds->zs, buf, len);
+#ifdef USE_KUNZIP
+	return kunzip_entry_read(ds->entry, buf, (int)len);
+#else
+	return (long)zip_fread(ds->file, buf, len);
+#endif
+}
 
-	RS_O("^\n+",  "");       /* blank lines at beginning and end of document */
-	RS_O("\n{2,}$",  "\n");
+static void close_stream(struct docstream *ds)
+{
+	if (ds->zs) {
+		zipstream_close(ds->zs);
+		yfree(ds);
+		return;
+	}
+#ifdef USE_KUNZIP
+	kunzip_entry_close(ds->entry);
+#else
+	zip_fclose(ds->file);
+	zip_close(ds->zip);
+#endif
+	yfree(ds);
 }
 
-int main(int argc, const char **argv)
+/*
+ * Flat XML documents are read in blocks of this size.
+ */
+#ifndef XML_BLOCK_SZ
+#define XML_BLOCK_SZ 65536
+#endif
+
+static const char xml_body_tag[] = "<office:body>";
+static const char xml_bin_tag[] = "<office:binary-data>";
+static const char xml_bin_end_tag[] = "</office:binary-data>";
+
+/* bytes needed behind a '<' to recognize all of the tags above */
+#define XML_LOOKAHEAD (sizeof(xml_bin_end_tag) - 1)
+
+static int xml_tag_at(const char *p, const char *end, const char *tag,
+		      size_t len)
 {
-	struct stat st;
-	iconv_t ic;
-	STRBUF *wbuf;
-	STRBUF *docbuf;
-	STRBUF *outbuf;
-	int i = 1;
+	return (size_t)(end - p) >= len && !memcmp(p, tag, len);
+}
 
-	(void)setlocale(LC_ALL, "");
+/*
+ * Returns -1 if a flat XML document of len bytes exceeds --max-size.
+ */
+static int check_xml_size(size_t len, const char *filename)
+{
+	if (opt_max_size && len > opt_max_size) {
+		fprintf(stderr, "Can't read from %s: It is larger than "
+			"--max-size allows.\n", filename);
+		return -1;
+	}
+	return 0;
+}
 
-	while (argv[i]) {
-		if (!strcmp(argv[i], "--raw")) {
-			opt_raw = 1;
-			i++; continue;
-		} else if (!strcmp(argv[i], "--raw-input")) {
-			opt_raw_input = 1;
-			i++; continue;
-		} else if (!strncmp(argv[i], "--encoding=", 11)) {
-			size_t arglen = strlen(argv[i]) - 10;
-#ifdef iconvlist
-			if (!strcmp(argv[i] + 11, "list")) {
-				show_iconvlist();
+/*
+ * The state of xml_filter() between the blocks of a flat XML
+ * document.
+ */
+struct xml_filter {
+	int head_only;
+	int body;	/* <office:body> has been found */
+	int binary;	/* in office:binary-data */
+	int done;	/* with head_only, at <office:body> */
+};
+
+/*
+ * Appends the flat XML from p to end to out, leaving out the contents
+ * of all office:binary-data elements.  If x->head_only is set, it
+ * stops at <office:body> and sets x->done.  Otherwise everything in
+ * front of <office:body> is dropped as soon as the tag is found.
+ * Unless eof is set, more of the document follows, and a tag which
+ * may be cut off is left.  Returns where it stopped.
+ */
+static const char *xml_filter(STRBUF *out, struct xml_filter *x,
+			      const char *p, const char *end, int eof)
+{
+	const char *lt;
+
+	while (p < end) {
+		lt = memchr(p, '<', (size_t)(end - p));
+		if (!lt) {
+			if (!x->binary)
+				strbuf_append_n(out, p, (size_t)(end - p));
+			return end;
+		}
+
+		if (!x->binary)
+			strbuf_append_n(out, p, (size_t)(lt - p));
+		p = lt;
+
+		/* keep a tag which may be cut for the next block */
+		if (!eof && (size_t)(end - p) < XML_LOOKAHEAD)
+			break;
+
+		if (x->binary) {
+			if (xml_tag_at(p, end, xml_bin_end_tag,
+				       sizeof(xml_bin_end_tag) - 1)) {
+				p += sizeof(xml_bin_end_tag) - 1;
+				x->binary = 0;
+			} else
+				p++;
+			continue;
+		}
+
+		if (xml_tag_at(p, end, xml_bin_tag, sizeof(xml_bin_tag) - 1)) {
+			p += sizeof(xml_bin_tag) - 1;
+			x->binary = 1;
+			continue;
+		}
+
+		if (!x->body && xml_tag_at(p, end, xml_body_tag,
+					   sizeof(xml_body_tag) - 1)) {
+			if (x->head_only) {
+				x->done = 1;
+				break;
 			}
-#endif
-			opt_encoding = ymalloc(arglen);
-			memcpy(opt_encoding, argv[i] + 11, arglen);
-			i++; continue;
-		} else if (!strncmp(argv[i], "--width=", 8)) {
-			opt_width = atoi(argv[i] + 8);
-			if(opt_width < 3 && opt_width != -1) {
-				fprintf(stderr, "Invalid value for width: %s\n",
-					argv[i] + 8);
-				exit(EXIT_FAILURE);
+			strbuf_truncate(out, 0);
+			x->body = 1;
+		}
+
+		strbuf_append_n(out, p, 1);
+		p++;
+	}
+
+	return p;
+}
+
+/*
+ * Reads a flat XML document from in, see xml_filter().  Only the
+ * body, or with head_only the part in front of it, is kept in memory.
+ * A document without body is returned completely.  Returns NULL on
+ * errors.
+ */
+static STRBUF *read_xml_stream(FILE *in, const char *filename, int head_only)
+{
+	STRBUF *out = strbuf_new();
+	char *win = ymalloc(XML_BLOCK_SZ);
+	struct xml_filter x = { 0, 0, 0, 0 };
+	const char *p;
+	size_t have = 0, r;
+	int eof = 0;
+
+	x.head_only = head_only;
+	while (!eof && !x.done) {
+		r = fread(win + have, 1, XML_BLOCK_SZ - have, in);
+		if (r < XML_BLOCK_SZ - have) {
+			if (ferror(in)) {
+				fprintf(stderr, "Can't read from %s: %s\n",
+					filename, strerror(errno));
+				goto fail;
 			}
-			i++; continue;
-		} else if (!strcmp(argv[i], "--force")) {
-			// ignore this setting
-			i++; continue;
-		} else if (!strncmp(argv[i], "--output=", 9)) {
-			if (*(argv[i] + 9) != '-') {
+			eof = 1;
+		}
+
+		have += r;
+		p = xml_filter(out, &x, win, win + have, eof);
+		have -= (size_t)(p - win);
+		memmove(win, p, have);
+
+		if (check_xml_size(strbuf_len(out), filename) == -1)
+			goto fail;
+	}
+
+	yfree(win);
+	return out;
+
+fail:
+	yfree(win);
+	strbuf_free(out);
+	return NULL;
+}
+
+/*
+ * The same for a flat XML document of len bytes at data.
+ */
+static STRBUF *read_xml_buffer(const char *data, size_t len,
+			       const char *filename, int head_only)
+{
+	STRBUF *out = strbuf_new();
+	struct xml_filter x = { 0, 0, 0, 0 };
+
+	x.head_only = head_only;
+	(void)xml_filter(out, &x, data, data + len, 1);
+	if (check_xml_size(strbuf_len(out), filename) == -1) {
+		strbuf_free(out);
+		return NULL;
+	}
+	return out;
+}
+
+static STRBUF *read_from_xml(const char *xmlfile, const char *filename)
+{
+	STRBUF *content;
+	FILE *in = strcmp(xmlfile, "-") ? fopen(xmlfile, "rb") : stdin;
+	if (in == 0) {
+		fprintf(stderr, "Can't open %s.\n", filename);
+		return NULL;
+	}
+
+	if (opt_raw) {
+		/* --raw prints the whole document */
+		content = strbuf_new();
+		strbuf_append_file(content, in);
+		if (check_xml_size(strbuf_len(content), xmlfile) == -1) {
+			strbuf_free(content);
+			content = NULL;
+		}
+	} else {
+		/* office:meta and office:master-styles come in front
+		   of office:body */
+		content = read_xml_stream(in, xmlfile,
+					  strcmp(filename, "content.xml") != 0);
+	}
+
+	if (in != stdin)
+		fclose(in);
+
+	return content;
+}
+
+/*
+ * Reads filename from a document in memory, which is either a package
+ * or flat XML.  Nothing is read from or written to the filesystem.
+ * Returns NULL on errors.
+ */
+static STRBUF *read_from_buffer(const char *data, size_t len,
+				const char *filename)
+{
+	STRBUF *content;
+
+	if (len < 2 || data[0] != 'P' || data[1] != 'K') {
+		/* flat XML */
+		if (opt_raw || len == 0) {
+			if (check_xml_size(len, "buffer") == -1)
+				return NULL;
+			content = strbuf_new();
+			strbuf_append_n(content, data, len);
+			return content;
+		}
+
+		return read_xml_buffer(data, len, "buffer",
+				       strcmp(filename, "content.xml") != 0);
+	}
+
+#ifdef USE_KUNZIP
+	{
+		KUNZIP_ARCHIVE *zip = kunzip_open_mem(data, len);
+
+		content = read_from_package(zip, "buffer", filename);
+		kunzip_close(zip);
+	}
+#else
+	{
+		zip_error_t error;
+		zip_source_t *src;
+		struct zip *zip = NULL;
+
+		zip_error_init(&error);
+		src = zip_source_buffer_create(data, len, 0, &error);
+		if (src && !(zip = zip_open_from_source(src, ZIP_RDONLY, &error)))
+			zip_source_free(src);
+		zip_error_fini(&error);
+
+		if (!zip) {
+			fprintf(stderr,
+				"Can't read from buffer: Is it an OpenDocument Text?\n");
+			return NULL;
+		}
+		content = read_from_package(zip, "buffer", filename);
+		zip_close(zip);
+	}
+#endif
+
+	return content;
+}
+
+static void unescape_entities(STRBUF *buf)
+{
+	RS_G("&apos;", "'");     /* common entities */
+	RS_G("&amp;",  "&");
+	RS_G("&quot;", "\"");
+	RS_G("&gt;",   ">");
+	RS_G("&lt;",   "<");
+}
+
+struct meta_field {
+	const char *tag;
+	const char *key;
+	int multi;
+};
+
+static const struct meta_field meta_fields[] = {
+	/* element,              output key,       may repeat */
+	{ "dc:title",             "title",          0 },
+	{ "dc:subject",           "subject",        0 },
+	{ "meta:keyword",         "keywords",       1 },
+	{ "dc:creator",           "author",         0 },
+	{ "meta:initial-creator", "initial-author", 0 },
+	{ "meta:creation-date",   "created",        0 },
+	{ "dc:date",              "modified",       0 },
+	{ NULL,                   NULL,             0 },
+};
+
+static void append_json_string(STRBUF *out, const char *str, size_t len)
+{
+	const char *end = str + len;
+	const char *run = str;
+	char esc[8];
+
+	strbuf_append_n(out, "\"", 1);
+	for (; str < end; str++) {
+		unsigned char c = (unsigned char)*str;
+
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		strbuf_append_n(out, run, (size_t)(str - run));
+		run = str + 1;
+		switch (c) {
+		case '"':  strbuf_append_n(out, "\\\"", 2); break;
+		case '\\': strbuf_append_n(out, "\\\\", 2); break;
+		case '\n': strbuf_append_n(out, "\\n", 2);  break;
+		case '\r': strbuf_append_n(out, "\\r", 2);  break;
+		case '\t': strbuf_append_n(out, "\\t", 2);  break;
+		default:
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			strbuf_append(out, esc);
+		}
+	}
+	strbuf_append_n(out, run, (size_t)(str - run));
+	strbuf_append_n(out, "\"", 1);
+}
+
+/*
+ * Finds the next element <tag>...</tag> between *pos and end, stores
+ * its unescaped content in val and moves *pos behind it.  Returns 0
+ * if there is no such element.
+ */
+static int next_meta_elem(const char **pos, const char *end,
+			  const char *tag, STRBUF *val)
+{
+	size_t taglen = strlen(tag);
+	const char *p = *pos;
+	const char *start, *stop;
+
+	while ((p = strchr(p, '<')) && p < end) {
+		p++;
+		if (strncmp(p, tag, taglen) ||
+		    !strchr(" \t\r\n/>", p[taglen]))
+			continue;
+
+		start = strchr(p, '>');
+		if (!start || start >= end)
+			return 0;
+
+		strbuf_truncate(val, 0);
+		if (start[-1] == '/') {         /* empty element */
+			*pos = start + 1;
+			return 1;
+		}
+
+		start++;
+		for (stop = start; (stop = strstr(stop, "</")); stop += 2) {
+			if (!strncmp(stop + 2, tag, taglen) &&
+			    stop[2 + taglen] == '>')
+				break;
+		}
+		if (!stop || stop >= end)
+			return 0;
+
+		strbuf_append_n(val, start, (size_t)(stop - start));
+		unescape_entities(val);
+		*pos = stop + taglen + 3;
+		return 1;
+	}
+	return 0;
+}
+
+static void append_meta_key(STRBUF *out, const char *key, size_t keylen,
+			    int json, int *first)
+{
+	if (json) {
+		strbuf_append(out, *first ? "{" : ",");
+		append_json_string(out, key, keylen);
+		strbuf_append_n(out, ":", 1);
+	} else {
+		strbuf_append_n(out, key, keylen);
+		strbuf_append_n(out, ": ", 2);
+	}
+	*first = 0;
+}
+
+/*
+ * Extracts the interesting fields from meta.xml and returns them
+ * either as "key: value" lines or as a JSON object.
+ */
+static STRBUF *format_meta(STRBUF *buf, int json)
+{
+	const struct meta_field *f;
+	const char *doc = strbuf_get(buf);
+	const char *begin, *end, *p;
+	STRBUF *out = strbuf_new();
+	STRBUF *val = strbuf_new();
+	int first = 1;
+
+	/* only look at the office:meta section */
+	begin = strstr(doc, "<office:meta");
+	end = begin ? strstr(begin, "</office:meta>") : NULL;
+	if (!begin || !end)
+		begin = end = doc;
+
+	for (f = meta_fields; f->tag; f++) {
+		int count = 0;
+
+		p = begin;
+		while (next_meta_elem(&p, end, f->tag, val)) {
+			if (!count)
+				append_meta_key(out, f->key, strlen(f->key),
+						json, &first);
+			if (json && f->multi)
+				strbuf_append(out, count ? "," : "[");
+			else if (count)
+				strbuf_append(out, ", ");
+
+			if (json)
+				append_json_string(out, strbuf_get(val),
+						   strbuf_len(val));
+			else
+				strbuf_append_n(out, strbuf_get(val),
+						strbuf_len(val));
+			count++;
+			if (!f->multi)
+				break;
+		}
+		if (count && json && f->multi)
+			strbuf_append(out, "]");
+		if (count && !json)
+			strbuf_append(out, "\n");
+	}
+
+	/* <meta:document-statistic meta:page-count="3" .../> */
+	p = strstr(begin, "<meta:document-statistic");
+	if (p && p < end) {
+		const char *stop = strchr(p, '>');
+
+		while ((p = strstr(p, " meta:")) && p < stop) {
+			const char *name = p + 6;
+			const char *eq = strchr(name, '=');
+			const char *num, *numend;
+			size_t namelen;
+
+			p = name;
+			if (!eq || eq > stop || eq[1] != '"')
+				continue;
+			num = eq + 2;
+			numend = num + strspn(num, "0123456789");
+			if (numend == num || *numend != '"')
+				continue;
+
+			/* "page-count" is printed as "pages" */
+			namelen = (size_t)(eq - name);
+			if (namelen > 6 &&
+			    !strncmp(name + namelen - 6, "-count", 6))
+				namelen -= 6;
+
+			strbuf_truncate(val, 0);
+			strbuf_append_n(val, name, namelen);
+			if (name[namelen - 1] != 's')
+				strbuf_append_n(val, "s", 1);
+
+			append_meta_key(out, strbuf_get(val), strbuf_len(val),
+					json, &first);
+			strbuf_append_n(out, num, (size_t)(numend - num));
+			if (!json)
+				strbuf_append(out, "\n");
+			p = numend;
+		}
+	}
+
+	if (json)
+		strbuf_append(out, first ? "{}\n" : "}\n");
+
+	strbuf_free(val);
+	return out;
+}
+
+/*
+ * Replaces every '<' which is not closed by a '>' before the next
+ * '<' with "&lt;".  Well-formed XML has none of them, but in broken
+ * documents each one makes the tag rules below search up to the end
+ * of the buffer.
+ */
+static void escape_stray_lt(STRBUF *buf)
+{
+	const char *data = strbuf_get(buf);
+	const char *base = data;
+	const char *end = data + strbuf_len(buf);
+	const char *p = data, *lt, *next;
+	STRBUF *out = NULL;
+	size_t *at = NULL;	/* of the escaped '<', for the marks */
+	size_t nat = 0, at_sz = 0;
+
+	while ((lt = memchr(p, '<', (size_t)(end - p)))) {
+		next = lt + 1;
+		while (next < end && *next != '<' && *next != '>')
+			next++;
+
+		if (next < end && *next == '>') {
+			p = next + 1;
+			continue;
+		}
+
+		if (!out) {
+			out = strbuf_new();
+			strbuf_reserve(out, strbuf_len(buf) + 16);
+		}
+		strbuf_append_n(out, data, (size_t)(lt - data));
+		strbuf_append_n(out, "&lt;", 4);
+		data = p = lt + 1;
+
+		if (nat == at_sz) {
+			at_sz = at_sz ? at_sz * 2 : 16;
+			at = yrealloc(at, at_sz * sizeof(size_t));
+		}
+		at[nat++] = (size_t)(lt - base);
+	}
+
+	if (out) {
+		strbuf_append_n(out, data, (size_t)(end - data));
+		strbuf_swap(buf, out);
+		strbuf_free(out);
+		regex_move_marks(at, nat, 4);
+		yfree(at);
+	}
+}
+
+/*
+ * Returns the first str between p and end, or NULL.
+ */
+static const char *find_between(const char *p, const char *end,
+				const char *str)
+{
+	size_t len = strlen(str);
+
+	for (; (p = memchr(p, *str, (size_t)(end - p))) &&
+	       (size_t)(end - p) >= len; p++) {
+		if (!memcmp(p, str, len))
+			return p;
+	}
+	return NULL;
+}
+
+/*
+ * The state of format_tags().  The formatted text is written to out
+ * through fmt_put(), which also removes the indentation behind line
+ * feeds, more than two line feeds in a row and the common entities.
+ */
+struct fmt {
+	STRBUF *out;
+	int nl;			/* line feeds at the end of out */
+	const char *in;		/* the document */
+	struct regex_marks *marks;
+	size_t next;		/* the first mark which hasn't been moved */
+};
+
+/*
+ * A tag, from its '<' at start to behind its '>' at end.  limit is
+ * the end of the document.
+ */
+struct tag {
+	const char *start;
+	const char *end;
+	const char *limit;
+	const char *name;
+	size_t name_len;
+	int close;		/* </name> */
+	int empty;		/* <name/> or <name .../> */
+	int bare;		/* without attributes */
+};
+
+/*
+ * Returns the length of the entity at p and sets *c to its
+ * character, or returns 0 if there is none.  The entities used to be
+ * replaced one after the other, each time searching the replacement
+ * again, so "&amp;" followed by any number of "amp;" and then by
+ * "quot;", "gt;" or "lt;" still stands for a single character.
+ */
+static size_t entity_at(const char *p, const char *end, char *c)
+{
+	static const struct {
+		const char *name;
+		size_t len;
+		char c;
+	} entities[] = {
+		{ "&apos;", 6, '\'' },
+		{ "&quot;", 6, '"' },
+		{ "&gt;", 4, '>' },
+		{ "&lt;", 4, '<' },
+		{ NULL, 0, 0 }
+	};
+	const char *q;
+	int i;
+
+	if (end - p >= 5 && !memcmp(p, "&amp;", 5)) {
+		for (q = p + 5; end - q >= 4 && !memcmp(q, "amp;", 4); q += 4)
+			;
+		for (i = 1; entities[i].name; i++) {
+			if ((size_t)(end - q) >= entities[i].len - 1 &&
+			    !memcmp(q, entities[i].name + 1,
+				    entities[i].len - 1)) {
+				*c = entities[i].c;
+				return (size_t)(q - p) + entities[i].len - 1;
+			}
+		}
+		*c = '&';
+		return (size_t)(q - p);
+	}
+
+	for (i = 0; entities[i].name; i++) {
+		if ((size_t)(end - p) >= entities[i].len &&
+		    !memcmp(p, entities[i].name, entities[i].len)) {
+			*c = entities[i].c;
+			return entities[i].len;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Moves the marks in front of in + off to pos in the output.
+ */
+static void fmt_marks(struct fmt *f, size_t off, size_t pos)
+{
+	struct regex_marks *marks = f->marks;
+
+	for (; f->next < marks->n && marks->pos[f->next] < off; f->next++)
+		marks->pos[f->next] = pos;
+}
+
+/*
+ * Returns where the next mark points into the document, or NULL.
+ */
+static const char *fmt_next_mark(struct fmt *f)
+{
+	if (!f->marks || f->next == f->marks->n)
+		return NULL;
+	return f->in + f->marks->pos[f->next];
+}
+
+/*
+ * Appends len bytes at p to the output.  If they are text of the
+ * document, the marks in them are moved along.
+ */
+static void fmt_put(struct fmt *f, const char *p, size_t len, int text)
+{
+	const char *end = p + len;
+	const char *run = p;	/* not appended yet */
+	const char *mark = text ? fmt_next_mark(f) : NULL;
+	size_t n;
+	char c;
+
+	while (p < end) {
+		if (mark && mark <= p) {
+			strbuf_append_n(f->out, run, (size_t)(p - run));
+			run = p;
+			fmt_marks(f, (size_t)(p - f->in) + 1,
+				  strbuf_len(f->out));
+			mark = fmt_next_mark(f);
+		}
+
+		c = *p;
+		if (c == '&' && (n = entity_at(p, end, &c))) {
+			strbuf_append_n(f->out, run, (size_t)(p - run));
+			if (mark && mark < p + n) {
+				fmt_marks(f, (size_t)(p + n - f->in),
+					  strbuf_len(f->out));
+				mark = fmt_next_mark(f);
+			}
+			strbuf_append_n(f->out, &c, 1);
+			f->nl = 0;
+			run = p += n;
+			continue;
+		}
+
+		if ((c == ' ' && f->nl) || (c == '\n' && f->nl >= 2)) {
+			/* indentation or a vertical space */
+			strbuf_append_n(f->out, run, (size_t)(p - run));
+			run = ++p;
+			continue;
+		}
+
+		f->nl = c == '\n' ? f->nl + 1 : 0;
+		p++;
+	}
+	strbuf_append_n(f->out, run, (size_t)(p - run));
+}
+
+/*
+ * Fills t with the tag from start to end.
+ */
+static void tag_at(struct tag *t, const char *start, const char *end,
+		   const char *limit)
+{
+	const char *p;
+
+	t->start = start;
+	t->end = end;
+	t->limit = limit;
+	t->close = start[1] == '/';
+	t->empty = !t->close && end - start > 2 && end[-2] == '/';
+	t->name = start + 1 + t->close;
+	for (p = t->name; p < end - 1 - t->empty && *p != ' ' && *p != '\t' &&
+		     *p != '\n' && *p != '\r'; p++)
+		;
+	t->name_len = (size_t)(p - t->name);
+	t->bare = p == end - 1 - t->empty;
+}
+
+/*
+ * Returns whether t is <name/>, without attributes.
+ */
+static int fmt_is_char(const struct tag *t)
+{
+	return t->bare && t->empty;
+}
+
+/*
+ * The handlers of the elements in elements.def.  Each one formats
+ * the tag t and returns where formatting goes on, usually at the end
+ * of t.  Most of them only format tags which the regular expressions
+ * they replace matched, e.g. <text:tab/> but not <text:tab .../>.
+ */
+
+static const char *fmt_para(struct fmt *f, const struct tag *t)
+{
+	/* <text:p> without attributes only ends one */
+	if (t->close || t->name[t->name_len] == ' ')
+		fmt_put(f, "\n\n", 2, 0);
+	return t->end;
+}
+
+/*
+ * A heading is its text up to the next tag, underlined.  The next
+ * tag ends it even if it isn't </text:h>, unless it is only a space.
+ */
+static const char *fmt_heading(struct fmt *f, const struct tag *t)
+{
+	static const char level1[] = "outline-level=\"1\"";
+	const struct element *e;
+	struct tag next;
+	const char *p = t->end, *lt, *gt;
+	STRBUF *text;
+	char *h;
+
+	if (t->close)
+		return t->end;
+
+	text = strbuf_new();
+	for (;;) {
+		lt = memchr(p, '<', (size_t)(t->limit - p));
+		gt = lt ? memchr(lt, '>', (size_t)(t->limit - lt)) : NULL;
+		if (!gt) {
+			/* no heading without a tag behind it */
+			strbuf_free(text);
+			return t->end;
+		}
+		strbuf_append_n(text, p, (size_t)(lt - p));
+
+		tag_at(&next, lt, gt + 1, t->limit);
+		e = element_lookup(next.name, next.name_len);
+		if (!e || !fmt_is_char(&next) ||
+		    (e->handler != fmt_space && e->handler != fmt_drop))
+			break;
+		if (e->handler == fmt_space)
+			strbuf_append_n(text, " ", 1);
+		p = next.end;
+	}
+
+	if (opt_tokens) {
+		/* the underline is no text */
+		if (strbuf_len(text)) {
+			fmt_put(f, strbuf_get(text), strbuf_len(text), 0);
+			fmt_put(f, "\n\n", 2, 0);
+		}
+	} else {
+		h = underline(find_between(t->start, t->end, level1) ?
+			      '=' : '-', strbuf_get(text));
+		fmt_put(f, h, strlen(h), 0);
+		yfree(h);
+	}
+	strbuf_free(text);
+
+	return next.end;
+}
+
+static const char *fmt_tab(struct fmt *f, const struct tag *t)
+{
+	if (fmt_is_char(t))
+		fmt_put(f, "  ", 2, 0);
+	return t->end;
+}
+
+static const char *fmt_space(struct fmt *f, const struct tag *t)
+{
+	if (fmt_is_char(t))
+		fmt_put(f, " ", 1, 0);
+	return t->end;
+}
+
+static const char *fmt_line_break(struct fmt *f, const struct tag *t)
+{
+	if (fmt_is_char(t))
+		fmt_put(f, "\n", 1, 0);
+	return t->end;
+}
+
+static const char *fmt_drop(struct fmt *f, const struct tag *t)
+{
+	(void)f;
+	return t->end;
+}
+
+/*
+ * A frame is replaced with its name, but for --tokens, which only
+ * has the words of the document.
+ */
+static const char *fmt_image(struct fmt *f, const struct tag *t)
+{
+	static const char attr[] = "draw:name=\"";
+	const char *name = NULL, *p = t->start, *q;
+
+	if (t->close || opt_tokens)
+		return t->end;
+
+	/* the last one, like the regular expression found */
+	while ((q = find_between(p, t->end, attr)))
+		p = name = q + sizeof(attr) - 1;
+	if (!name || !(q = memchr(name, '"', (size_t)(t->end - name))))
+		return t->end;
+
+	fmt_put(f, "[-- Image: ", 11, 0);
+	fmt_put(f, name, (size_t)(q - name), 0);
+	fmt_put(f, " --]", 4, 0);
+	return t->end;
+}
+
+/*
+ * Drops the element with everything in it.
+ */
+static const char *fmt_skip(struct fmt *f, const struct tag *t)
+{
+	char close[64];
+	const char *stop;
+
+	(void)f;
+	if (t->close || t->empty || t->name_len > sizeof(close) - 4)
+		return t->end;
+
+	snprintf(close, sizeof(close), "</%.*s>", (int)t->name_len, t->name);
+	stop = find_between(t->end, t->limit, close);
+	return stop ? stop + strlen(close) : t->end;
+}
+
+/*
+ * Formats buf, in which every '<' is closed by a '>' in front of the
+ * next one, see escape_stray_lt().  The text is kept, the tags of
+ * the elements in elements.def are passed to their handlers and all
+ * others are dropped.  This is a single pass over the document, in
+ * which each tag is found in the element table by its name.
+ */
+static void format_tags(STRBUF *buf)
+{
+	const char *data = strbuf_get(buf);
+	const char *end = data + strbuf_len(buf);
+	const char *p = data, *lt, *gt, *next;
+	const struct element *e;
+	struct tag t;
+	struct fmt f;
+	size_t start;
+	long ntags = 0;
+
+	PROBE1(format_begin, (long)strbuf_len(buf));
+	f.out = strbuf_new();
+	strbuf_reserve(f.out, strbuf_len(buf));
+	f.nl = 0;
+	f.in = data;
+	f.marks = regex_get_marks();
+	f.next = 0;
+
+	while (p < end) {
+		lt = memchr(p, '<', (size_t)(end - p));
+		gt = lt ? memchr(lt, '>', (size_t)(end - lt)) : NULL;
+		if (!gt) {
+			fmt_put(&f, p, (size_t)(end - p), 1);
+			break;
+		}
+		fmt_put(&f, p, (size_t)(lt - p), 1);
+
+		tag_at(&t, lt, gt + 1, end);
+		ntags++;
+		start = strbuf_len(f.out);
+		e = element_lookup(t.name, t.name_len);
+		next = e ? e->handler(&f, &t) : t.end;
+
+		/* marks in a replaced part go to its replacement */
+		if (f.marks)
+			fmt_marks(&f, (size_t)(next - data), start);
+		p = next;
+	}
+	if (f.marks)
+		fmt_marks(&f, (size_t)-1, strbuf_len(f.out));
+
+	strbuf_swap(buf, f.out);
+	strbuf_free(f.out);
+	PROBE2(format_end, (long)strbuf_len(buf), ntags);
+}
+
+/*
+ * Applies all formatting rules that only look at a few neighbouring
+ * tags.  The document may be split behind any </text:p> or </text:h>
+ * and the parts can be formatted separately, see join_part().
+ */
+static void format_part(STRBUF *buf)
+{
+	escape_stray_lt(buf);
+	format_tags(buf);
+}
+
+static void format_doc(STRBUF *buf)
+{
+	/* FIXME: Convert buffer to utf-8 first.  Are there
+	   OpenOffice texts which are not utf8-encoded? */
+
+	format_part(buf);
+
+	RS_O("^\n+",  "");       /* blank lines at beginning and end of document */
+	RS_O("\n{2,}$",  "\n");
+}
+
+/*
+ * Moves the marks which are before the end of a replaced part of
+ * the document.  The text from in to at has been copied to out_pos,
+ * and at to stop has been replaced.
+ */
+static void move_note_marks(struct regex_marks *marks, size_t *next,
+			    size_t in, size_t at, size_t stop, size_t out_pos)
+{
+	for (; *next < marks->n && marks->pos[*next] < stop; (*next)++) {
+		if (marks->pos[*next] <= at)
+			marks->pos[*next] = out_pos + marks->pos[*next] - in;
+		else
+			marks->pos[*next] = out_pos + at - in;
+	}
+}
+
+/*
+ * --skip: the elements which are dropped with everything in them
+ * before the document is substituted and formatted, e.g. the deleted
+ * text of tracked changes.  skip_names points into opt_skip.
+ */
+#define SKIP_MAX 32
+
+static struct {
+	const char *name;
+	size_t len;
+} skip_names[SKIP_MAX];
+static size_t nskip;
+
+/*
+ * Splits opt_skip into skip_names.  Returns -1 if it has too many.
+ */
+static int init_skip(void)
+{
+	const char *p = opt_skip, *q;
+
+	nskip = 0;
+	for (; *p; p = *q ? q + 1 : q) {
+		q = strchr(p, ',');
+		if (!q)
+			q = p + strlen(p);
+		if (q == p)
+			continue;
+		if (nskip == SKIP_MAX)
+			return -1;
+		skip_names[nskip].name = p;
+		skip_names[nskip].len = (size_t)(q - p);
+		nskip++;
+	}
+	return 0;
+}
+
+/*
+ * Returns the entry of skip_names for the element, or NULL.
+ */
+static const char *is_skipped(const char *name, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < nskip; i++) {
+		if (skip_names[i].len == len &&
+		    !memcmp(skip_names[i].name, name, len))
+			return skip_names[i].name;
+	}
+	return NULL;
+}
+
+/*
+ * The state of skip_elements() between the blocks of a document.
+ */
+struct skip {
+	size_t pos;		/* where the scan goes on */
+	const char *name;	/* in skip_names of the element being dropped */
+	size_t len;
+	int depth;		/* of its nested elements of the same name */
+};
+
+/*
+ * Scans the tags from p on for the end tag of the element which s
+ * is in, counting the nested elements of the same name.  Returns
+ * behind it, with s->name reset, or where the scan stopped: at end,
+ * or unless last is set at a tag which is cut off.
+ */
+static const char *skip_subtree(struct skip *s, const char *p,
+				const char *end, int last)
+{
+	const char *lt, *gt;
+	struct tag t;
+
+	while ((lt = memchr(p, '<', (size_t)(end - p)))) {
+		gt = memchr(lt, '>', (size_t)(end - lt));
+		if (!gt)
+			return last ? end : lt;
+		tag_at(&t, lt, gt + 1, end);
+		p = t.end;
+		if (t.name_len != s->len || memcmp(t.name, s->name, s->len) ||
+		    t.empty)
+			continue;
+		if (!t.close)
+			s->depth++;
+		else if (!--s->depth) {
+			s->name = NULL;
+			return p;
+		}
+	}
+	return end;
+}
+
+/*
+ * Drops the --skip elements in buf from s->pos on with everything in
+ * them.  Only their tags are looked at, to find the end tag which
+ * matches.  Unless last is set, more of the document follows, and a
+ * tag or an element which is cut off is left for the next call; the
+ * text in front of s->pos won't change any more.  An element which
+ * isn't closed reaches to the end of the document.  marks, if not
+ * NULL, are moved like regex_subst() does.
+ */
+static void skip_elements(STRBUF *buf, struct skip *s,
+			  struct regex_marks *marks, int last)
+{
+	const char *data = strbuf_get(buf);
+	const char *end = data + strbuf_len(buf);
+	const char *p = data + s->pos, *copied = data;
+	const char *lt, *gt, *name, *stop = p;
+	STRBUF *rest = NULL;
+	struct tag t;
+	size_t next = 0;
+
+	if (!nskip)
+		return;
+	if (s->name) {
+		/* the element goes on from the last block */
+		rest = strbuf_new();
+		strbuf_append_n(rest, data, s->pos);
+	}
+
+	for (;;) {
+		if (s->name) {
+			/* the text from stop to p is dropped */
+			p = skip_subtree(s, p, end, last);
+			if (marks)
+				move_note_marks(marks, &next,
+						(size_t)(copied - data),
+						(size_t)(stop - data),
+						(size_t)(p - data),
+						strbuf_len(rest) -
+						(size_t)(stop - copied));
+			copied = p;
+			if (s->name && !last)
+				break;
+			s->name = NULL;
+			continue;
+		}
+
+		lt = memchr(p, '<', (size_t)(end - p));
+		gt = lt ? memchr(lt, '>', (size_t)(end - lt)) : NULL;
+		if (!gt) {
+			/* without a tag, the text is complete */
+			p = lt && !last ? lt : end;
+			break;
+		}
+		tag_at(&t, lt, gt + 1, end);
+		p = t.end;
+		if (t.close || t.empty ||
+		    !(name = is_skipped(t.name, t.name_len)))
+			continue;
+
+		if (!rest) {
+			rest = strbuf_new();
+			strbuf_reserve(rest, strbuf_len(buf));
+		}
+		strbuf_append_n(rest, copied, (size_t)(lt - copied));
+		stop = lt;
+		s->name = name;
+		s->len = t.name_len;
+		s->depth = 1;
+	}
+
+	if (!rest) {
+		s->pos = (size_t)(p - data);
+		return;
+	}
+
+	if (marks)
+		move_note_marks(marks, &next, (size_t)(copied - data),
+				strbuf_len(buf), strbuf_len(buf) + 1,
+				strbuf_len(rest));
+	s->pos = strbuf_len(rest) + (size_t)(p - copied);
+	strbuf_append_n(rest, copied, (size_t)(end - copied));
+	strbuf_swap(buf, rest);
+	strbuf_free(rest);
+}
+
+/*
+ * Below this size, a document is not split for parallel formatting.
+ */
+#ifndef PAR_MIN_PART
+#define PAR_MIN_PART (256 * 1024)
+#endif
+
+struct par {
+	STRBUF **parts;
+	const char *text;
+	size_t *cuts;
+	size_t nparts;
+	STRBUF **out;
+	struct text_counts *counts;	/* of each part, for --count */
+};
+
+/*
+ * Returns the first position behind p where the document may be
+ * split, or NULL if there is none before end.  With xml set, this is
+ * behind </text:p> or </text:h>, otherwise behind a line feed which
+ * is followed by neither another line feed nor a space, so that the
+ * parts can be wrapped independently.
+ */
+static const char *find_cut(const char *p, const char *end, int xml)
+{
+	if (xml) {
+		while ((p = find_between(p, end, "</text:"))) {
+			p += 7;
+			if (end - p >= 2 && (*p == 'p' || *p == 'h') &&
+			    p[1] == '>')
+				return p + 2 < end ? p + 2 : NULL;
+		}
+	} else {
+		while ((p = memchr(p, '\n', (size_t)(end - p)))) {
+			p++;
+			if (p < end && *p != '\n' && *p != ' ')
+				return p;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Splits doc into parts of roughly target bytes, see find_cut().
+ * Part i reaches from cuts[i] to cuts[i + 1].  Returns the number of
+ * parts.
+ */
+static size_t split_doc(const char *doc, size_t len, size_t target,
+			int xml, size_t **cuts)
+{
+	size_t n = 0;
+	size_t max = len / target + 2;
+	size_t pos = 0;
+
+	*cuts = ymalloc(sizeof(size_t) * (max + 1));
+	(*cuts)[n++] = 0;
+
+	while (n < max && len - pos > target) {
+		const char *p = find_cut(doc + pos + target, doc + len, xml);
+
+		if (!p)
+			break;
+		pos = (size_t)(p - doc);
+		(*cuts)[n++] = pos;
+	}
+
+	(*cuts)[n] = len;
+	return n;
+}
+
+/*
+ * Appends a separately formatted part to buf.  The rules for white
+ * space in format_part() are applied again to the white space around
+ * the seam.  As they only remove spaces behind line feeds and limit
+ * the number of successive line feeds, this gives the same result as
+ * formatting the whole document at once.
+ */
+static void join_part(STRBUF *buf, STRBUF *part)
+{
+	const char *d = strbuf_get(buf);
+	const char *p = strbuf_get(part);
+	size_t len = strbuf_len(buf);
+	size_t plen = strbuf_len(part);
+	size_t start = len, lead = 0;
+	size_t i, nl = 0, spaces = 0;
+	int seen_nl = 0;
+
+	while (start > 0 && (d[start - 1] == ' ' || d[start - 1] == '\n'))
+		start--;
+	while (lead < plen && (p[lead] == ' ' || p[lead] == '\n'))
+		lead++;
+
+	for (i = start; i < len; i++) {
+		if (d[i] == '\n') {
+			seen_nl = 1;
+			nl++;
+		} else if (!seen_nl)
+			spaces++;
+	}
+	for (i = 0; i < lead; i++) {
+		if (p[i] == '\n') {
+			seen_nl = 1;
+			nl++;
+		} else if (!seen_nl)
+			spaces++;
+	}
+
+	if (!nl) {
+		strbuf_append_n(buf, p, plen);
+		return;
+	}
+
+	strbuf_truncate(buf, start);
+	for (i = 0; i < spaces; i++)
+		strbuf_append_n(buf, " ", 1);
+	strbuf_append_n(buf, "\n\n", nl > 2 ? 2 : nl);
+	strbuf_append_n(buf, p + lead, plen - lead);
+}
+
+/*
+ * Returns the line of --count, or NULL like conv().
+ */
+static STRBUF *convert_counts(iconv_t ic, const struct text_counts *counts)
+{
+	STRBUF *buf = strbuf_new();
+	STRBUF *outbuf;
+	char line[80];
+
+	snprintf(line, sizeof(line), "%lu %lu %lu\n", counts->words,
+		 counts->chars, counts->paras);
+	strbuf_append(buf, line);
+	outbuf = conv(ic, buf, NULL);
+	strbuf_free(buf);
+	return outbuf;
+}
+
+static void par_format(void *arg, size_t i)
+{
+	struct par *par = arg;
+
+	regex_set_deadline(opt_timeout ? &doc_deadline : NULL);
+	subst_doc(par->parts[i]);
+	format_part(par->parts[i]);
+}
+
+static void par_finish(void *arg, size_t i)
+{
+	struct par *par = arg;
+	STRBUF *wbuf = strbuf_new();
+	iconv_t ic;
+
+	if (opt_tokens) {
+		/* a part follows a line feed, see split_doc() */
+		tokenize_n(wbuf, par->text + par->cuts[i],
+			   par->cuts[i + 1] - par->cuts[i], opt_tokens,
+			   i == 0 || par->text[par->cuts[i] - 2] == '\n',
+			   &par->counts[i]);
+	} else {
+		if (i == 0 && opt_width != -1)
+			strbuf_append_n(wbuf, "\n", 1);
+		wrap_n(wbuf, par->text + par->cuts[i],
+		       par->cuts[i + 1] - par->cuts[i], opt_width);
+		if (i == par->nparts - 1 && opt_width != -1)
+			strbuf_append_n(wbuf, "\n", 1);
+	}
+
+	ic = open_conv();
+	if (ic == (iconv_t)-1) {
+		par->out[i] = NULL;
+	} else {
+		par->out[i] = conv(ic, wbuf, NULL);
+		finish_conv(ic);
+	}
+	strbuf_free(wbuf);
+}
+
+/*
+ * Joins the formatted parts, then wraps and converts the document
+ * like the sequential path in convert_doc() does, but on up to jobs
+ * threads.  The parts are freed.  Returns NULL if a part can't be
+ * converted.
+ */
+static STRBUF *finish_parallel(STRBUF **parts, size_t nparts, int jobs)
+{
+	struct par par;
+	STRBUF *buf;
+	STRBUF *outbuf;
+	size_t target;
+	size_t i;
+
+	buf = strbuf_new();
+	for (i = 0; i < nparts; i++) {
+		join_part(buf, parts[i]);
+		strbuf_free(parts[i]);
+	}
+
+	/* over --timeout, the output is thrown away */
+	if (opt_timeout && regex_deadline_passed())
+		return buf;
+
+	RS_O("^\n+",  "");       /* blank lines at beginning and end of document */
+	RS_O("\n{2,}$",  "\n");
+
+	/* several parts per thread even out their different costs */
+	target = strbuf_len(buf) / ((size_t)jobs * 4);
+	if (target < PAR_MIN_PART)
+		target = PAR_MIN_PART;
+
+	par.text = strbuf_get(buf);
+	par.nparts = split_doc(par.text, strbuf_len(buf), target, 0,
+			       &par.cuts);
+	par.out = ymalloc(sizeof(STRBUF *) * par.nparts);
+	par.counts = ymalloc(sizeof(struct text_counts) * par.nparts);
+	memset(par.counts, 0, sizeof(struct text_counts) * par.nparts);
+
+	pool_run(jobs, par.nparts, par_finish, &par);
+
+	outbuf = par.out[0];
+	for (i = 1; i < par.nparts; i++) {
+		if (outbuf && par.out[i])
+			strbuf_append_n(outbuf, strbuf_get(par.out[i]),
+					strbuf_len(par.out[i]));
+		else if (outbuf) {
+			strbuf_free(outbuf);
+			outbuf = NULL;
+		}
+		if (par.out[i])
+			strbuf_free(par.out[i]);
+	}
+	if (outbuf && opt_tokens & TOKENS_COUNT) {
+		struct text_counts sum = { 0, 0, 0 };
+		iconv_t ic = open_conv();
+
+		for (i = 0; i < par.nparts; i++) {
+			sum.words += par.counts[i].words;
+			sum.chars += par.counts[i].chars;
+			sum.paras += par.counts[i].paras;
+		}
+		strbuf_free(outbuf);
+		outbuf = ic == (iconv_t)-1 ? NULL : convert_counts(ic, &sum);
+		if (ic != (iconv_t)-1)
+			finish_conv(ic);
+	}
+	if (outbuf)
+		strbuf_setopt(outbuf, STRBUF_NULLOK);
+
+	yfree(par.counts);
+	yfree(par.out);
+	yfree(par.cuts);
+	strbuf_free(buf);
+	return outbuf;
+}
+
+/*
+ * Does the same as the sequential path in convert_doc(), but splits
+ * the document into parts which are formatted, wrapped and converted
+ * on up to jobs threads.
+ */
+static STRBUF *convert_parallel(STRBUF *docbuf, int jobs)
+{
+	struct par par;
+	STRBUF *outbuf;
+	size_t target;
+	size_t i;
+
+	target = strbuf_len(docbuf) / ((size_t)jobs * 4);
+	if (target < PAR_MIN_PART)
+		target = PAR_MIN_PART;
+
+	par.nparts = split_doc(strbuf_get(docbuf), strbuf_len(docbuf),
+			       target, 1, &par.cuts);
+	par.parts = ymalloc(sizeof(STRBUF *) * par.nparts);
+	for (i = 0; i < par.nparts; i++) {
+		par.parts[i] = strbuf_new();
+		strbuf_append_n(par.parts[i],
+				strbuf_get(docbuf) + par.cuts[i],
+				par.cuts[i + 1] - par.cuts[i]);
+	}
+	yfree(par.cuts);
+
+	pool_run(jobs, par.nparts, par_format, &par);
+
+	outbuf = finish_parallel(par.parts, par.nparts, jobs);
+	yfree(par.parts);
+	return outbuf;
+}
+
+/*
+ * --cache: the output of each paragraph of content.xml from the last
+ * conversion of a document.  The document is split behind every
+ * </text:p> and </text:h>, see find_cut(), and a part whose XML has
+ * not changed since is neither substituted, formatted, wrapped nor
+ * converted again if its output can be used as it is.  That is the
+ * case when its formatted text and the text before it end with a
+ * blank line, as the wrapping starts afresh behind those, see
+ * finish_parallel().  The other parts are formatted and converted
+ * in groups which reach from one such seam to the next.
+ *
+ * The file starts with the line
+ *
+ *	odt2txt cache 1 VERSION ENCODING SUBST WIDTH TOKENS
+ *
+ * as the output depends on these, and has a record per part: a line
+ * with the hash of its XML, the length of the XML, its CACHE_ flags
+ * and the length of its output, in hex, followed by the output.
+ */
+struct cache_file {
+	int dir_fd;		/* AT_FDCWD for a single document */
+	const char *name;
+	const char *path;	/* of the directory, for messages */
+};
+
+#ifndef NO_OPENAT
+
+#define CACHE_BLANK  1		/* the formatted text is white space */
+#define CACHE_CLEAN  2		/* it ends with a blank line */
+#define CACHE_OUTPUT 4		/* the output of the part is cached */
+
+struct cache_entry {
+	uint64_t hash;
+	size_t xml_len;
+	int flags;
+	const char *text;	/* the output, with CACHE_OUTPUT */
+	size_t len;
+};
+
+struct cache_part {
+	const char *xml;
+	size_t xml_len;
+	uint64_t hash;
+	const struct cache_entry *e;	/* NULL if it is not cached */
+	STRBUF *fmt;			/* the formatted text, if needed */
+	int flags;
+	STRBUF *out;			/* output for the cache, or NULL */
+};
+
+/*
+ * The CRC-32 and the Adler-32 of the XML, which zlib computes faster
+ * than the document is read.  Together with the length, a collision
+ * of two versions of a paragraph is unlikely enough.
+ */
+static uint64_t part_hash(const char *p, size_t len)
+{
+	uLong crc = crc32(0L, Z_NULL, 0);
+	uLong adler = adler32(0L, Z_NULL, 0);
+
+	while (len > 0) {
+		uInt n = len > (1U << 30) ? 1U << 30 : (uInt)len;
+
+		crc = crc32(crc, (const Bytef *)p, n);
+		adler = adler32(adler, (const Bytef *)p, n);
+		p += n;
+		len -= n;
+	}
+	return (uint64_t)(crc & 0xffffffffUL) << 32 | (adler & 0xffffffffUL);
+}
+
+static void cache_header(char *buf, size_t len)
+{
+	snprintf(buf, len, "odt2txt cache 1 %s %s %d %d %d\n", VERSION,
+		 conv_encoding ? conv_encoding : "UTF-8", opt_subst,
+		 opt_width, opt_tokens);
+}
+
+static int cmp_cache_entry(const void *a, const void *b)
+{
+	const struct cache_entry *x = a, *y = b;
+
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	return x->xml_len < y->xml_len ? -1 : x->xml_len > y->xml_len;
+}
+
+/*
+ * Reads a hex number at *p, before end, which must be followed by
+ * the character sep.  Returns -1 if it isn't.
+ */
+static int cache_field(const char **p, const char *end, int sep,
+		       uint64_t *val)
+{
+	const char *q = *p;
+	uint64_t v = 0;
+
+	for (; q < end && *q != sep; q++) {
+		int d = *q >= '0' && *q <= '9' ? *q - '0' :
+			*q >= 'a' && *q <= 'f' ? *q - 'a' + 10 : -1;
+
+		if (d < 0 || v >> 60)
+			return -1;
+		v = v << 4 | (uint64_t)d;
+	}
+	if (q == end || q == *p)
+		return -1;
+	*p = q + 1;
+	*val = v;
+	return 0;
+}
+
+/*
+ * Reads the cache file into *file and returns the number of its
+ * entries, sorted for bsearch().  A cache which is missing, was
+ * written with other options or is damaged has none.
+ */
+static size_t cache_load(const struct cache_file *cf, STRBUF **file,
+			 struct cache_entry **entries)
+{
+	char header[256];
+	const char *p, *end;
+	size_t n = 0, sz = 0;
+	FILE *in;
+	int fd;
+
+	*file = NULL;
+	*entries = NULL;
+	fd = openat(cf->dir_fd, cf->name, O_RDONLY);
+	if (fd == -1 || !(in = fdopen(fd, "rb"))) {
+		if (fd != -1)
+			close(fd);
+		return 0;
+	}
+	*file = strbuf_new();
+	strbuf_setopt(*file, STRBUF_NULLOK);
+	strbuf_append_file(*file, in);
+	fclose(in);
+
+	cache_header(header, sizeof(header));
+	p = strbuf_get(*file);
+	end = p + strbuf_len(*file);
+	if ((size_t)(end - p) < strlen(header) ||
+	    memcmp(p, header, strlen(header)))
+		return 0;
+	p += strlen(header);
+
+	while (p < end) {
+		struct cache_entry e;
+		uint64_t xml_len, flags, len;
+
+		if (cache_field(&p, end, ' ', &e.hash) ||
+		    cache_field(&p, end, ' ', &xml_len) ||
+		    cache_field(&p, end, ' ', &flags) ||
+		    cache_field(&p, end, '\n', &len) ||
+		    len > (uint64_t)(end - p))
+			goto damaged;
+		e.xml_len = (size_t)xml_len;
+		e.flags = (int)(flags & (CACHE_BLANK | CACHE_CLEAN |
+					 CACHE_OUTPUT));
+		e.text = p;
+		e.len = (size_t)len;
+		p = e.text + e.len;
+
+		if (n == sz) {
+			sz = sz ? sz << 1 : 256;
+			*entries = yrealloc(*entries, sizeof(e) * sz);
+		}
+		(*entries)[n++] = e;
+	}
+
+	qsort(*entries, n, sizeof(**entries), cmp_cache_entry);
+	return n;
+
+damaged:
+	fprintf(stderr, "Ignoring damaged cache %s/%s\n", cf->path, cf->name);
+	return 0;
+}
+
+/*
+ * Writes an entry per part to the cache.
+ */
+static void cache_store(const struct cache_file *cf,
+			const struct cache_part *parts, size_t nparts)
+{
+	STRBUF *buf = strbuf_new();
+	char line[256];
+	size_t i;
+
+	strbuf_setopt(buf, STRBUF_NULLOK);
+	cache_header(line, sizeof(line));
+	strbuf_append(buf, line);
+	for (i = 0; i < nparts; i++) {
+		const struct cache_part *part = &parts[i];
+		const char *text = NULL;
+		size_t len = 0;
+		int flags = part->flags;
+
+		if (part->out) {
+			text = strbuf_get(part->out);
+			len = strbuf_len(part->out);
+			flags |= CACHE_OUTPUT;
+		} else if (part->e && part->e->flags & CACHE_OUTPUT) {
+			text = part->e->text;
+			len = part->e->len;
+			flags |= CACHE_OUTPUT;
+		}
+
+		snprintf(line, sizeof(line), "%016llx %lx %x %lx\n",
+			 (unsigned long long)part->hash,
+			 (unsigned long)part->xml_len, (unsigned)flags,
+			 (unsigned long)len);
+		strbuf_append(buf, line);
+		strbuf_append_n(buf, text, len);
+	}
+
+	/* the text is still right without a cache */
+	(void)write_at(cf->dir_fd, cf->name, buf, cf->path);
+	strbuf_free(buf);
+}
+
+/*
+ * Returns the CACHE_BLANK and CACHE_CLEAN flags of a formatted part.
+ */
+static int cache_flags(STRBUF *fmt)
+{
+	const char *d = strbuf_get(fmt);
+	size_t len = strbuf_len(fmt);
+	size_t nl = 0;
+
+	while (len > 0 && (d[len - 1] == ' ' || d[len - 1] == '\n')) {
+		if (d[len - 1] == '\n')
+			nl++;
+		len--;
+	}
+	return (len ? 0 : CACHE_BLANK) | (nl >= 2 ? CACHE_CLEAN : 0);
+}
+
+struct cache_runs {
+	struct cache_part *parts;
+	size_t *runs;		/* first and behind the last part of each */
+};
+
+/*
+ * Formats a run of successive parts.  The substitutions run on the
+ * whole run at once, as each of them costs a pass over its text.  As
+ * they don't touch the tags, the run is split where it was before.
+ */
+static void cache_format(void *arg, size_t r)
+{
+	struct cache_runs *cr = arg;
+	size_t first = cr->runs[2 * r], last = cr->runs[2 * r + 1];
+	STRBUF *buf = strbuf_new();
+	const char *p, *end, *cut;
+	size_t i;
+
+	regex_set_deadline(opt_timeout ? &doc_deadline : NULL);
+	for (i = first; i < last; i++)
+		strbuf_append_n(buf, cr->parts[i].xml, cr->parts[i].xml_len);
+	subst_doc(buf);
+
+	p = strbuf_get(buf);
+	end = p + strbuf_len(buf);
+	for (i = first; i < last; i++) {
+		struct cache_part *part = &cr->parts[i];
+
+		cut = i + 1 < last ? find_cut(p, end, 1) : NULL;
+		if (!cut)
+			cut = end;
+		part->fmt = strbuf_new();
+		strbuf_append_n(part->fmt, p, (size_t)(cut - p));
+		format_part(part->fmt);
+		part->flags = cache_flags(part->fmt);
+		p = cut;
+	}
+	strbuf_free(buf);
+}
+
+/*
+ * Formats the parts which need[] marks and are not formatted yet, in
+ * runs of up to PAR_MIN_PART bytes on up to jobs threads.
+ */
+static void cache_format_parts(struct cache_part *parts, size_t nparts,
+			       const char *need, int jobs)
+{
+	struct cache_runs cr;
+	size_t i, nruns = 0, size = 0;
+
+	cr.parts = parts;
+	cr.runs = ymalloc(sizeof(size_t) * 2 * (nparts + 1));
+	for (i = 0; i < nparts; i++) {
+		if (!need[i] || parts[i].fmt)
+			continue;
+		if (!nruns || cr.runs[2 * nruns - 1] != i ||
+		    size >= PAR_MIN_PART) {
+			cr.runs[2 * nruns] = i;
+			nruns++;
+			size = 0;
+		}
+		cr.runs[2 * nruns - 1] = i + 1;
+		size += parts[i].xml_len;
+	}
+
+	pool_run(jobs, nruns, cache_format, &cr);
+	yfree(cr.runs);
+}
+
+/*
+ * Joins, wraps and converts the formatted parts first to last - 1 like
+ * finish_parallel() does, as the start or the end of the document if
+ * they are at either.  Returns their output, or NULL if it can't be
+ * converted.
+ */
+static STRBUF *cache_group(iconv_t ic, struct cache_part *parts,
+			   size_t first, size_t last, size_t nparts)
+{
+	STRBUF *buf = strbuf_new();
+	STRBUF *wbuf = strbuf_new();
+	STRBUF *outbuf;
+	struct text_counts counts;
+	size_t i;
+
+	for (i = first; i < last; i++) {
+		if (i == first && first > 0) {
+			/* the text before ends with a blank line */
+			const char *p = strbuf_get(parts[i].fmt);
+			size_t len = strbuf_len(parts[i].fmt), lead = 0;
+
+			while (lead < len && (p[lead] == ' ' || p[lead] == '\n'))
+				lead++;
+			strbuf_append_n(buf, p + lead, len - lead);
+		} else
+			join_part(buf, parts[i].fmt);
+	}
+
+	if (first == 0)
+		RS_O("^\n+",  "");
+	if (last == nparts)
+		RS_O("\n{2,}$",  "\n");
+
+	if (opt_tokens) {
+		tokenize_n(wbuf, strbuf_get(buf), strbuf_len(buf),
+			   opt_tokens, 1, &counts);
+	} else {
+		if (first == 0 && opt_width != -1)
+			strbuf_append_n(wbuf, "\n", 1);
+		wrap_n(wbuf, strbuf_get(buf), strbuf_len(buf), opt_width);
+		if (last == nparts && opt_width != -1)
+			strbuf_append_n(wbuf, "\n", 1);
+	}
+
+	outbuf = conv(ic, wbuf, NULL);
+	strbuf_free(wbuf);
+	strbuf_free(buf);
+	return outbuf;
+}
+
+/*
+ * Does the same as convert_parallel(), but takes the output of the
+ * parts of the document which are in the cache file cf from there.
+ * The cache is rewritten if any part was not in it.
+ */
+static STRBUF *convert_cached(iconv_t ic, STRBUF *docbuf,
+			      const struct cache_file *cf, int jobs)
+{
+	const char *doc = strbuf_get(docbuf);
+	const char *end = doc + strbuf_len(docbuf);
+	const char *p, *cut;
+	struct cache_entry *entries, key;
+	struct cache_part *parts = NULL;
+	STRBUF *file, *outbuf, *out;
+	size_t nentries, nparts = 0, sz = 0;
+	size_t *groups, ngroups = 0;
+	size_t i, j, head, tail, reused = 0;
+	char *need, *clean;
+	int changed = 0;
+
+	nentries = cache_load(cf, &file, &entries);
+
+	for (p = doc; p < end || !nparts; p = cut) {
+		struct cache_part *part;
+
+		cut = find_cut(p, end, 1);
+		if (!cut)
+			cut = end;
+
+		if (nparts == sz) {
+			sz = sz ? sz << 1 : 256;
+			parts = yrealloc(parts, sizeof(*parts) * sz);
+		}
+		part = &parts[nparts++];
+		part->xml = p;
+		part->xml_len = (size_t)(cut - p);
+		part->hash = part_hash(p, part->xml_len);
+		part->fmt = NULL;
+		part->out = NULL;
+
+		key.hash = part->hash;
+		key.xml_len = part->xml_len;
+		part->e = nentries ? bsearch(&key, entries, nentries,
+					     sizeof(key), cmp_cache_entry) : NULL;
+		if (part->e)
+			part->flags = part->e->flags & (CACHE_BLANK | CACHE_CLEAN);
+		else
+			changed = 1;
+	}
+	if (nparts != nentries)
+		changed = 1;
+
+	need = ymalloc(nparts);
+	clean = ymalloc(nparts);
+	for (i = 0; i < nparts; i++)
+		need[i] = !parts[i].e;
+	cache_format_parts(parts, nparts, need, jobs);
+
+	/* the blank lines at the start and the end go with the text */
+	for (head = 0; head < nparts; head++) {
+		if (!(parts[head].flags & CACHE_BLANK))
+			break;
+	}
+	for (tail = nparts; tail > 0; tail--) {
+		if (!(parts[tail - 1].flags & CACHE_BLANK))
+			break;
+	}
+	for (i = 0; i < nparts; i++) {
+		clean[i] = parts[i].flags & CACHE_CLEAN ||
+			(parts[i].flags & CACHE_BLANK && (!i || clean[i - 1]));
+	}
+
+	/* a group ends behind a part which ends with a blank line */
+	groups = ymalloc(sizeof(size_t) * (nparts + 1));
+	for (i = 0; i < nparts; i = j) {
+		j = i < head ? head + 1 : i + 1;
+		while (j < nparts && !clean[j - 1])
+			j++;
+		if (j >= tail || j > nparts)
+			j = nparts;
+		groups[ngroups++] = i;
+		if (j > i + 1 || i <= head || j == nparts ||
+		    !(parts[i].e && parts[i].e->flags & CACHE_OUTPUT))
+			memset(need + i, 1, j - i);
+		else
+			need[i] = 0;
+	}
+	groups[ngroups] = nparts;
+	cache_format_parts(parts, nparts, need, jobs);
+
+	outbuf = strbuf_new();
+	strbuf_setopt(outbuf, STRBUF_NULLOK);
+	for (i = 0; outbuf && i < ngroups; i++) {
+		size_t first = groups[i], last = groups[i + 1];
+		struct cache_part *part = &parts[first];
+
+		/* over --timeout, the parts may not be formatted */
+		if (opt_timeout && regex_deadline_passed())
+			break;
+
+		if (!need[first]) {
+			strbuf_append_n(outbuf, part->e->text, part->e->len);
+			reused++;
+			continue;
+		}
+
+		out = cache_group(ic, parts, first, last, nparts);
+		if (!out) {
+			strbuf_free(outbuf);
+			outbuf = NULL;
+			break;
+		}
+		strbuf_append_n(outbuf, strbuf_get(out), strbuf_len(out));
+		if (last == first + 1 && first > head && last < nparts &&
+		    !(part->e && part->e->flags & CACHE_OUTPUT)) {
+			part->out = out;
+			changed = 1;
+		} else
+			strbuf_free(out);
+	}
+	PROBE2(cache_end, (long)nparts, (long)reused);
+
+	if (outbuf && changed && !(opt_timeout && regex_deadline_passed()))
+		cache_store(cf, parts, nparts);
+
+	for (i = 0; i < nparts; i++) {
+		if (parts[i].fmt)
+			strbuf_free(parts[i].fmt);
+		if (parts[i].out)
+			strbuf_free(parts[i].out);
+	}
+	yfree(groups);
+	yfree(clean);
+	yfree(need);
+	yfree(parts);
+	if (file)
+		strbuf_free(file);
+	if (entries)
+		yfree(entries);
+	return outbuf;
+}
+
+#endif /* NO_OPENAT */
+
+#ifndef NO_PTHREADS
+
+#define PIPE_BLOCK_SZ (64 * 1024)
+#define PIPE_SLOTS    16
+
+struct pipe {
+	struct docstream *in;
+	RING *ring;
+	int error;	/* errno of a failed read */
+};
+
+static void *pipe_producer(void *arg)
+{
+	struct pipe *pipe = arg;
+	long len;
+
+	errno = 0;
+	do {
+		char *block = ring_get_free(pipe->ring);
+
+		len = read_stream(pipe->in, block, PIPE_BLOCK_SZ);
+		if (len > 0)
+			ring_put(pipe->ring, (size_t)len);
+	} while (len > 0);
+
+	pipe->error = len < 0 ? (errno ? errno : EIO) : 0;
+	ring_close(pipe->ring);
+	return NULL;
+}
+
+static void pipe_format(void *job)
+{
+	STRBUF *part = job;
+
+	regex_set_deadline(opt_timeout ? &doc_deadline : NULL);
+	subst_doc(part);
+	format_part(part);
+}
+
+/*
+ * Like convert_parallel(), but content.xml is inflated on its own
+ * thread while the parts which are already complete are formatted.
+ * The whole uncompressed document is never held in memory.  Returns
+ * NULL on errors.
+ */
+static STRBUF *convert_pipelined(const char *zipfile, const char *filename,
+				 int jobs)
+{
+	struct pipe pipe;
+	pthread_t producer;
+	POOL *pool;
+	STRBUF **parts = NULL;
+	size_t nparts = 0, parts_sz = 0;
+	STRBUF *pending;
+	struct skip s = { 0, NULL, 0, 0 };
+	const char *block;
+	size_t len;
+	size_t scan = PAR_MIN_PART;
+	size_t i;
+	int r;
+
+	pipe.in = open_from_zip(zipfile, filename);
+	if (!pipe.in)
+		return NULL;
+	pipe.ring = ring_new(PIPE_SLOTS, PIPE_BLOCK_SZ);
+	pipe.error = 0;
+
+	r = pthread_create(&producer, NULL, pipe_producer, &pipe);
+	if (r) {
+		fprintf(stderr, "Can't create thread: %s\n", strerror(r));
+		close_stream(pipe.in);
+		ring_free(pipe.ring);
+		return NULL;
+	}
+
+	pool = pool_start(jobs, pipe_format);
+	pending = strbuf_new();
+
+	for (;;) {
+		const char *cut = NULL;
+
+		block = ring_get(pipe.ring, &len);
+		if (block && opt_timeout && regex_deadline_passed()) {
+			/* the document is given up, the producer only
+			   needs to finish */
+			ring_release(pipe.ring);
+			continue;
+		}
+		if (block) {
+			strbuf_append_n(pending, block, len);
+			ring_release(pipe.ring);
+			skip_elements(pending, &s, NULL, 0);
+
+			/* a tag behind s.pos may still be cut off */
+			if (s.pos < scan)
+				continue;
+			cut = find_cut(strbuf_get(pending) + scan,
+				       strbuf_get(pending) + s.pos, 1);
+			if (!cut) {
+				/* the next block may complete an end tag */
+				scan = s.pos - 8;
+				continue;
+			}
+		}
+
+		if (nparts == parts_sz) {
+			parts_sz = parts_sz ? parts_sz << 1 : 16;
+			parts = yrealloc(parts, sizeof(STRBUF *) * parts_sz);
+		}
+
+		if (!block) {
+			/* the rest of the document */
+			skip_elements(pending, &s, NULL, 1);
+			parts[nparts++] = pending;
+			pool_add(pool, pending);
+			break;
+		}
+
+		len = (size_t)(cut - strbuf_get(pending));
+		parts[nparts] = strbuf_new();
+		strbuf_append_n(parts[nparts], strbuf_get(pending), len);
+		pool_add(pool, parts[nparts++]);
+
+		(void)strbuf_subst(pending, 0, len, "");
+		s.pos -= len;
+		scan = PAR_MIN_PART;
+	}
+
+	pthread_join(producer, NULL);
+	pool_finish(pool);
+	close_stream(pipe.in);
+	ring_free(pipe.ring);
+
+	if (pipe.error) {
+		errno = pipe.error;
+		extract_failed(zipfile, filename);
+		for (i = 0; i < nparts; i++)
+			strbuf_free(parts[i]);
+		yfree(parts);
+		return NULL;
+	}
+
+	pending = finish_parallel(parts, nparts, jobs);
+	yfree(parts);
+	return pending;
+}
+
+#endif
+
+/*
+ * --offsets: where the paragraphs and headings of a document start,
+ * in content.xml and in the output.  The offsets into the output are
+ * marks which start behind the start tags and follow the text
+ * through the conversion.
+ */
+struct anchors {
+	size_t *xml;		/* offsets of the start tags */
+	int *level;		/* outline level of a heading, 0 for paragraphs */
+	struct regex_marks marks;
+	size_t sz;
+};
+
+static void anchors_init(struct anchors *an)
+{
+	an->xml = NULL;
+	an->level = NULL;
+	an->marks.pos = NULL;
+	an->marks.n = 0;
+	an->sz = 0;
+}
+
+static void anchors_free(struct anchors *an)
+{
+	if (an->sz) {
+		yfree(an->xml);
+		yfree(an->level);
+		yfree(an->marks.pos);
+	}
+}
+
+/*
+ * Finds the non-empty text:p and text:h elements in doc, but not
+ * those in the --skip elements.
+ */
+static void find_anchors(STRBUF *doc, struct anchors *an)
+{
+	static const char level_attr[] = "text:outline-level=\"";
+	const char *data = strbuf_get(doc);
+	const char *end = data + strbuf_len(doc);
+	const char *p = data, *gt, *attr;
+	struct skip s = { 0, NULL, 0, 0 };
+	struct tag t;
+	size_t n = 0;
+
+	anchors_init(an);
+
+	while ((p = memchr(p, '<', (size_t)(end - p)))) {
+		if (nskip && p[1] != '/' &&
+		    (gt = memchr(p, '>', (size_t)(end - p)))) {
+			tag_at(&t, p, gt + 1, end);
+			if (!t.empty &&
+			    (s.name = is_skipped(t.name, t.name_len))) {
+				s.len = t.name_len;
+				s.depth = 1;
+				p = skip_subtree(&s, t.end, end, 1);
+				continue;
+			}
+		}
+
+		if (end - p < 9 || memcmp(p + 1, "text:", 5) ||
+		    (p[6] != 'p' && p[6] != 'h') ||
+		    (p[7] != ' ' && p[7] != '>' && p[7] != '/')) {
+			p++;
+			continue;
+		}
+
+		gt = memchr(p, '>', (size_t)(end - p));
+		if (!gt)
+			break;
+		if (gt[-1] == '/') {
+			p = gt;
+			continue;
+		}
+
+		if (n == an->sz) {
+			an->sz = an->sz ? an->sz * 2 : 64;
+			an->xml = yrealloc(an->xml, an->sz * sizeof(size_t));
+			an->level = yrealloc(an->level, an->sz * sizeof(int));
+			an->marks.pos = yrealloc(an->marks.pos,
+						 an->sz * sizeof(size_t));
+		}
+
+		an->xml[n] = (size_t)(p - data);
+		an->level[n] = 0;
+		if (p[6] == 'h') {
+			/* 1 unless the attribute says otherwise */
+			an->level[n] = 1;
+			for (attr = p; attr + sizeof(level_attr) - 1 < gt; attr++) {
+				if (!memcmp(attr, level_attr, sizeof(level_attr) - 1)) {
+					an->level[n] = atoi(attr + sizeof(level_attr) - 1);
+					break;
+				}
+			}
+		}
+		an->marks.pos[n] = (size_t)(gt + 1 - data);
+		n++;
+		p = gt;
+	}
+
+	an->marks.n = n;
+}
+
+/*
+ * Moves the marks in the formatted document buf from the end of the
+ * start tags to the first character of the text.  Elements without
+ * text of their own, e.g. a paragraph which only holds another one,
+ * are dropped.
+ */
+static void settle_anchors(struct anchors *an, STRBUF *buf)
+{
+	const char *data = strbuf_get(buf);
+	size_t len = strbuf_len(buf);
+	size_t i, n = 0;
+	size_t *pos = an->marks.pos;
+
+	for (i = 0; i < an->marks.n; i++) {
+		while (pos[i] < len && (data[pos[i]] == ' ' || data[pos[i]] == '\n'))
+			pos[i]++;
+	}
+
+	for (i = 0; i < an->marks.n; i++) {
+		if (pos[i] == len ||
+		    (i + 1 < an->marks.n && pos[i] == pos[i + 1]))
+			continue;
+		an->xml[n] = an->xml[i];
+		an->level[n] = an->level[i];
+		pos[n] = pos[i];
+		n++;
+	}
+	an->marks.n = n;
+}
+
+/*
+ * Moves the marks from buf to its wrapped copy wbuf.  Wrapping only
+ * changes spaces and line feeds, so a mark stays at the character
+ * which has as many other characters in front of it.  Marks on text
+ * which is not wrapped, e.g. that of a paragraph which is not closed
+ * at the end of the document, are dropped.
+ */
+static void wrap_anchors(struct anchors *an, STRBUF *buf, STRBUF *wbuf)
+{
+	const char *s = strbuf_get(buf);
+	const char *d = strbuf_get(wbuf);
+	size_t dlen = strbuf_len(wbuf);
+	size_t i, sp = 0, dp = 0;
+
+	for (i = 0; i < an->marks.n; i++) {
+		for (; sp < an->marks.pos[i]; sp++) {
+			if (s[sp] == ' ' || s[sp] == '\n')
+				continue;
+			while (dp < dlen && (d[dp] == ' ' || d[dp] == '\n'))
+				dp++;
+			if (dp < dlen)
+				dp++;
+		}
+		while (dp < dlen && (d[dp] == ' ' || d[dp] == '\n'))
+			dp++;
+		an->marks.pos[i] = dp;
+	}
+
+	while (an->marks.n && an->marks.pos[an->marks.n - 1] == dlen)
+		an->marks.n--;
+}
+
+/*
+ * Appends the anchors as a JSON array of objects with the offset in
+ * the output, the offset in content.xml, the element and its outline
+ * level, which is null for paragraphs.
+ */
+static void append_anchors(STRBUF *out, struct anchors *an)
+{
+	char num[128];
+	size_t i;
+
+	strbuf_append_n(out, "[", 1);
+	for (i = 0; i < an->marks.n; i++) {
+		if (an->level[i])
+			snprintf(num, sizeof(num), "%s{\"offset\":%lu,"
+				 "\"xml_offset\":%lu,\"element\":\"text:h\","
+				 "\"level\":%d}", i ? "," : "",
+				 (unsigned long)an->marks.pos[i],
+				 (unsigned long)an->xml[i], an->level[i]);
+		else
+			snprintf(num, sizeof(num), "%s{\"offset\":%lu,"
+				 "\"xml_offset\":%lu,\"element\":\"text:p\","
+				 "\"level\":null}", i ? "," : "",
+				 (unsigned long)an->marks.pos[i],
+				 (unsigned long)an->xml[i]);
+		strbuf_append(out, num);
+	}
+	strbuf_append_n(out, "]", 1);
+}
+
+/*
+ * Appends the contents of the page styles' elements name, e.g.
+ * style:header, and of their variants for left and first pages to
+ * out.  A part which several page styles share is appended once.
+ */
+static void find_page_parts(STRBUF *out, STRBUF *styles, const char *name)
+{
+	const char *data = strbuf_get(styles);
+	const char *end = data + strbuf_len(styles);
+	const char *p = data, *q, *gt, *stop;
+	size_t name_len = strlen(name);
+	size_t *parts = NULL;	/* offset and length in out of each part */
+	size_t nparts = 0, parts_sz = 0, i;
+	char close[32];
+
+	while ((p = memchr(p, '<', (size_t)(end - p)))) {
+		q = p + 1;
+		if ((size_t)(end - q) < name_len || memcmp(q, name, name_len)) {
+			p++;
+			continue;
+		}
+		q += name_len;
+		if (end - q >= 5 && !memcmp(q, "-left", 5))
+			q += 5;
+		else if (end - q >= 6 && !memcmp(q, "-first", 6))
+			q += 6;
+		if (q == end || (*q != '>' && *q != ' ')) {
+			/* e.g. style:header-style */
+			p++;
+			continue;
+		}
+
+		gt = memchr(q, '>', (size_t)(end - q));
+		if (!gt)
+			break;
+		if (gt[-1] == '/') {
+			p = gt;
+			continue;
+		}
+		snprintf(close, sizeof(close), "</%.*s>", (int)(q - p - 1), p + 1);
+		stop = strstr(gt + 1, close);
+		if (!stop)
+			break;
+		p = stop;
+
+		for (i = 0; i < nparts; i++) {
+			if (parts[2 * i + 1] == (size_t)(stop - gt - 1) &&
+			    !memcmp(strbuf_get(out) + parts[2 * i], gt + 1,
+				    (size_t)(stop - gt - 1)))
+				break;
+		}
+		if (i < nparts)
+			continue;
+
+		if (nparts == parts_sz) {
+			parts_sz = parts_sz ? parts_sz * 2 : 8;
+			parts = yrealloc(parts, 2 * parts_sz * sizeof(size_t));
+		}
+		parts[2 * nparts] = strbuf_len(out);
+		parts[2 * nparts + 1] = (size_t)(stop - gt - 1);
+		nparts++;
+		strbuf_append_n(out, gt + 1, (size_t)(stop - gt - 1));
+	}
+
+	if (parts)
+		yfree(parts);
+}
+
+/*
+ * Returns the length of the footnote or endnote element which starts
+ * at p, or 0 if there is none.  *close is set to its end tag, or to
+ * NULL if it isn't closed.
+ */
+static size_t note_at(const char *p, const char *end, const char **close)
+{
+	static const char *const ends[] = {
+		"</text:note>", "</text:footnote>", "</text:endnote>", NULL
+	};
+	const char *const *e;
+	const char *stop;
+	size_t len;
+
+	for (e = ends; *e; e++) {
+		len = strlen(*e) - 3;
+		if ((size_t)(end - p) > len + 1 && !memcmp(p + 1, *e + 2, len) &&
+		    (p[len + 1] == ' ' || p[len + 1] == '>'))
+			break;
+	}
+	if (!*e)
+		return 0;
+
+	*close = NULL;
+	stop = strstr(p, *e);
+	if (!stop)
+		return 1;
+
+	*close = *e;
+	return (size_t)(stop - p) + strlen(*e);
+}
+
+/*
+ * Moves the footnotes and endnotes out of doc and appends them to
+ * out, each starting with its citation.  In doc, the citations are
+ * left in brackets.  marks, if not NULL, are moved like
+ * regex_subst() does.
+ */
+static void take_notes(STRBUF *doc, STRBUF *out, struct regex_marks *marks)
+{
+	const char *data = strbuf_get(doc);
+	const char *end = data + strbuf_len(doc);
+	const char *p = data, *copied = data;
+	const char *close, *cit, *cit_end, *body, *stop, *gt;
+	STRBUF *rest = NULL;
+	size_t len, next = 0;
+
+	while ((p = memchr(p, '<', (size_t)(end - p)))) {
+		len = note_at(p, end, &close);
+		if (!len) {
+			p++;
+			continue;
+		}
+		if (!close)
+			break;	/* and neither are the ones behind it */
+		stop = p + len - strlen(close);
+
+		cit = find_between(p, stop, "-citation");
+		cit = cit ? memchr(cit, '>', (size_t)(stop - cit)) : NULL;
+		cit_end = NULL;
+		if (cit) {
+			cit++;
+			cit_end = memchr(cit, '<', (size_t)(stop - cit));
+		}
+		if (!cit_end)
+			cit = cit_end = stop;
+		body = find_between(p, stop, "-body>");
+		body = body ? body + 6 : stop;
+
+		if (!rest) {
+			rest = strbuf_new();
+			strbuf_reserve(rest, strbuf_len(doc));
+		}
+		strbuf_append_n(rest, copied, (size_t)(p - copied));
+		if (marks)
+			move_note_marks(marks, &next, (size_t)(copied - data),
+					(size_t)(p - data), (size_t)(p + len - data),
+					strbuf_len(rest) - (size_t)(p - copied));
+		strbuf_append_n(rest, "[", 1);
+		strbuf_append_n(rest, cit, (size_t)(cit_end - cit));
+		strbuf_append_n(rest, "]", 1);
+		copied = p = p + len;
+
+		/* the citation goes into the first paragraph of the note */
+		strbuf_append_n(out, "\n\n", 2);
+		if (stop - body > 8 && !memcmp(body, "<text:p", 7) &&
+		    (body[7] == ' ' || body[7] == '>') &&
+		    (gt = memchr(body, '>', (size_t)(stop - body)))) {
+			strbuf_append_n(out, body, (size_t)(gt + 1 - body));
+			body = gt + 1;
+		}
+		strbuf_append_n(out, "[", 1);
+		strbuf_append_n(out, cit, (size_t)(cit_end - cit));
+		strbuf_append_n(out, "] ", 2);
+		strbuf_append_n(out, body, (size_t)(stop - body));
+	}
+
+	if (rest) {
+		if (marks)
+			move_note_marks(marks, &next, (size_t)(copied - data),
+					strbuf_len(doc), strbuf_len(doc) + 1,
+					strbuf_len(rest));
+		strbuf_append_n(rest, copied, (size_t)(end - copied));
+		strbuf_swap(doc, rest);
+		strbuf_free(rest);
+	}
+}
+
+/*
+ * Appends the parts to out as a section under a heading, and empties
+ * parts.  Nothing is appended if there are none.  --tokens leaves out
+ * the heading, like the other text which is not in the document.
+ */
+static void append_section(STRBUF *out, const char *title, STRBUF *parts)
+{
+	if (!strbuf_len(parts))
+		return;
+
+	if (!opt_tokens) {
+		strbuf_append(out, "<text:h text:outline-level=\"1\">");
+		strbuf_append(out, title);
+		strbuf_append(out, "</text:h>");
+	}
+	strbuf_append_n(out, strbuf_get(parts), strbuf_len(parts));
+	strbuf_truncate(parts, 0);
+}
+
+/*
+ * Returns the sections which --headers, --footers and --notes ask
+ * for as XML, to be formatted like a document.  The notes are moved
+ * out of doc, the headers and footers come from styles, which is
+ * only used then.
+ */
+static STRBUF *take_sections(STRBUF *doc, STRBUF *styles,
+			     struct regex_marks *marks)
+{
+	STRBUF *out = strbuf_new();
+	STRBUF *parts = strbuf_new();
+
+	if (opt_sections & SECTION_HEADERS) {
+		find_page_parts(parts, styles, "style:header");
+		append_section(out, "Headers", parts);
+	}
+	if (opt_sections & SECTION_FOOTERS) {
+		find_page_parts(parts, styles, "style:footer");
+		append_section(out, "Footers", parts);
+	}
+	if (opt_sections & SECTION_NOTES) {
+		take_notes(doc, parts, marks);
+		append_section(out, "Notes", parts);
+	}
+
+	strbuf_free(parts);
+	return out;
+}
+
+/*
+ * The embedded objects of a package, e.g. charts and formulas.  Each
+ * one is a sub-document with a content.xml of its own in a directory
+ * like "Object 1", which a draw:object in a frame points to.
+ */
+struct objects {
+	const char *zipfile;	/* the package, or NULL if it is data */
+	const char *data;
+	size_t len;
+	const struct timespec *deadline;	/* of the document */
+	size_t n;
+	char **paths;		/* of their content.xml */
+	const char **names;	/* of their frames, name_lens bytes */
+	size_t *name_lens;
+	size_t *at;		/* behind their draw:object tags */
+	STRBUF **texts;		/* formatted, NULL if it can't be read */
+};
+
+/*
+ * Finds the draw:object elements in doc which point into the package.
+ */
+static void find_objects(struct objects *objs, STRBUF *doc)
+{
+	static const char href[] = "xlink:href=\"";
+	static const char name[] = "draw:name=\"";
+	const char *data = strbuf_get(doc);
+	const char *end = data + strbuf_len(doc);
+	const char *p = data, *gt, *q, *qe;
+	const char *frame = NULL, *frame_end = NULL;
+	size_t sz = 0, len;
+
+	objs->n = 0;
+	while ((p = memchr(p, '<', (size_t)(end - p)))) {
+		if (!(gt = memchr(p, '>', (size_t)(end - p))))
+			break;
+		if (end - p > 12 && !memcmp(p, "<draw:frame ", 12)) {
+			frame = p;
+			frame_end = gt;
+		}
+		if (end - p < 13 || memcmp(p, "<draw:object", 12) ||
+		    (p[12] != ' ' && p[12] != '/') ||
+		    !(q = find_between(p, gt, href))) {
+			p = gt;
+			continue;
+		}
+		q += sizeof(href) - 1;
+		qe = memchr(q, '"', (size_t)(gt - q));
+		p = gt;
+		if (!qe)
+			continue;
+
+		/* "./Object 1" or "Object 1/", but no URL */
+		if (qe - q >= 2 && !memcmp(q, "./", 2))
+			q += 2;
+		while (qe > q && qe[-1] == '/')
+			qe--;
+		if (qe == q || *q == '/' || memchr(q, ':', (size_t)(qe - q)) ||
+		    find_between(q, qe, ".."))
+			continue;
+
+		if (objs->n == sz) {
+			sz = sz ? sz << 1 : 8;
+			objs->paths = yrealloc(objs->paths, sizeof(char *) * sz);
+			objs->names = yrealloc(objs->names,
+					       sizeof(const char *) * sz);
+			objs->name_lens = yrealloc(objs->name_lens,
+						   sizeof(size_t) * sz);
+			objs->at = yrealloc(objs->at, sizeof(size_t) * sz);
+		}
+		len = (size_t)(qe - q);
+		objs->paths[objs->n] = ymalloc(len + sizeof("/content.xml"));
+		memcpy(objs->paths[objs->n], q, len);
+		strcpy(objs->paths[objs->n] + len, "/content.xml");
+
+		/* the frame's name, as in "[-- Image: name --]" */
+		objs->names[objs->n] = q;
+		objs->name_lens[objs->n] = len;
+		if (frame && (q = find_between(frame, frame_end, name)) &&
+		    (qe = memchr(q + sizeof(name) - 1, '"',
+				 (size_t)(frame_end - q)))) {
+			objs->names[objs->n] = q + sizeof(name) - 1;
+			objs->name_lens[objs->n] =
+				(size_t)(qe - objs->names[objs->n]);
+		}
+		objs->at[objs->n] = (size_t)(gt + 1 - data);
+		objs->n++;
+	}
+}
+
+/*
+ * Reads and formats object i, on a thread of the pool.
+ */
+static void object_format(void *arg, size_t i)
+{
+	struct objects *objs = arg;
+	struct skip s = { 0, NULL, 0, 0 };
+	const char *body;
+	STRBUF *buf;
+
+	regex_set_deadline(objs->deadline);
+	buf = objs->zipfile ? read_from_zip(objs->zipfile, objs->paths[i]) :
+		read_from_buffer(objs->data, objs->len, objs->paths[i]);
+	if (buf) {
+		/* only the body, like in flat XML */
+		body = strstr(strbuf_get(buf), xml_body_tag);
+		if (body)
+			strbuf_subst(buf, 0, (size_t)(body - strbuf_get(buf)),
+				     "");
+		skip_elements(buf, &s, NULL, 1);
+		subst_doc(buf);
+		format_doc(buf);
+	}
+	objs->texts[i] = buf;
+}
+
+/*
+ * Appends the text at p to out as XML, which format_tags() turns
+ * back into the same text.
+ */
+static void append_xml_text(STRBUF *out, const char *p, size_t len)
+{
+	const char *end = p + len, *run = p;
+	const char *ent;
+
+	for (; p < end; p++) {
+		ent = *p == '&' ? "&amp;" : *p == '<' ? "&lt;" :
+			*p == '>' ? "&gt;" : NULL;
+		if (!ent)
+			continue;
+		strbuf_append_n(out, run, (size_t)(p - run));
+		strbuf_append(out, ent);
+		run = p + 1;
+	}
+	strbuf_append_n(out, run, (size_t)(end - run));
+}
+
+/*
+ * --objects: formats the embedded objects of the package, which is
+ * the file zipfile or else the len bytes at data, on up to jobs
+ * threads, as they are independent documents.  Their text goes into
+ * doc, behind their frames or into a section at its end, so that it
+ * is wrapped and converted with the document.  Objects which can't be
+ * read are left out.
+ */
+static void add_objects(STRBUF *doc, const char *zipfile, const char *data,
+			size_t len, int jobs)
+{
+	struct objects objs;
+	STRBUF *out, *parts;
+	size_t i, copied = 0;
+
+	memset(&objs, 0, sizeof(objs));
+	objs.zipfile = zipfile;
+	objs.data = data;
+	objs.len = len;
+	objs.deadline = regex_get_deadline();
+	find_objects(&objs, doc);
+	if (!objs.n)
+		return;
+
+	objs.texts = ymalloc(sizeof(STRBUF *) * objs.n);
+	pool_run(jobs, objs.n, object_format, &objs);
+	regex_set_deadline(objs.deadline);
+
+	out = strbuf_new();
+	parts = strbuf_new();
+	strbuf_reserve(out, strbuf_len(doc));
+	for (i = 0; i < objs.n; i++) {
+		STRBUF *text = objs.texts[i];
+
+		if (!text || !strbuf_len(text))
+			continue;
+		if (opt_objects == OBJECTS_SECTION) {
+			if (!opt_tokens) {
+				strbuf_append(parts, "<text:h text:outline-level=\"2\">");
+				strbuf_append_n(parts, objs.names[i],
+						objs.name_lens[i]);
+				strbuf_append(parts, "</text:h>");
+			}
+			strbuf_append(parts, "<text:p>");
+			append_xml_text(parts, strbuf_get(text), strbuf_len(text));
+			strbuf_append(parts, "</text:p>");
+		} else {
+			/* paragraphs of their own inside the frame */
+			strbuf_append_n(out, strbuf_get(doc) + copied,
+					objs.at[i] - copied);
+			copied = objs.at[i];
+			strbuf_append_n(out, "\n\n", 2);
+			append_xml_text(out, strbuf_get(text), strbuf_len(text));
+			strbuf_append_n(out, "\n\n", 2);
+		}
+	}
+	strbuf_append_n(out, strbuf_get(doc) + copied,
+			strbuf_len(doc) - copied);
+	append_section(out, "Objects", parts);
+	strbuf_swap(doc, out);
+
+	for (i = 0; i < objs.n; i++) {
+		if (objs.texts[i])
+			strbuf_free(objs.texts[i]);
+		yfree(objs.paths[i]);
+	}
+	strbuf_free(parts);
+	strbuf_free(out);
+	yfree(objs.texts);
+	yfree(objs.at);
+	yfree(objs.name_lens);
+	yfree(objs.names);
+	yfree(objs.paths);
+}
+
+/*
+ * Formats, wraps and converts docbuf on the calling thread, like
+ * convert_doc() does.
+ */
+static STRBUF *convert_text(iconv_t ic, STRBUF *docbuf, struct anchors *an)
+{
+	STRBUF *wbuf;
+	STRBUF *outbuf;
+
+	if (an)
+		regex_set_marks(&an->marks);
+
+	if (!opt_raw) {
+		subst_doc(docbuf);
+		format_doc(docbuf);
+	}
+	regex_set_marks(NULL);
+
+	/* over --timeout, the output is thrown away */
+	if (opt_timeout && regex_deadline_passed())
+		return strbuf_new();
+
+	if (opt_tokens & TOKENS_COUNT) {
+		struct text_counts counts = { 0, 0, 0 };
+
+		tokenize_n(NULL, strbuf_get(docbuf), strbuf_len(docbuf),
+			   opt_tokens, 1, &counts);
+		return convert_counts(ic, &counts);
+	} else if (opt_tokens) {
+		struct text_counts counts = { 0, 0, 0 };
+
+		wbuf = strbuf_new();
+		tokenize_n(wbuf, strbuf_get(docbuf), strbuf_len(docbuf),
+			   opt_tokens, 1, &counts);
+		outbuf = conv(ic, wbuf, NULL);
+		strbuf_free(wbuf);
+		return outbuf;
+	}
+
+	if (an)
+		settle_anchors(an, docbuf);
+
+	wbuf = wrap(docbuf, opt_width);
+	if (an)
+		wrap_anchors(an, docbuf, wbuf);
+
+	outbuf = conv(ic, wbuf, an ? &an->marks : NULL);
+	strbuf_free(wbuf);
+	return outbuf;
+}
+
+/*
+ * Formats, wraps and converts the document in docbuf, which is
+ * modified in the process.  Returns NULL if it can't be converted to
+ * the output encoding.  styles is the content of styles.xml if
+ * opt_sections asks for headers or footers, otherwise it is not
+ * used.  The sections follow the text.  If an is not NULL, it is
+ * filled with the anchors for --offsets, and the document is
+ * converted on the calling thread only.  It must be freed with
+ * anchors_free() then.  cf is NULL or the --cache file, which can't be
+ * combined with an.
+ */
+static STRBUF *convert_doc(iconv_t ic, STRBUF *docbuf, STRBUF *styles,
+			   struct anchors *an, const struct cache_file *cf)
+{
+	STRBUF *sections = NULL;
+	STRBUF *outbuf, *secbuf;
+
+	/* the anchors point into content.xml as it was read */
+	if (an)
+		find_anchors(docbuf, an);
+	if (!opt_raw) {
+		struct skip s = { 0, NULL, 0, 0 };
+
+		skip_elements(docbuf, &s, an ? &an->marks : NULL, 1);
+	}
+	if (opt_sections)
+		sections = take_sections(docbuf, styles,
+					 an ? &an->marks : NULL);
+
+#ifndef NO_OPENAT
+	if (cf && !opt_raw)
+		outbuf = convert_cached(ic, docbuf, cf, opt_jobs);
+	else
+#endif
+	if (!an && !opt_raw && opt_jobs > 1 &&
+	    strbuf_len(docbuf) >= 2 * PAR_MIN_PART)
+		outbuf = convert_parallel(docbuf, opt_jobs);
+	else
+		outbuf = convert_text(ic, docbuf, an);
+
+	if (sections) {
+		if (outbuf && strbuf_len(sections)) {
+			secbuf = convert_text(ic, sections, NULL);
+			if (secbuf) {
+				strbuf_append_n(outbuf, strbuf_get(secbuf),
+						strbuf_len(secbuf));
+				strbuf_free(secbuf);
+			} else {
+				strbuf_free(outbuf);
+				outbuf = NULL;
+			}
+		}
+		strbuf_free(sections);
+	}
+	return outbuf;
+}
+
+/*
+ * Returns NULL like convert_doc().
+ */
+static STRBUF *convert_meta(iconv_t ic, STRBUF *docbuf)
+{
+	STRBUF *wbuf;
+	STRBUF *outbuf;
+
+	outbuf = format_meta(docbuf, opt_meta == META_JSON);
+
+	/* JSON is always written in UTF-8 */
+	if (opt_meta == META_TEXT) {
+		wbuf = outbuf;
+		subst_doc(wbuf);
+		outbuf = conv(ic, wbuf, NULL);
+		strbuf_free(wbuf);
+	}
+	return outbuf;
+}
+
+/*
+ * Starts the --timeout of a document on the calling thread.
+ */
+static void start_deadline(struct timespec *deadline)
+{
+	if (!opt_timeout)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec += opt_timeout;
+	regex_set_deadline(deadline);
+}
+
+/*
+ * Checks a converted document against --max-output and --timeout.
+ * If it is over either of them, the output is incomplete or too
+ * large and must not be used.  Returns the reason in that case,
+ * otherwise NULL.  The document is filename in dir, which may be
+ * NULL, for the message.
+ */
+static const char *output_exceeds(STRBUF *outbuf, const char *dir,
+				  const char *filename)
+{
+	const char *sep = dir ? "/" : "";
+	const char *why = NULL;
+
+	if (!dir)
+		dir = "";
+
+	if (opt_timeout && regex_deadline_passed())
+		why = "It takes longer than --timeout allows";
+	else if (opt_max_output && strbuf_len(outbuf) > opt_max_output)
+		why = "Its text is larger than --max-output allows";
+
+	if (why)
+		fprintf(stderr, "Can't convert %s%s%s: %s.\n", dir, sep,
+			filename, why);
+	return why;
+}
+
+/*
+ * With --compress, replaces outbuf by a buffer with it in the gzip
+ * format.  outbuf is freed then, and NULL is returned if zlib fails.
+ */
+static STRBUF *compress_output(STRBUF *outbuf)
+{
+	STRBUF *gz;
+
+	if (!opt_compress)
+		return outbuf;
+
+	gz = strbuf_gzip(outbuf, opt_compress);
+	strbuf_free(outbuf);
+	return gz;
+}
+
+/*
+ * Converts a document which is already in memory, e.g. one which has
+ * been received over the network, without a round trip through the
+ * filesystem.  Returns NULL if it can't be converted, after printing
+ * why.  Nothing needs to be cleaned up then, and ic can be used for
+ * the next document.  an is NULL or receives the anchors like in
+ * convert_doc(), and must be freed in either case.  cf is the --cache
+ * file or NULL, like in convert_doc().
+ */
+static STRBUF *convert_buffer(iconv_t ic, const char *data, size_t len,
+			      struct anchors *an, const struct cache_file *cf)
+{
+	STRBUF *docbuf;
+	STRBUF *styles = NULL;
+	STRBUF *outbuf;
+
+	if (an)
+		anchors_init(an);
+
+	docbuf = read_from_buffer(data, len,
+				  opt_meta ? "meta.xml" : "content.xml");
+	if (!docbuf)
+		return NULL;
+
+	if (opt_sections & SECTION_PAGES &&
+	    !(styles = read_from_buffer(data, len, "styles.xml"))) {
+		strbuf_free(docbuf);
+		return NULL;
+	}
+
+	if (opt_objects && len >= 2 && data[0] == 'P' && data[1] == 'K')
+		add_objects(docbuf, NULL, data, len, opt_jobs);
+
+	if (opt_meta)
+		outbuf = convert_meta(ic, docbuf);
+	else
+		outbuf = convert_doc(ic, docbuf, styles, an, cf);
+	strbuf_free(docbuf);
+	if (styles)
+		strbuf_free(styles);
+	return outbuf;
+}
+
+/*
+ * Finds the media type of a document in memory: the mimetype file
+ * which starts a package or the office:mimetype attribute of flat
+ * XML.  Returns its length, or 0 if it is not found.
+ */
+static size_t doc_type(const char *data, size_t len, const char **type)
+{
+	static const char attr[] = "office:mimetype=\"";
+	const unsigned char *hdr = (const unsigned char *)data;
+	const char *p, *end, *q;
+	size_t off, n;
+
+	if (len >= 30 && !memcmp(hdr, "PK\3\4", 4)) {
+		/* stored, and first in every OpenDocument package */
+		off = 30 + 8 + (size_t)(hdr[28] | hdr[29] << 8);
+		n = (size_t)(hdr[18] | hdr[19] << 8);
+		if ((hdr[26] | hdr[27] << 8) != 8 || memcmp(hdr + 30, "mimetype", 8) ||
+		    (hdr[8] | hdr[9] << 8) != 0 || hdr[20] || hdr[21] ||
+		    off + n > len)
+			return 0;
+		*type = data + off;
+		return n;
+	}
+
+	/* the attribute is on the root element */
+	end = data + (len < 4096 ? len : 4096);
+	for (p = data; p + sizeof(attr) - 1 <= end; p++) {
+		if (*p != 'o' || memcmp(p, attr, sizeof(attr) - 1))
+			continue;
+		p += sizeof(attr) - 1;
+		q = memchr(p, '"', (size_t)(end - p));
+		if (!q)
+			return 0;
+		*type = p;
+		return (size_t)(q - p);
+	}
+	return 0;
+}
+
+/* --json-lines, stdout or --output */
+static FILE *json_out;
+
+/*
+ * Converts the document in data and writes its --json-lines record:
+ * one JSON object on a line of its own with its path, status, type,
+ * sizes, the CRC-32 of content.xml (of the body of flat XML), the
+ * time taken and the text, and with --offsets its anchors.  Fields
+ * which are not known are null.  If error is set, the document is
+ * not converted and error is recorded as the reason; data may be
+ * NULL then.  Returns -1 if the document fails or the record can't
+ * be written.
+ */
+static int json_convert(iconv_t ic, const char *path, const char *data,
+			size_t len, const char *error)
+{
+	struct timespec start, end;
+	struct anchors an;
+	STRBUF *docbuf = NULL;
+	STRBUF *styles = NULL;
+	STRBUF *outbuf = NULL;
+	STRBUF *rec;
+	const char *type = NULL;
+	size_t type_len = 0;
+	unsigned int crc = 0;
+	char num[64];
+	int r = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	anchors_init(&an);
+
+	if (!error) {
+		errno = 0;
+		docbuf = read_from_buffer(data, len,
+					  opt_meta ? "meta.xml" : "content.xml");
+		if (docbuf && opt_sections & SECTION_PAGES &&
+		    !(styles = read_from_buffer(data, len, "styles.xml"))) {
+			strbuf_free(docbuf);
+			docbuf = NULL;
+		}
+		if (!docbuf)
+			error = errno == EFBIG ?
+				"It is larger than --max-size or --max-ratio allows" :
+				"It can't be read";
+	}
+	if (docbuf) {
+		crc = strbuf_crc32(docbuf);
+		if (opt_objects && len >= 2 && data[0] == 'P' && data[1] == 'K')
+			add_objects(docbuf, NULL, data, len, opt_jobs);
+		if (opt_meta) {
+			/* kept as a JSON object, without its newline */
+			outbuf = format_meta(docbuf, 1);
+			strbuf_truncate(outbuf, strbuf_len(outbuf) - 1);
+		} else
+			outbuf = convert_doc(ic, docbuf, styles,
+					     opt_offsets ? &an : NULL, NULL);
+		if (!outbuf)
+			error = "It can't be converted";
+		else
+			error = output_exceeds(outbuf, NULL, path);
+	}
+	if (data)
+		type_len = doc_type(data, len, &type);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	rec = strbuf_new();
+	if (outbuf && !error)
+		strbuf_reserve(rec, strbuf_len(outbuf) + strlen(path) + 256);
+
+	strbuf_append(rec, "{\"path\":");
+	append_json_string(rec, path, strlen(path));
+	if (error) {
+		strbuf_append(rec, ",\"status\":\"error\",\"error\":");
+		append_json_string(rec, error, strlen(error));
+	} else
+		strbuf_append(rec, ",\"status\":\"ok\",\"error\":null");
+
+	strbuf_append(rec, ",\"type\":");
+	if (type_len)
+		append_json_string(rec, type, type_len);
+	else
+		strbuf_append(rec, "null");
+
+	strbuf_append(rec, ",\"input_size\":");
+	if (data) {
+		snprintf(num, sizeof(num), "%lu", (unsigned long)len);
+		strbuf_append(rec, num);
+	} else
+		strbuf_append(rec, "null");
+
+	strbuf_append(rec, ",\"output_size\":");
+	if (outbuf && !error) {
+		snprintf(num, sizeof(num), "%lu",
+			 (unsigned long)strbuf_len(outbuf));
+		strbuf_append(rec, num);
+	} else
+		strbuf_append(rec, "null");
+
+	strbuf_append(rec, ",\"crc32\":");
+	if (docbuf) {
+		snprintf(num, sizeof(num), "\"%08x\"", crc);
+		strbuf_append(rec, num);
+	} else
+		strbuf_append(rec, "null");
+
+	snprintf(num, sizeof(num), ",\"time\":%.3f",
+		 (double)(end.tv_sec - start.tv_sec) +
+		 (double)(end.tv_nsec - start.tv_nsec) / 1e9);
+	strbuf_append(rec, num);
+
+	if (opt_offsets) {
+		strbuf_append(rec, ",\"anchors\":");
+		if (outbuf && !error)
+			append_anchors(rec, &an);
+		else
+			strbuf_append(rec, "null");
+	}
+
+	strbuf_append(rec, opt_meta ? ",\"meta\":" : ",\"text\":");
+	if (outbuf && !error && opt_meta)
+		strbuf_append_n(rec, strbuf_get(outbuf), strbuf_len(outbuf));
+	else if (outbuf && !error)
+		append_json_string(rec, strbuf_get(outbuf), strbuf_len(outbuf));
+	else
+		strbuf_append(rec, "null");
+	strbuf_append(rec, "}\n");
+
+	if (docbuf)
+		strbuf_free(docbuf);
+	if (styles)
+		strbuf_free(styles);
+	if (outbuf)
+		strbuf_free(outbuf);
+	anchors_free(&an);
+
+	/* a single fwrite() is not interleaved with those of other
+	   threads, and a reader sees each record when it is done.
+	   Compressed, each record is a gzip member of its own, which
+	   gunzip reads as one stream. */
+	rec = compress_output(rec);
+	if (!rec)
+		return -1;
+	PROBE1(write_begin, (long)strbuf_len(rec));
+	if (fwrite(strbuf_get(rec), 1, strbuf_len(rec), json_out) !=
+	    strbuf_len(rec) || fflush(json_out) == EOF) {
+		fprintf(stderr, "Can't write to %s: %s\n",
+			opt_output ? opt_output : "stdout", strerror(errno));
+		r = -1;
+	}
+	PROBE1(write_end, r ? -1L : (long)strbuf_len(rec));
+	strbuf_free(rec);
+
+	return error ? -1 : r;
+}
+
+/*
+ * Writes the --json-lines record of a single document, which is read
+ * from stdin if filename is -.
+ */
+static int json_file(iconv_t ic, const char *filename)
+{
+	STRBUF *data;
+	FILE *in;
+	int r;
+
+	in = strcmp(filename, "-") ? fopen(filename, "rb") : stdin;
+	if (!in) {
+		const char *why = strerror(errno);
+
+		fprintf(stderr, "Can't open %s: %s\n", filename, why);
+		return json_convert(ic, filename, NULL, 0, why);
+	}
+
+	data = strbuf_new();
+	strbuf_setopt(data, STRBUF_NULLOK);
+	strbuf_append_file(data, in);
+	if (in != stdin)
+		fclose(in);
+
+	r = json_convert(ic, filename, strbuf_get(data), strbuf_len(data),
+			 NULL);
+	strbuf_free(data);
+	return r;
+}
+
+/*
+ * Closes --json-lines output to a file.  Returns -1 if it fails.
+ */
+static int json_close(void)
+{
+	if (json_out == stdout)
+		return 0;
+	if (fclose(json_out) == EOF) {
+		fprintf(stderr, "Can't write to %s: %s\n", opt_output,
+			strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+#ifndef NO_OPENAT
+
+/*
+ * --recursive walks the input tree with one open directory per level
+ * and names every file relative to it, so no paths are built for the
+ * documents.  The documents are collected first and then converted
+ * by a SCHED, largest first and within the memory budget.
+ */
+struct walkdir {
+	struct walkdir *parent;
+	const char *name;	/* in the parent, NULL for the top */
+	int in_fd;
+	int out_fd;		/* -1 until needed */
+	struct batchdir *batch;	/* NULL until a document is found */
+};
+
+/*
+ * A directory with documents to convert, for the workers.
+ */
+struct batchdir {
+	char *path;		/* with the input directory, for messages */
+	const char *rel;	/* relative to the input directory */
+	struct batchdir *next;
+};
+
+struct batchdoc {
+	struct walk *walk;
+	struct batchdir *dir;
+	char *name;
+	char *out_name;
+};
+
+struct walk {
+	STRBUF *path;		/* of the current directory */
+	size_t top_len;		/* length of the input directory */
+	int top_in_fd;
+	int top_out_fd;
+	dev_t out_dev;		/* the output tree is not walked */
+	ino_t out_ino;
+	struct batchdir *dirs;
+	SCHED *sched;
+	int failed;		/* documents which were not converted */
+#ifndef NO_PTHREADS
+	pthread_mutex_t lock;	/* for failed */
+#endif
+};
+
+/*
+ * A conversion holds the document, content.xml and about three
+ * copies of the text at the same time.
+ */
+#define PEAK_FACTOR 4
+
+/*
+ * Checks for the mimetype file which starts every OpenDocument
+ * package, and OpenOffice.org 1.x packages as well.
+ */
+static int is_odf_package(const unsigned char *hdr, size_t len)
+{
+	static const char *const types[] = {
+		"application/vnd.oasis.opendocument.",
+		"application/vnd.sun.xml.",
+		NULL
+	};
+	size_t name_len, data;
+	int i;
+
+	if (len < 30 || memcmp(hdr, "PK\3\4", 4))
+		return 0;
+
+	name_len = hdr[26] | hdr[27] << 8;
+	data = 30 + name_len + (hdr[28] | hdr[29] << 8);
+	if (name_len != 8 || memcmp(hdr + 30, "mimetype", 8))
+		return 0;
+
+	for (i = 0; types[i]; i++) {
+		size_t n = strlen(types[i]);
+		if (data + n <= len && !memcmp(hdr + data, types[i], n))
+			return 1;
+	}
+	return 0;
+}
+
+static uint64_t get_le(const unsigned char *p, int n)
+{
+	uint64_t v = 0;
+
+	while (n--)
+		v = v << 8 | p[n];
+	return v;
+}
+
+/*
+ * Returns the uncompressed size in the ZIP64 extra field of a
+ * central directory entry whose size is 0xffffffff, or 0.
+ */
+static uint64_t zip64_size(const unsigned char *extra, size_t len)
+{
+	const unsigned char *p, *end = extra + len;
+
+	for (p = extra; p + 4 <= end; p += 4 + get_le(p + 2, 2)) {
+		/* the uncompressed size is the first field */
+		if (get_le(p, 2) == 0x0001 && p + 4 + 8 <= end)
+			return get_le(p + 4, 8);
+	}
+	return 0;
+}
+
+/*
+ * Returns the uncompressed size of content.xml from the central
+ * directory of the package in fd, or 0 if it can't be found.
+ */
+static size_t package_content_size(int fd, off_t file_size)
+{
+	unsigned char *buf, *p, *end;
+	unsigned char rec[56];
+	size_t len, i, size = 0;
+	uint64_t cd_size, cd_offset, v;
+	ssize_t r;
+
+	/* the end of central directory record, behind which is at
+	   most a comment of 64 KiB */
+	if (file_size < 22)
+		return 0;
+	len = file_size < 22 + 65535 ? (size_t)file_size : 22 + 65535;
+	buf = ymalloc(len);
+	r = pread(fd, buf, len, file_size - (off_t)len);
+	if (r != (ssize_t)len)
+		goto done;
+
+	for (i = len - 22; buf[i] != 'P' || memcmp(buf + i, "PK\5\6", 4); i--) {
+		if (!i)
+			goto done;
+	}
+	p = buf + i;
+
+	cd_size = get_le(p + 12, 4);
+	cd_offset = get_le(p + 16, 4);
+
+	/* in ZIP64 archives, a locator in front of it points to the
+	   ZIP64 end of central directory record with the real values */
+	if (p - buf >= 20 && !memcmp(p - 20, "PK\6\7", 4)) {
+		uint64_t rec_offset = get_le(p - 12, 8);
+
+		if (rec_offset > (uint64_t)file_size ||
+		    rec_offset + sizeof(rec) > (uint64_t)file_size ||
+		    pread(fd, rec, sizeof(rec), (off_t)rec_offset) !=
+		    (ssize_t)sizeof(rec) || memcmp(rec, "PK\6\6", 4))
+			goto done;
+		cd_size = get_le(rec + 40, 8);
+		cd_offset = get_le(rec + 48, 8);
+	}
+	if (cd_size > (1 << 24) || cd_offset > (uint64_t)file_size ||
+	    cd_offset + cd_size > (uint64_t)file_size)
+		goto done;
+
+	yfree(buf);
+	buf = ymalloc(cd_size + 1);
+	if (pread(fd, buf, cd_size, (off_t)cd_offset) != (ssize_t)cd_size)
+		goto done;
+
+	end = buf + cd_size;
+	for (p = buf; p + 46 <= end && !memcmp(p, "PK\1\2", 4); ) {
+		size_t name_len = get_le(p + 28, 2);
+
+		if (name_len == 11 && p + 46 + 11 <= end &&
+		    !memcmp(p + 46, "content.xml", 11)) {
+			size_t extra_len = get_le(p + 30, 2);
+
+			v = get_le(p + 24, 4);
+			if (v == 0xffffffff && p + 46 + 11 + extra_len <= end)
+				v = zip64_size(p + 46 + 11, extra_len);
+			size = v > (size_t)-1 ? (size_t)-1 : (size_t)v;
+			break;
+		}
+		p += 46 + name_len + get_le(p + 30, 2) + get_le(p + 32, 2);
+	}
+
+done:
+	yfree(buf);
+	return size;
+}
+
+/*
+ * Returns the output directory for wd in the walk.  If it doesn't
+ * exist, -1 is returned.
+ */
+static int walkdir_out_fd(struct walkdir *wd)
+{
+	int parent_fd;
+
+	if (wd->out_fd != -1)
+		return wd->out_fd;
+
+	parent_fd = walkdir_out_fd(wd->parent);
+	if (parent_fd == -1)
+		return -1;
+
+	wd->out_fd = openat(parent_fd, wd->name, O_RDONLY | O_DIRECTORY);
+	return wd->out_fd;
+}
+
+/*
+ * Opens the output directory for a batchdir in a worker and creates
+ * it if needed.  Workers may race to create the same directory.
+ */
+static int batchdir_out_fd(struct walk *w, struct batchdir *dir)
+{
+	char *rel, *p;
+	int fd;
+
+	fd = openat(w->top_out_fd, dir->rel, O_RDONLY | O_DIRECTORY);
+	if (fd != -1 || errno != ENOENT)
+		goto done;
+
+	rel = ymalloc(strlen(dir->rel) + 1);
+	strcpy(rel, dir->rel);
+	/* create the parents first */
+	for (p = strchr(rel, '/'); ; p = strchr(p + 1, '/')) {
+		if (p)
+			*p = '\0';
+		if (mkdirat(w->top_out_fd, rel, 0777) == -1 &&
+		    errno != EEXIST) {
+			fprintf(stderr, "Can't create %s in %s: %s\n", rel,
+				opt_outdir, strerror(errno));
+			yfree(rel);
+			return -1;
+		}
+		if (!p)
+			break;
+		*p = '/';
+	}
+	yfree(rel);
+
+	fd = openat(w->top_out_fd, dir->rel, O_RDONLY | O_DIRECTORY);
+done:
+	if (fd == -1)
+		fprintf(stderr, "Can't open %s in %s: %s\n", dir->rel,
+			opt_outdir, strerror(errno));
+	return fd;
+}
+
+/*
+ * The output for doc.odt is doc.txt, with ext ".txt".
+ */
+static char *output_name(const char *name, const char *ext)
+{
+	const char *dot = strrchr(name, '.');
+	size_t len = dot && dot != name ? (size_t)(dot - name) : strlen(name);
+	char *out = ymalloc(len + strlen(ext) + 1);
+
+	memcpy(out, name, len);
+	strcpy(out + len, ext);
+	return out;
+}
+
+/*
+ * Returns -1 if outbuf can't be written.  Nothing is left behind then.
+ */
+static int write_at(int dir_fd, const char *name, STRBUF *outbuf,
+		    const char *path)
+{
+	char *tmp = ymalloc(strlen(name) + 6);
+	size_t done = 0;
+	ssize_t len;
+	int fd;
+
+	/* written under a temporary name, so that an interrupted run
+	   leaves no output which looks up to date */
+	sprintf(tmp, ".%s.tmp", name);
+	fd = openat(dir_fd, tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		fprintf(stderr, "Can't open %s/%s: %s\n", path, tmp,
+			strerror(errno));
+		yfree(tmp);
+		return -1;
+	}
+
+	PROBE1(write_begin, (long)strbuf_len(outbuf));
+	while (done < strbuf_len(outbuf)) {
+		len = write(fd, strbuf_get(outbuf) + done,
+			    strbuf_len(outbuf) - done);
+		if (len == -1) {
+			fprintf(stderr, "Can't write to %s/%s: %s\n", path,
+				tmp, strerror(errno));
+			close(fd);
+			goto fail;
+		}
+		done += (size_t)len;
+	}
+
+	if (close(fd) == -1 || renameat(dir_fd, tmp, dir_fd, name) == -1) {
+		fprintf(stderr, "Can't write to %s/%s: %s\n", path, name,
+			strerror(errno));
+		goto fail;
+	}
+	yfree(tmp);
+	PROBE1(write_end, (long)done);
+	return 0;
+
+fail:
+	PROBE1(write_end, -1L);
+	(void)unlinkat(dir_fd, tmp, 0);
+	yfree(tmp);
+	return -1;
+}
+
+/*
+ * Counts a document which could not be converted.
+ */
+static void batch_failed(struct walk *w)
+{
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&w->lock);
+#endif
+	w->failed++;
+#ifndef NO_PTHREADS
+	pthread_mutex_unlock(&w->lock);
+#endif
+}
+
+/*
+ * Converts name in dir, which is in data, for --json-lines.  See
+ * json_convert() for error.
+ */
+static int json_at(iconv_t ic, const char *dir, const char *name,
+		   STRBUF *data, const char *error)
+{
+	STRBUF *path = strbuf_new();
+	int r;
+
+	strbuf_append(path, dir);
+	strbuf_append(path, "/");
+	strbuf_append(path, name);
+	r = json_convert(ic, strbuf_get(path), data ? strbuf_get(data) : NULL,
+			 data ? strbuf_len(data) : 0, error);
+	strbuf_free(path);
+	return r;
+}
+
+/*
+ * Converts one document, on a worker thread.  A document which fails
+ * is counted and the batch goes on.
+ */
+static void batch_convert(void *job)
+{
+	struct batchdoc *doc = job;
+	struct walk *w = doc->walk;
+	STRBUF *data, *outbuf;
+	struct timespec deadline;
+	struct anchors an;
+	struct cache_file cache;
+	char *cache_name = NULL;
+	struct stat st;
+	iconv_t ic;
+	FILE *in;
+	int dir_fd, fd, r;
+	int out_fd = -1;
+
+	anchors_init(&an);
+	PROBE2(doc_open, doc->dir->path, doc->name);
+	dir_fd = openat(w->top_in_fd, doc->dir->rel, O_RDONLY | O_DIRECTORY);
+	fd = dir_fd == -1 ? -1 : openat(dir_fd, doc->name, O_RDONLY | O_NOFOLLOW);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		const char *why = strerror(errno);
+
+		fprintf(stderr, "Can't open %s/%s: %s\n", doc->dir->path,
+			doc->name, why);
+		if (opt_json_lines)
+			(void)json_at((iconv_t)-1, doc->dir->path, doc->name,
+				      NULL, why);
+		if (fd != -1)
+			close(fd);
+		goto fail;
+	}
+
+	start_deadline(&deadline);
+
+	in = fdopen(fd, "rb");
+	data = strbuf_new();
+	strbuf_setopt(data, STRBUF_NULLOK);
+	strbuf_reserve(data, (size_t)st.st_size + 1024);
+	strbuf_append_file(data, in);
+	fclose(in);
+
+	/* iconv descriptors can't be shared between threads */
+	ic = open_conv();
+	if (ic == (iconv_t)-1) {
+		strbuf_free(data);
+		goto fail;
+	}
+	if (opt_json_lines) {
+		r = json_at(ic, doc->dir->path, doc->name, data, NULL);
+		finish_conv(ic);
+		strbuf_free(data);
+		if (r == 0)
+			goto done;
+		goto fail;
+	}
+	if (opt_cache) {
+		/* doc.cache next to doc.txt */
+		out_fd = batchdir_out_fd(w, doc->dir);
+		if (out_fd == -1) {
+			finish_conv(ic);
+			strbuf_free(data);
+			goto fail;
+		}
+		cache_name = output_name(doc->name, ".cache");
+		cache.dir_fd = out_fd;
+		cache.name = cache_name;
+		cache.path = doc->dir->path;
+	}
+	outbuf = convert_buffer(ic, strbuf_get(data), strbuf_len(data),
+				opt_offsets ? &an : NULL,
+				opt_cache ? &cache : NULL);
+	finish_conv(ic);
+	strbuf_free(data);
+
+	if (!outbuf) {
+		fprintf(stderr, "Can't convert %s/%s\n", doc->dir->path,
+			doc->name);
+		goto fail;
+	}
+	if (output_exceeds(outbuf, doc->dir->path, doc->name)) {
+		strbuf_free(outbuf);
+		goto fail;
+	}
+	outbuf = compress_output(outbuf);
+	if (!outbuf)
+		goto fail;
+	if (out_fd == -1 && (out_fd = batchdir_out_fd(w, doc->dir)) == -1) {
+		strbuf_free(outbuf);
+		goto fail;
+	}
+
+	r = write_at(out_fd, doc->out_name, outbuf, doc->dir->path);
+	strbuf_free(outbuf);
+	if (r == 0 && opt_offsets) {
+		/* doc.offsets next to doc.txt */
+		char *name = output_name(doc->name, ".offsets");
+
+		outbuf = strbuf_new();
+		append_anchors(outbuf, &an);
+		strbuf_append_n(outbuf, "\n", 1);
+		r = write_at(out_fd, name, outbuf, doc->dir->path);
+		strbuf_free(outbuf);
+		yfree(name);
+	}
+	if (r == 0)
+		goto done;
+
+fail:
+	batch_failed(w);
+	r = -1;
+done:
+	PROBE3(doc_close, doc->dir->path, doc->name, r ? -1L : 0L);
+	anchors_free(&an);
+	regex_set_deadline(NULL);
+	if (out_fd != -1)
+		close(out_fd);
+	if (cache_name)
+		yfree(cache_name);
+	if (dir_fd != -1)
+		close(dir_fd);
+	yfree(doc->name);
+	yfree(doc->out_name);
+	yfree(doc);
+}
+
+/*
+ * Returns whether a was modified after b, to the nanosecond where
+ * struct stat has it.
+ */
+static int newer_than(const struct stat *a, const struct stat *b)
+{
+	if (a->st_mtime != b->st_mtime)
+		return a->st_mtime > b->st_mtime;
+#ifdef __APPLE__
+	return a->st_mtimespec.tv_nsec > b->st_mtimespec.tv_nsec;
+#else
+	return a->st_mtim.tv_nsec > b->st_mtim.tv_nsec;
+#endif
+}
+
+/*
+ * Adds the file name in wd to the batch if it is a document whose
+ * output is not up to date.
+ */
+static void queue_at(struct walk *w, struct walkdir *wd, const char *name,
+		     const struct stat *st)
+{
+	unsigned char hdr[128];
+	struct stat out_st;
+	struct batchdoc *doc;
+	char *out_name;
+	size_t size;
+	ssize_t len;
+	int fd, out_fd;
+
+	fd = openat(wd->in_fd, name, O_RDONLY | O_NOFOLLOW);
+	if (fd == -1) {
+		fprintf(stderr, "Can't open %s/%s: %s\n", strbuf_get(w->path),
+			name, strerror(errno));
+		return;
+	}
+
+	len = pread(fd, hdr, sizeof(hdr), 0);
+	if (len <= 0 || !is_odf_package(hdr, (size_t)len)) {
+		close(fd);
+		return;
+	}
+
+	out_name = output_name(name, opt_compress ? ".txt.gz" : ".txt");
+	out_fd = opt_outdir ? walkdir_out_fd(wd) : -1;
+	if (out_fd != -1 && fstatat(out_fd, out_name, &out_st, 0) == 0 &&
+	    newer_than(&out_st, st)) {
+		/* up to date */
+		yfree(out_name);
+		close(fd);
+		return;
+	}
+
+	/* without a central directory, assume a ratio of 1 */
+	size = package_content_size(fd, st->st_size);
+	if (!size)
+		size = (size_t)st->st_size;
+	close(fd);
+
+	if (opt_max_size && size > opt_max_size) {
+		fprintf(stderr, "Skipping %s/%s: Its content is larger than "
+			"--max-size allows.\n", strbuf_get(w->path), name);
+		if (opt_json_lines)
+			(void)json_at((iconv_t)-1, strbuf_get(w->path), name,
+				      NULL, "Its content is larger than "
+				      "--max-size allows");
+		yfree(out_name);
+		batch_failed(w);
+		return;
+	}
+
+	if (!wd->batch) {
+		const char *path = strbuf_get(w->path);
+		struct batchdir *dir = ymalloc(sizeof(struct batchdir));
+
+		dir->path = ymalloc(strbuf_len(w->path) + 1);
+		strcpy(dir->path, path);
+		dir->rel = strbuf_len(w->path) > w->top_len ?
+			dir->path + w->top_len + 1 : ".";
+		dir->next = w->dirs;
+		w->dirs = dir;
+		wd->batch = dir;
+	}
+
+	doc = ymalloc(sizeof(struct batchdoc));
+	doc->walk = w;
+	doc->dir = wd->batch;
+	doc->name = ymalloc(strlen(name) + 1);
+	strcpy(doc->name, name);
+	doc->out_name = out_name;
+
+	sched_add(w->sched, doc,
+		  (size_t)st->st_size + PEAK_FACTOR * size);
+}
+
+static void walk_dir(struct walk *w, struct walkdir *wd)
+{
+	struct dirent *de;
+	struct stat st;
+	size_t path_len;
+	DIR *dir;
+
+	dir = fdopendir(wd->in_fd);
+	if (!dir) {
+		fprintf(stderr, "Can't read %s: %s\n", strbuf_get(w->path),
+			strerror(errno));
+		close(wd->in_fd);
+		return;
+	}
+
+	path_len = strbuf_len(w->path);
+	while ((de = readdir(dir))) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		if (fstatat(wd->in_fd, de->d_name, &st,
+			    AT_SYMLINK_NOFOLLOW) == -1) {
+			fprintf(stderr, "Can't stat %s/%s: %s\n",
+				strbuf_get(w->path), de->d_name,
+				strerror(errno));
+			continue;
+		}
+
+		if (S_ISREG(st.st_mode)) {
+			queue_at(w, wd, de->d_name, &st);
+		} else if (S_ISDIR(st.st_mode)) {
+			struct walkdir sub;
+
+			if (w->top_out_fd != -1 && st.st_dev == w->out_dev &&
+			    st.st_ino == w->out_ino)
+				continue;
+
+			sub.parent = wd;
+			sub.name = de->d_name;
+			sub.out_fd = -1;
+			sub.batch = NULL;
+			sub.in_fd = openat(wd->in_fd, de->d_name,
+					   O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+
+			strbuf_append(w->path, "/");
+			strbuf_append(w->path, de->d_name);
+			if (sub.in_fd == -1)
+				fprintf(stderr, "Can't open %s: %s\n",
+					strbuf_get(w->path), strerror(errno));
+			else
+				walk_dir(w, &sub);
+			strbuf_truncate(w->path, path_len);
+
+			if (sub.out_fd != -1)
+				close(sub.out_fd);
+		}
+	}
+
+	closedir(dir);
+}
+
+/*
+ * The budget of --memory, by default half of the physical memory.
+ */
+static size_t memory_budget(void)
+{
+	if (opt_memory >= 0)
+		return (size_t)opt_memory << 20;
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+	{
+		long pages = sysconf(_SC_PHYS_PAGES);
+		long page_sz = sysconf(_SC_PAGESIZE);
+
+		if (pages > 0 && page_sz > 0)
+			return (size_t)pages / 2 * (size_t)page_sz;
+	}
+#endif
+	return 0;
+}
+
+/*
+ * Returns the number of documents which could not be converted.
+ * Without outdir, the documents are written as --json-lines records.
+ */
+static int convert_tree(const char *indir, const char *outdir)
+{
+	struct walkdir top;
+	struct walk w;
+	struct stat st;
+	int jobs = opt_jobs;
+
+	w.top_in_fd = open(indir, O_RDONLY | O_DIRECTORY);
+	if (w.top_in_fd == -1) {
+		fprintf(stderr, "%s: %s\n", indir, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	w.top_out_fd = -1;
+	w.out_dev = 0;
+	w.out_ino = 0;
+	if (outdir) {
+		if (mkdir(outdir, 0777) == -1 && errno != EEXIST) {
+			fprintf(stderr, "Can't create %s: %s\n", outdir,
+				strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		w.top_out_fd = open(outdir, O_RDONLY | O_DIRECTORY);
+		if (w.top_out_fd == -1 || fstat(w.top_out_fd, &st) == -1) {
+			fprintf(stderr, "%s: %s\n", outdir, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		w.out_dev = st.st_dev;
+		w.out_ino = st.st_ino;
+	}
+
+	w.path = strbuf_new();
+	strbuf_append(w.path, indir);
+	w.top_len = strbuf_len(w.path);
+	w.dirs = NULL;
+	w.sched = sched_new(jobs, memory_budget());
+	w.failed = 0;
+#ifndef NO_PTHREADS
+	pthread_mutex_init(&w.lock, NULL);
+#endif
+
+	/* walk_dir() closes the directory it reads */
+	top.parent = NULL;
+	top.name = NULL;
+	top.in_fd = dup(w.top_in_fd);
+	top.out_fd = w.top_out_fd;
+	top.batch = NULL;
+	walk_dir(&w, &top);
+
+	/* the documents are converted in parallel, not their parts */
+	opt_jobs = 1;
+	sched_run(w.sched, batch_convert);
+	opt_jobs = jobs;
+
+	while (w.dirs) {
+		struct batchdir *next = w.dirs->next;
+		yfree(w.dirs->path);
+		yfree(w.dirs);
+		w.dirs = next;
+	}
+	close(w.top_in_fd);
+	if (w.top_out_fd != -1)
+		close(w.top_out_fd);
+	strbuf_free(w.path);
+#ifndef NO_PTHREADS
+	pthread_mutex_destroy(&w.lock);
+#endif
+	return w.failed;
+}
+
+#endif /* NO_OPENAT */
+
+/*
+ * Returns the value of an option which takes a number of 0 or more.
+ */
+static long number_arg(const char *arg, const char *name)
+{
+	char *end;
+	long n = strtol(arg, &end, 10);
+
+	if (*end || end == arg || n < 0) {
+		fprintf(stderr, "Invalid value for %s: %s\n", name, arg);
+		exit(EXIT_FAILURE);
+	}
+	return n;
+}
+
+void odt2txt_options_init(struct odt2txt_options *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	opts->encoding = "UTF-8";
+	opts->width = 63;
+	opts->subst = ODT2TXT_SUBST_SOME;
+	opts->skip = "text:tracked-changes,office:annotation,office:binary-data";
+	opts->jobs = 1;
+}
+
+#ifndef NO_PTHREADS
+/* for the opt_* variables and the rest of the static state */
+static pthread_mutex_t lib_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * Sets the opt_* variables from opts, the way main() does from the
+ * command line, and those which opts doesn't have to their defaults,
+ * so that nothing is left from an earlier call.  Returns -1 if opts
+ * are invalid.
+ */
+static int set_options(const struct odt2txt_options *opts)
+{
+	if ((opts->width < 3 && opts->width != -1) ||
+	    opts->subst < SUBST_NONE || opts->subst > SUBST_ALL ||
+	    opts->meta < META_NONE || opts->meta > META_JSON ||
+	    opts->objects < OBJECTS_NONE || opts->objects > OBJECTS_SECTION ||
+	    opts->jobs < 1 || !opts->skip)
+		return -1;
+
+	/* the same combinations as on the command line */
+	if (opts->meta && (opts->sections || opts->objects || opts->tokens))
+		return -1;
+	if (opts->tokens & ODT2TXT_TOKENS_COUNT && opts->sections)
+		return -1;
+
+	opt_width = opts->width;
+	opt_subst = opts->subst;
+	opt_meta = opts->meta;
+	opt_sections = opts->sections;
+	opt_objects = opts->objects;
+	opt_tokens = 0;
+	if (opts->tokens) {
+		opt_tokens = TOKENS_ON;
+		if (opts->tokens & ODT2TXT_TOKENS_LOWER)
+			opt_tokens |= TOKENS_LOWER;
+		if (opts->tokens & ODT2TXT_TOKENS_LENGTH)
+			opt_tokens |= TOKENS_LENGTH;
+		if (opts->tokens & ODT2TXT_TOKENS_COUNT)
+			opt_tokens |= TOKENS_COUNT;
+	}
+	opt_skip = opts->skip;
+	opt_jobs = opts->jobs;
+	opt_max_size = opts->max_size;
+	opt_max_ratio = opts->max_ratio;
+	opt_max_output = opts->max_output;
+	opt_timeout = opts->timeout;
+
+	/* only on the command line */
+	opt_raw = 0;
+	opt_raw_input = 0;
+	opt_filename = NULL;
+	opt_compress = 0;
+	opt_recursive = 0;
+	opt_outdir = NULL;
+	opt_json_lines = 0;
+	opt_offsets = 0;
+	opt_offsets_file = NULL;
+	opt_cache = 0;
+	opt_cache_file = NULL;
+	opt_memory = -1;
+	return 0;
+}
+
+int odt2txt_convert(const char *data, size_t len,
+		    const struct odt2txt_options *opts,
+		    char **text, size_t *text_len)
+{
+	iconv_t ic;
+	STRBUF *outbuf = NULL;
+	int r = -1;
+
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&lib_lock);
+#endif
+	if (set_options(opts) == -1 || init_skip() == -1) {
+		fprintf(stderr, "Invalid options for odt2txt_convert()\n");
+		errno = EINVAL;
+		goto out;
+	}
+
+	ic = init_conv("UTF-8", opts->encoding ? opts->encoding : "UTF-8");
+	if (ic == (iconv_t)-1)
+		goto out;
+	if (init_subst(ic) == -1) {
+		finish_conv(ic);
+		goto out;
+	}
+#ifdef USE_KUNZIP
+	kunzip_set_limits(opt_max_size, opt_max_ratio);
+#endif
+
+	start_deadline(&doc_deadline);
+	outbuf = convert_buffer(ic, data, len, NULL, NULL);
+	if (outbuf && !output_exceeds(outbuf, NULL, "buffer")) {
+		*text_len = strbuf_len(outbuf);
+		*text = strbuf_spit(outbuf);
+		r = 0;
+	} else if (outbuf)
+		strbuf_free(outbuf);
+	regex_set_deadline(NULL);
+	finish_conv(ic);
+
+out:
+#ifndef NO_PTHREADS
+	pthread_mutex_unlock(&lib_lock);
+#endif
+	return r;
+}
+
+void odt2txt_free(char *text)
+{
+	yfree(text);
+}
+
+#ifndef ODT2TXT_LIB
+int main(int argc, const char **argv)
+{
+	struct stat st;
+	struct anchors an;
+	struct cache_file cache, *cf = NULL;
+	char *cache_dir = NULL;
+	iconv_t ic;
+	STRBUF *docbuf;
+	STRBUF *styles;
+	STRBUF *outbuf;
+	int i = 1;
+
+	(void)setlocale(LC_ALL, "");
+
+	while (argv[i]) {
+		if (!strcmp(argv[i], "--raw")) {
+			opt_raw = 1;
+			i++; continue;
+		} else if (!strcmp(argv[i], "--raw-input")) {
+			opt_raw_input = 1;
+			i++; continue;
+		} else if (!strcmp(argv[i], "--meta")) {
+			opt_meta = META_TEXT;
+			i++; continue;
+		} else if (!strncmp(argv[i], "--meta=", 7)) {
+			if (!strcmp(argv[i] + 7, "text"))
+				opt_meta = META_TEXT;
+			else if (!strcmp(argv[i] + 7, "json"))
+				opt_meta = META_JSON;
+			else {
+				fprintf(stderr, "Invalid value for --meta: %s\n",
+					argv[i] + 7);
+				exit(EXIT_FAILURE);
+			}
+			i++; continue;
+		} else if (!strcmp(argv[i], "--tokens")) {
+			opt_tokens |= TOKENS_ON;
+			i++; continue;
+		} else if (!strncmp(argv[i], "--tokens=", 9)) {
+			const char *p = argv[i] + 9;
+
+			opt_tokens |= TOKENS_ON;
+			while (*p) {
+				size_t n = strcspn(p, ",");
+				if (n == 5 && !strncmp(p, "lower", 5))
+					opt_tokens |= TOKENS_LOWER;
+				else if (n == 6 && !strncmp(p, "length", 6))
+					opt_tokens |= TOKENS_LENGTH;
+				else {
+					fprintf(stderr, "Invalid value for --tokens: %s\n",
+						argv[i] + 9);
+					exit(EXIT_FAILURE);
+				}
+				p += n;
+				if (*p)
+					p++;
+			}
+			i++; continue;
+		} else if (!strcmp(argv[i], "--count")) {
+			opt_tokens |= TOKENS_ON | TOKENS_COUNT;
+			i++; continue;
+		} else if (!strncmp(argv[i], "--encoding=", 11)) {
+			size_t arglen = strlen(argv[i]) - 10;
+#ifdef iconvlist
+			if (!strcmp(argv[i] + 11, "list")) {
+				show_iconvlist();
+			}
+#endif
+			opt_encoding = ymalloc(arglen);
+			memcpy(opt_encoding, argv[i] + 11, arglen);
+			i++; continue;
+		} else if (!strncmp(argv[i], "--width=", 8)) {
+			opt_width = atoi(argv[i] + 8);
+			if(opt_width < 3 && opt_width != -1) {
+				fprintf(stderr, "Invalid value for width: %s\n",
+					argv[i] + 8);
+				exit(EXIT_FAILURE);
+			}
+			i++; continue;
+		} else if (!strncmp(argv[i], "--jobs=", 7)) {
+			char *end;
+			long jobs = strtol(argv[i] + 7, &end, 10);
+			if (*end || end == argv[i] + 7 || jobs < 0 || jobs > 1024) {
+				fprintf(stderr, "Invalid value for jobs: %s\n",
+					argv[i] + 7);
+				exit(EXIT_FAILURE);
+			}
+			opt_jobs = jobs ? (int)jobs : pool_ncpus();
+			i++; continue;
+		} else if (!strncmp(argv[i], "--memory=", 9)) {
+			opt_memory = number_arg(argv[i] + 9, "memory");
+			i++; continue;
+		} else if (!strncmp(argv[i], "--max-size=", 11)) {
+			opt_max_size = (size_t)number_arg(argv[i] + 11,
+							  "max-size") << 20;
+			i++; continue;
+		} else if (!strncmp(argv[i], "--max-ratio=", 12)) {
+			opt_max_ratio = (unsigned long)number_arg(argv[i] + 12,
+								  "max-ratio");
+			i++; continue;
+		} else if (!strncmp(argv[i], "--max-output=", 13)) {
+			opt_max_output = (size_t)number_arg(argv[i] + 13,
+							    "max-output") << 20;
+			i++; continue;
+		} else if (!strncmp(argv[i], "--timeout=", 10)) {
+			opt_timeout = number_arg(argv[i] + 10, "timeout");
+			i++; continue;
+		} else if (!strcmp(argv[i], "--force")) {
+			// ignore this setting
+			i++; continue;
+		} else if (!strncmp(argv[i], "--output=", 9)) {
+			if (*(argv[i] + 9) != '-') {
 				size_t arglen = strlen(argv[i]) - 8;
 				opt_output = ymalloc(arglen);
 				memcpy(opt_output, argv[i] + 9, arglen);
 			}
 			i++; continue;
+		} else if (!strcmp(argv[i], "--compress")) {
+			opt_compress = Z_DEFAULT_COMPRESSION;
+			i++; continue;
+		} else if (!strncmp(argv[i], "--compress=", 11)) {
+			opt_compress = (int)number_arg(argv[i] + 11,
+						       "compress");
+			if (opt_compress < 1 || opt_compress > 9) {
+				fprintf(stderr,
+					"Invalid value for compress: %s\n",
+					argv[i] + 11);
+				exit(EXIT_FAILURE);
+			}
+			i++; continue;
+		} else if (!strcmp(argv[i], "--cache")) {
+			opt_cache = 1;
+			i++; continue;
+		} else if (!strncmp(argv[i], "--cache=", 8)) {
+			opt_cache = 1;
+			opt_cache_file = argv[i] + 8;
+			i++; continue;
+		} else if (!strcmp(argv[i], "--offsets")) {
+			opt_offsets = 1;
+			i++; continue;
+		} else if (!strncmp(argv[i], "--offsets=", 10)) {
+			opt_offsets = 1;
+			opt_offsets_file = argv[i] + 10;
+			i++; continue;
+		} else if (!strcmp(argv[i], "--headers")) {
+			opt_sections |= SECTION_HEADERS;
+			i++; continue;
+		} else if (!strcmp(argv[i], "--footers")) {
+			opt_sections |= SECTION_FOOTERS;
+			i++; continue;
+		} else if (!strcmp(argv[i], "--notes")) {
+			opt_sections |= SECTION_NOTES;
+			i++; continue;
+		} else if (!strcmp(argv[i], "--objects")) {
+			opt_objects = OBJECTS_INLINE;
+			i++; continue;
+		} else if (!strncmp(argv[i], "--objects=", 10)) {
+			if (!strcmp(argv[i] + 10, "inline"))
+				opt_objects = OBJECTS_INLINE;
+			else if (!strcmp(argv[i] + 10, "section"))
+				opt_objects = OBJECTS_SECTION;
+			else {
+				fprintf(stderr, "Invalid value for --objects: %s\n",
+					argv[i] + 10);
+				exit(EXIT_FAILURE);
+			}
+			i++; continue;
+		} else if (!strncmp(argv[i], "--skip=", 7)) {
+			opt_skip = argv[i] + 7;
+			i++; continue;
+		} else if (!strcmp(argv[i], "--json-lines")) {
+			opt_json_lines = 1;
+			i++; continue;
+		} else if (!strcmp(argv[i], "--recursive")) {
+			opt_recursive = 1;
+			i++; continue;
+		} else if (!strncmp(argv[i], "--outdir=", 9)) {
+			opt_outdir = argv[i] + 9;
+			i++; continue;
+		} else if (!strcmp(argv[i], "--outdir")) {
+			if (!argv[i + 1])
+				usage();
+			opt_outdir = argv[i + 1];
+			i += 2; continue;
 		} else if (!strncmp(argv[i], "--subst=", 8)) {
 			if (!strcmp(argv[i] + 8, "none"))
 				opt_subst = SUBST_NONE;
@@ -558,8 +5113,6 @@ int main(int argc, const char **argv)
 		} else if (!strcmp(argv[i], "--version")
 			   || !strcmp(argv[i], "-v")) {
 			version_info();
-		} else if (!strcmp(argv[i], "-")) {
-			usage();
 		} else {
 			if(opt_filename)
 				usage();
@@ -579,55 +5132,261 @@ int main(int argc, const char **argv)
 	if(opt_raw)
 		opt_width = -1;
 
+	if (opt_output && !opt_compress) {
+		size_t len = strlen(opt_output);
+		if (len > 3 && !strcmp(opt_output + len - 3, ".gz"))
+			opt_compress = Z_DEFAULT_COMPRESSION;
+	}
+
 	if(!opt_filename)
 		usage();
 
+	/* a single document has its --offsets in a file of their own,
+	   the others next to their text */
+	if (opt_offsets && (opt_raw || opt_meta ||
+			    !opt_offsets_file == !(opt_recursive || opt_json_lines)))
+		usage();
+
+	if (opt_sections && (opt_raw || opt_meta))
+		usage();
+
+	/* the offsets point into content.xml as it was read */
+	if (opt_objects && (opt_raw || opt_meta || opt_offsets))
+		usage();
+
+	if (init_skip()) {
+		fprintf(stderr, "Too many elements for --skip\n");
+		exit(EXIT_FAILURE);
+	}
+
+#ifdef NO_OPENAT
+	if (opt_recursive || opt_outdir || opt_cache) {
+		fprintf(stderr, "--recursive, --outdir and --cache are not "
+			"supported on this platform\n");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	/* like --offsets, but there is no place for the cache of
+	   --json-lines records */
+	if (opt_cache && (opt_raw || opt_meta || opt_offsets || opt_json_lines ||
+			  opt_tokens & TOKENS_COUNT ||
+			  !opt_cache_file == !opt_recursive))
+		usage();
+
+	/* the counts of the sections would be a second line */
+	if (opt_tokens && (opt_raw || opt_meta || opt_offsets ||
+			   (opt_tokens & TOKENS_COUNT && opt_sections)))
+		usage();
+
+#ifndef NO_ICONV
+	if (opt_json_lines) {
+		/* JSON is always written in UTF-8 */
+		if (opt_encoding)
+			yfree(opt_encoding);
+		opt_encoding = ymalloc(6);
+		strcpy(opt_encoding, "UTF-8");
+	}
+#endif
+
 	if(!opt_encoding) {
 		opt_encoding = guess_encoding();
 	}
 
 	ic = init_conv("UTF-8", opt_encoding);
+	if (ic == (iconv_t)-1 || init_subst(ic) == -1)
+		exit(EXIT_FAILURE);
+#ifdef USE_KUNZIP
+	kunzip_set_limits(opt_max_size, opt_max_ratio);
+#endif
+
+	if (opt_json_lines) {
+		json_out = opt_output ? fopen(opt_output, "w") : stdout;
+		if (!json_out) {
+			fprintf(stderr, "Can't open %s: %s\n", opt_output,
+				strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+#ifndef NO_OPENAT
+	if (opt_recursive || opt_outdir) {
+		/* the documents go either to --outdir or into the
+		   --json-lines records */
+		if (!opt_recursive || !opt_outdir == !opt_json_lines ||
+		    (opt_output && !opt_json_lines) ||
+		    !strcmp(opt_filename, "-"))
+			usage();
+
+		i = convert_tree(opt_filename, opt_outdir);
+		if (opt_json_lines && json_close() == -1)
+			i = 1;
+
+		finish_conv(ic);
+#ifndef NO_ICONV
+		yfree(opt_encoding);
+#endif
+		return i ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+#endif
 
-	if (0 != stat(opt_filename, &st)) {
+	if (!strcmp(opt_filename, "-")) {
+		/* a package starts with a local header, anything else
+		   is taken for flat XML */
+		int c = getc(stdin);
+		if (c != 'P')
+			opt_raw_input = 1;
+		if (c != EOF)
+			ungetc(c, stdin);
+	} else if (!opt_json_lines && 0 != stat(opt_filename, &st)) {
 		fprintf(stderr, "%s: %s\n",
 			opt_filename, strerror(errno));
 		exit(EXIT_FAILURE);
 	}
 
-	/* read content.xml */
-	docbuf = opt_raw_input ?
-		read_from_xml(opt_filename, "content.xml") :
-		read_from_zip(opt_filename, "content.xml");
+	start_deadline(&doc_deadline);
+	PROBE2(doc_open, "", opt_filename);
 
-	if (!opt_raw) {
-		subst_doc(ic, docbuf);
-		format_doc(docbuf, opt_raw_input);
+	if (opt_json_lines) {
+		/* the record needs the size of the whole document */
+		i = json_file(ic, opt_filename);
+		if (json_close() == -1)
+			i = -1;
+		PROBE3(doc_close, "", opt_filename, i ? -1L : 0L);
+
+		finish_conv(ic);
+#ifndef NO_ICONV
+		yfree(opt_encoding);
+#endif
+		if (opt_output)
+			yfree(opt_output);
+		return i ? EXIT_FAILURE : EXIT_SUCCESS;
 	}
 
-	wbuf = wrap(docbuf, opt_width);
+#ifndef NO_OPENAT
+	if (opt_cache_file) {
+		/* it is replaced by renaming, in its directory */
+		const char *slash = strrchr(opt_cache_file, '/');
+
+		cache.dir_fd = AT_FDCWD;
+		cache.name = slash ? slash + 1 : opt_cache_file;
+		cache.path = ".";
+		if (slash) {
+			size_t len = slash == opt_cache_file ? 1 :
+				(size_t)(slash - opt_cache_file);
+
+			cache_dir = ymalloc(len + 1);
+			memcpy(cache_dir, opt_cache_file, len);
+			cache_dir[len] = '\0';
+			cache.dir_fd = open(cache_dir, O_RDONLY | O_DIRECTORY);
+			if (cache.dir_fd == -1) {
+				fprintf(stderr, "Can't open %s: %s\n",
+					cache_dir, strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			cache.path = cache_dir;
+		}
+		cf = &cache;
+	}
+#endif
 
-	/* remove all trailing whitespace */
-	(void) regex_subst(wbuf, " +\n", _REG_GLOBAL, "\n");
+	if (opt_meta) {
+		/* read meta.xml only, the content is not needed */
+		docbuf = opt_raw_input ?
+			read_from_xml(opt_filename, "meta.xml") :
+			read_from_zip(opt_filename, "meta.xml");
 
-	outbuf = conv(ic, wbuf);
+		outbuf = NULL;
+		if (docbuf) {
+			outbuf = convert_meta(ic, docbuf);
+			strbuf_free(docbuf);
+		}
+#ifndef NO_PTHREADS
+	} else if (opt_jobs > 1 && !opt_raw && !opt_raw_input &&
+		   !opt_offsets && !opt_sections && !opt_cache &&
+		   !opt_objects) {
+		/* inflate and format at the same time */
+		outbuf = convert_pipelined(opt_filename, "content.xml",
+					   opt_jobs);
+#endif
+	} else if ((opt_sections & SECTION_PAGES || opt_objects) &&
+		   !opt_raw_input && !strcmp(opt_filename, "-")) {
+		/* styles.xml or the objects and content.xml can't all
+		   be read from a stream */
+		docbuf = strbuf_new();
+		strbuf_setopt(docbuf, STRBUF_NULLOK);
+		strbuf_append_file(docbuf, stdin);
+		outbuf = convert_buffer(ic, strbuf_get(docbuf),
+					strbuf_len(docbuf),
+					opt_offsets ? &an : NULL, cf);
+		strbuf_free(docbuf);
+	} else {
+		/* read content.xml, and styles.xml only for the
+		   sections which are in it */
+		docbuf = opt_raw_input ?
+			read_from_xml(opt_filename, "content.xml") :
+			read_from_zip(opt_filename, "content.xml");
+		styles = NULL;
+		if (docbuf && opt_sections & SECTION_PAGES) {
+			styles = opt_raw_input ?
+				read_from_xml(opt_filename, "styles.xml") :
+				read_from_zip(opt_filename, "styles.xml");
+			if (!styles) {
+				strbuf_free(docbuf);
+				docbuf = NULL;
+			}
+		}
+
+		if (docbuf && opt_objects && !opt_raw_input)
+			add_objects(docbuf, opt_filename, NULL, 0, opt_jobs);
+
+		outbuf = NULL;
+		if (docbuf) {
+			outbuf = convert_doc(ic, docbuf, styles,
+					     opt_offsets ? &an : NULL, cf);
+			strbuf_free(docbuf);
+		}
+		if (styles)
+			strbuf_free(styles);
+	}
 
+	if (!outbuf || output_exceeds(outbuf, NULL, opt_filename) ||
+	    !(outbuf = compress_output(outbuf))) {
+		PROBE3(doc_close, "", opt_filename, -1L);
+		exit(EXIT_FAILURE);
+	}
+
+	PROBE1(write_begin, (long)strbuf_len(outbuf));
 	if (opt_output)
 		write_to_file(outbuf, opt_output);
 	else
 		fwrite(strbuf_get(outbuf), strbuf_len(outbuf), 1, stdout);
+	PROBE1(write_end, (long)strbuf_len(outbuf));
+
+	if (opt_offsets) {
+		strbuf_truncate(outbuf, 0);
+		append_anchors(outbuf, &an);
+		strbuf_append_n(outbuf, "\n", 1);
+		write_to_file(outbuf, opt_offsets_file);
+		anchors_free(&an);
+	}
+	PROBE3(doc_close, "", opt_filename, 0L);
 
 	finish_conv(ic);
-	strbuf_free(wbuf);
-	strbuf_free(docbuf);
 	strbuf_free(outbuf);
 #ifndef NO_ICONV
 	yfree(opt_encoding);
 #endif
 	if (opt_output)
 		yfree(opt_output);
+	if (cache_dir) {
+		close(cache.dir_fd);
+		yfree(cache_dir);
+	}
 
 	return EXIT_SUCCESS;
 }
+#endif /* ODT2TXT_LIB */
 
 static void write_to_file(STRBUF *outbuf, const char *filename)
 {
@@ -0,0 +1,101 @@
+/*
+ * odt2txt.h: Convert OpenDocument documents in memory to text
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+/*
+ * libodt2txt.a has the converter of the odt2txt program, for
+ * programs which get the documents as buffers, e.g. over the
+ * network.  The options are those of the command line, passed
+ * explicitly:
+ *
+ *   struct odt2txt_options opts;
+ *   char *text;
+ *   size_t len;
+ *
+ *   odt2txt_options_init(&opts);
+ *   opts.width = -1;
+ *   if (odt2txt_convert(data, size, &opts, &text, &len) == 0) {
+ *           fwrite(text, len, 1, stdout);
+ *           odt2txt_free(text);
+ *   }
+ *
+ * The converter keeps its state in static variables, so calls from
+ * several threads are made one after the other.  A document may
+ * still be converted on several threads, see jobs below.
+ */
+
+#ifndef ODT2TXT_H
+#define ODT2TXT_H
+
+#include <stddef.h>
+
+/* subst, --subst */
+#define ODT2TXT_SUBST_NONE 0
+#define ODT2TXT_SUBST_SOME 1	/* those missing in the encoding */
+#define ODT2TXT_SUBST_ALL  2
+
+/* meta, --meta */
+#define ODT2TXT_META_NONE 0	/* the text */
+#define ODT2TXT_META_TEXT 1
+#define ODT2TXT_META_JSON 2	/* always in UTF-8 */
+
+/* sections, --headers, --footers and --notes */
+#define ODT2TXT_HEADERS 1
+#define ODT2TXT_FOOTERS 2
+#define ODT2TXT_NOTES   4
+
+/* objects, --objects */
+#define ODT2TXT_OBJECTS_NONE    0
+#define ODT2TXT_OBJECTS_INLINE  1
+#define ODT2TXT_OBJECTS_SECTION 2
+
+/* tokens, --tokens and --count */
+#define ODT2TXT_TOKENS        1	/* one token per line */
+#define ODT2TXT_TOKENS_LOWER  2
+#define ODT2TXT_TOKENS_LENGTH 4
+#define ODT2TXT_TOKENS_COUNT  8	/* only the counts */
+
+struct odt2txt_options {
+	const char *encoding;	/* of the text, NULL for UTF-8 */
+	int width;		/* of the lines, -1 for no wrapping */
+	int subst;		/* ODT2TXT_SUBST_* */
+	int meta;		/* ODT2TXT_META_* */
+	int sections;		/* ODT2TXT_HEADERS, ... behind the text */
+	int objects;		/* ODT2TXT_OBJECTS_* */
+	int tokens;		/* ODT2TXT_TOKENS* flags, 0 for the text */
+	const char *skip;	/* comma-separated elements, --skip */
+	int jobs;		/* threads for one document */
+
+	/* limits for untrusted documents, 0 for no limit */
+	size_t max_size;	/* bytes of content.xml */
+	unsigned long max_ratio;/* of content.xml to its compressed size */
+	size_t max_output;	/* bytes of text */
+	long timeout;		/* seconds */
+};
+
+/*
+ * Sets opts to the defaults of the odt2txt program, with UTF-8
+ * output.
+ */
+void odt2txt_options_init(struct odt2txt_options *opts);
+
+/*
+ * Converts the document of len bytes in data, a package or flat
+ * XML.  On success, returns 0 and sets text to the text, which is
+ * terminated by a null byte not counted in text_len, and must be
+ * freed with odt2txt_free().  Returns -1 if the document can't be
+ * converted, after printing why to stderr, and sets errno to EINVAL
+ * if opts are invalid.  The options of the odt2txt program which
+ * opts doesn't have, e.g. --raw, are off in every call.
+ */
+int odt2txt_convert(const char *data, size_t len,
+		    const struct odt2txt_options *opts,
+		    char **text, size_t *text_len);
+
+void odt2txt_free(char *text);
+
+#endif /* ODT2TXT_H */
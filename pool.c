@@ -0,0 +1,251 @@
+/*
+ * pool.c: Run independent jobs on several threads
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifndef NO_PTHREADS
+#  include <pthread.h>
+#endif
+
+#include "mem.h"
+#include "pool.h"
+
+#ifndef NO_PTHREADS
+
+struct pool_range {
+	pthread_mutex_t lock;
+	size_t next;
+	size_t n;
+	void (*fn)(void *arg, size_t i);
+	void *arg;
+};
+
+static void *pool_worker(void *p)
+{
+	struct pool_range *pool = p;
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next;
+		if (i < pool->n)
+			pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (i >= pool->n)
+			break;
+		pool->fn(pool->arg, i);
+	}
+
+	return NULL;
+}
+
+void pool_run(int jobs, size_t n, void (*fn)(void *arg, size_t i), void *arg)
+{
+	struct pool_range pool;
+	pthread_t *threads;
+	int nthreads = 0;
+	int t, r;
+
+	if ((size_t)jobs > n)
+		jobs = (int)n;
+
+	if (jobs < 2) {
+		size_t i;
+		for (i = 0; i < n; i++)
+			fn(arg, i);
+		return;
+	}
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pool.next = 0;
+	pool.n = n;
+	pool.fn = fn;
+	pool.arg = arg;
+
+	/* the calling thread is the first worker */
+	threads = ymalloc(sizeof(pthread_t) * (size_t)jobs);
+	for (t = 1; t < jobs; t++) {
+		r = pthread_create(&threads[nthreads], NULL, pool_worker, &pool);
+		if (r) {
+			fprintf(stderr, "warning: Can't create thread: %s\n",
+				strerror(r));
+			break;
+		}
+		nthreads++;
+	}
+
+	(void)pool_worker(&pool);
+
+	for (t = 0; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+
+	yfree(threads);
+	pthread_mutex_destroy(&pool.lock);
+}
+
+struct pool_job {
+	void *job;
+	struct pool_job *next;
+};
+
+struct pool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct pool_job *first;
+	struct pool_job *last;
+	int stop;
+	void (*fn)(void *job);
+	pthread_t *threads;
+	int nthreads;
+};
+
+static void *pool_queue_worker(void *p)
+{
+	POOL *pool = p;
+	struct pool_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->first && !pool->stop)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		job = pool->first;
+		if (job) {
+			pool->first = job->next;
+			if (!pool->first)
+				pool->last = NULL;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		if (!job)
+			break;	/* stopped and nothing left to do */
+		pool->fn(job->job);
+		yfree(job);
+	}
+
+	return NULL;
+}
+
+POOL *pool_start(int jobs, void (*fn)(void *job))
+{
+	POOL *pool = ymalloc(sizeof(POOL));
+	int r;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pool->first = pool->last = NULL;
+	pool->stop = 0;
+	pool->fn = fn;
+	pool->nthreads = 0;
+	pool->threads = NULL;
+
+	if (jobs < 1)
+		return pool;
+
+	pool->threads = ymalloc(sizeof(pthread_t) * (size_t)jobs);
+	while (pool->nthreads < jobs) {
+		r = pthread_create(&pool->threads[pool->nthreads], NULL,
+				   pool_queue_worker, pool);
+		if (r) {
+			fprintf(stderr, "warning: Can't create thread: %s\n",
+				strerror(r));
+			break;
+		}
+		pool->nthreads++;
+	}
+
+	return pool;
+}
+
+void pool_add(POOL *pool, void *job)
+{
+	struct pool_job *j;
+
+	if (!pool->nthreads) {
+		pool->fn(job);
+		return;
+	}
+
+	j = ymalloc(sizeof(struct pool_job));
+	j->job = job;
+	j->next = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->last)
+		pool->last->next = j;
+	else
+		pool->first = j;
+	pool->last = j;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_finish(POOL *pool)
+{
+	int t;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (t = 0; t < pool->nthreads; t++)
+		pthread_join(pool->threads[t], NULL);
+
+	if (pool->threads)
+		yfree(pool->threads);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->cond);
+	yfree(pool);
+}
+
+#else
+
+struct pool {
+	void (*fn)(void *job);
+};
+
+POOL *pool_start(int jobs, void (*fn)(void *job))
+{
+	POOL *pool = ymalloc(sizeof(POOL));
+
+	pool->fn = fn;
+	return pool;
+}
+
+void pool_add(POOL *pool, void *job)
+{
+	pool->fn(job);
+}
+
+void pool_finish(POOL *pool)
+{
+	yfree(pool);
+}
+
+void pool_run(int jobs, size_t n, void (*fn)(void *arg, size_t i), void *arg)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		fn(arg, i);
+}
+
+#endif
+
+int pool_ncpus(void)
+{
+	long n = -1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return n < 1 ? 1 : (int)n;
+}
@@ -0,0 +1,53 @@
+/*
+ * pool.h: Run independent jobs on several threads
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/*
+ * Calls fn(arg, i) for every i from 0 to n - 1, using up to jobs
+ * threads.  The calls may happen in any order and concurrently.
+ * Returns after all calls have finished.
+ *
+ * Without thread support (NO_PTHREADS) or if jobs is smaller than
+ * two, all calls are made in order from the calling thread.
+ */
+void pool_run(int jobs, size_t n, void (*fn)(void *arg, size_t i), void *arg);
+
+/*
+ * A pool of threads working on jobs which are added one by one.
+ */
+typedef struct pool POOL;
+
+/*
+ * Starts jobs threads which call fn(job) for every job added to the
+ * pool.  Without thread support (NO_PTHREADS) or if jobs is smaller
+ * than one, pool_add() calls fn(job) itself.
+ */
+POOL *pool_start(int jobs, void (*fn)(void *job));
+
+/*
+ * Adds a job to the pool.  Jobs are started in the order in which
+ * they were added.
+ */
+void pool_add(POOL *pool, void *job);
+
+/*
+ * Waits until all jobs have been done, then stops the threads and
+ * frees the pool.
+ */
+void pool_finish(POOL *pool);
+
+/*
+ * Returns the number of online processors, at least 1.
+ */
+int pool_ncpus(void);
+
+#endif /* POOL_H */
@@ -0,0 +1,66 @@
+/*
+ * probes.h: Static tracepoints at the boundaries of the conversion
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+/*
+ * Built with "make USE_SDT=1", which needs <sys/sdt.h> from
+ * SystemTap, every PROBE is a USDT probe of the provider odt2txt.
+ * It compiles to a single nop and a note in the binary, which
+ * bpftrace, perf and SystemTap find, e.g.
+ *
+ *	bpftrace -e 'usdt:./odt2txt:odt2txt:rule_end { ... }'
+ *
+ * Otherwise the probes and their arguments are compiled out.  The
+ * arguments are evaluated whenever the probes are built in, so they
+ * must be cheap.
+ *
+ * The probes and their arguments:
+ *
+ *	doc_open       dir, name
+ *	doc_close      dir, name, 0, -1 if it failed
+ *	entry_found    package, name in the package
+ *	inflate_begin  size limit, 0 for none
+ *	inflate_end    bytes read, bytes inflated, errno or 0
+ *	rule_begin     pattern
+ *	rule_end       pattern, matches, -1 if it does not compile
+ *	format_begin   bytes
+ *	format_end     bytes, tags
+ *	wrap_begin     bytes, width
+ *	wrap_end       bytes in the output buffer
+ *	tokens_begin   bytes, flags
+ *	tokens_end     bytes, words
+ *	cache_end      paragraphs, paragraphs whose output was cached
+ *	conv_begin     bytes
+ *	conv_end       bytes, -1 if it failed
+ *	write_begin    bytes
+ *	write_end      bytes, -1 if it failed
+ *
+ * Strings are const char *, the other arguments are long.  dir is ""
+ * for a single document.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#ifdef USE_SDT
+
+#include <sys/sdt.h>
+
+#define PROBE1(name, a)          DTRACE_PROBE1(odt2txt, name, a)
+#define PROBE2(name, a, b)       DTRACE_PROBE2(odt2txt, name, a, b)
+#define PROBE3(name, a, b, c)    DTRACE_PROBE3(odt2txt, name, a, b, c)
+
+#else
+
+#define PROBE1(name, a)          do { if (0) (void)(a); } while (0)
+#define PROBE2(name, a, b)       do { if (0) { (void)(a); (void)(b); } } while (0)
+#define PROBE3(name, a, b, c) \
+	do { if (0) { (void)(a); (void)(b); (void)(c); } } while (0)
+
+#endif /* USE_SDT */
+
+#endif /* PROBES_H */
@@ -8,11 +8,23 @@
  * version 2 as published by the Free Software Foundation
  */
 
+#ifndef NO_PTHREADS
+#  include <pthread.h>
+#endif
+
 #include "mem.h"
+#include "probes.h"
 #include "regex.h"
 
+#ifndef NO_DFA
+#  include "rules.h"
+#endif
+
 #define BUF_SZ 4096
 
+/* the clock is read once per this many matches */
+#define DEADLINE_MATCHES 64
+
 static char *headline(char line, const char *buf, regmatch_t matches[],
 		      size_t nmatch, size_t off);
 static size_t charlen_utf8(const char *s);
@@ -27,70 +39,315 @@ static void print_regexp_err(int reg_errno, const regex_t *rx)
 	yfree(buf);
 }
 
+#ifndef NO_PTHREADS
+
+static pthread_key_t deadline_key;
+static pthread_key_t marks_key;
+static pthread_once_t deadline_once = PTHREAD_ONCE_INIT;
+
+static void deadline_init(void)
+{
+	(void)pthread_key_create(&deadline_key, NULL);
+	(void)pthread_key_create(&marks_key, NULL);
+}
+
+void regex_set_deadline(const struct timespec *deadline)
+{
+	(void)pthread_once(&deadline_once, deadline_init);
+	(void)pthread_setspecific(deadline_key, deadline);
+}
+
+const struct timespec *regex_get_deadline(void)
+{
+	(void)pthread_once(&deadline_once, deadline_init);
+	return pthread_getspecific(deadline_key);
+}
+
+void regex_set_marks(struct regex_marks *marks)
+{
+	(void)pthread_once(&deadline_once, deadline_init);
+	(void)pthread_setspecific(marks_key, marks);
+}
+
+struct regex_marks *regex_get_marks(void)
+{
+	(void)pthread_once(&deadline_once, deadline_init);
+	return pthread_getspecific(marks_key);
+}
+
+#else
+
+static const struct timespec *the_deadline;
+static struct regex_marks *the_marks;
+
+void regex_set_deadline(const struct timespec *deadline)
+{
+	the_deadline = deadline;
+}
+
+const struct timespec *regex_get_deadline(void)
+{
+	return the_deadline;
+}
+
+void regex_set_marks(struct regex_marks *marks)
+{
+	the_marks = marks;
+}
+
+struct regex_marks *regex_get_marks(void)
+{
+	return the_marks;
+}
+
+#endif
+
+void regex_move_marks(const size_t *at, size_t n, size_t len)
+{
+	struct regex_marks *marks = regex_get_marks();
+	size_t i, j = 0;
+
+	if (!marks)
+		return;
+
+	for (i = 0; i < marks->n; i++) {
+		while (j < n && at[j] < marks->pos[i])
+			j++;
+		marks->pos[i] += j * (len - 1);
+	}
+}
+
+/*
+ * Moves the marks from *next on, up to the end of a match from start
+ * to stop.  The text from off to start has been copied to out, which
+ * was outlen bytes long before.
+ */
+static void move_marks(struct regex_marks *marks, size_t *next, size_t off,
+		       size_t start, size_t stop, size_t outlen)
+{
+	size_t j = *next;
+
+	for (; j < marks->n && marks->pos[j] < start; j++)
+		marks->pos[j] = outlen + (marks->pos[j] - off);
+	for (; j < marks->n && marks->pos[j] < stop; j++)
+		marks->pos[j] = outlen + (start - off);
+	*next = j;
+}
+
+int regex_deadline_passed(void)
+{
+	const struct timespec *deadline = regex_get_deadline();
+	struct timespec now;
+
+	if (!deadline)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > deadline->tv_sec ||
+		(now.tv_sec == deadline->tv_sec &&
+		 now.tv_nsec >= deadline->tv_nsec);
+}
+
+#ifndef NO_DFA
+
+/*
+ * Finds the leftmost-longest match of dfa in the len bytes at str,
+ * like regexec() does with REG_STARTEND.  Returns 0 and fills
+ * matches[0], or REG_NOMATCH.  The automata have no subexpressions.
+ */
+static int dfa_exec(const struct regex_dfa *dfa, const char *str, size_t len,
+		    size_t nmatch, regmatch_t matches[])
+{
+	const unsigned char *s = (const unsigned char *)str;
+	const unsigned char *p;
+	const unsigned short *start = dfa->next + dfa->nclasses;
+	size_t i, j, stop;
+	unsigned int state;
+
+	for (i = 0; i <= len; i++) {
+		/* skip the bytes which can't begin a match */
+		if (dfa->bol) {
+			if (i > 0)
+				break;
+		} else if (dfa->first != -1) {
+			p = memchr(s + i, dfa->first, len - i);
+			if (!p)
+				break;
+			i = (size_t)(p - s);
+		} else if (!dfa->accept[1]) {
+			while (i < len && !start[dfa->classes[s[i]]])
+				i++;
+			if (i == len)
+				break;
+		}
+
+		stop = (size_t)-1;
+		state = 1;
+		for (j = i; ; j++) {
+			if (dfa->accept[state] && (!dfa->eol || j == len))
+				stop = j;
+			if (j == len)
+				break;
+			state = dfa->next[state * dfa->nclasses +
+					  dfa->classes[s[j]]];
+			if (!state)
+				break;
+		}
+
+		if (stop != (size_t)-1) {
+			matches[0].rm_so = (regoff_t)i;
+			matches[0].rm_eo = (regoff_t)stop;
+			for (j = 1; j < nmatch; j++)
+				matches[j].rm_so = matches[j].rm_eo = -1;
+			return 0;
+		}
+	}
+	return REG_NOMATCH;
+}
+
+#endif
+
 int regex_subst(STRBUF *buf,
 		const char *regex, int regopt,
 		const void *subst)
 {
 	int r;
+	const char *data;
 	const char *bufp;
+	size_t len;
 	size_t off = 0;
 	const int i = 0;
 	int match_count = 0;
+	STRBUF *out = NULL;
+	struct regex_marks *marks = regex_get_marks();
+	size_t next_mark = 0;
 
 	regex_t rx;
 	const size_t nmatches = 10;
 	regmatch_t matches[10];
+	const struct regex_dfa *dfa = NULL;
+
+	if (regex_deadline_passed())
+		return 0;
 
-	r = regcomp(&rx, regex, REG_EXTENDED);
-	if (r) {
-		print_regexp_err(r, &rx);
-		exit(EXIT_FAILURE);
+	PROBE1(rule_begin, regex);
+#ifndef NO_DFA
+	dfa = dfa_lookup(regex);
+#endif
+	if (!dfa) {
+		r = regcomp(&rx, regex, REG_EXTENDED);
+		if (r) {
+			print_regexp_err(r, &rx);
+			PROBE2(rule_end, regex, -1L);
+			return -1;
+		}
 	}
 
+	/*
+	 * The result is collected in out, so that every match only
+	 * costs copying the text in front of it.  The search continues
+	 * where it did when the buffer was modified in place: the part
+	 * of a replacement that is searched again is written over the
+	 * end of the matched text, which is never longer.
+	 */
+	data = strbuf_get(buf);
+	len = strbuf_len(buf);
+
 	do {
-		if (off > strbuf_len(buf))
+		if (off > len)
 			break;
 
-		bufp = strbuf_get(buf) + off;
+		bufp = data + off;
 
+#ifndef NO_DFA
+		if (dfa) {
+			if (0 != dfa_exec(dfa, bufp, len - off, nmatches, matches))
+				break;
+		} else
+#endif
 #ifdef REG_STARTEND
-		matches[0].rm_so = 0;
-		matches[0].rm_eo = strbuf_len(buf) - off;
+		{
+			matches[0].rm_so = 0;
+			matches[0].rm_eo = len - off;
 
-		if (0 != regexec(&rx, bufp, nmatches, matches, REG_STARTEND))
+			if (0 != regexec(&rx, bufp, nmatches, matches,
+					 REG_STARTEND))
+				break;
+		}
 #else
 		if (0 != regexec(&rx, bufp, nmatches, matches, 0))
-#endif
 			break;
+#endif
 
 		if (matches[i].rm_so != -1) {
 			char *s;
-			int subst_len;
+			size_t start = off + matches[i].rm_so;
+			size_t stop = off + matches[i].rm_eo;
+			size_t subst_len, done;
 
 			if (regopt & _REG_EXEC) {
 				s = (*(char *(*)
 				       (const char *buf, regmatch_t matches[],
 					size_t nmatch, size_t off))subst)
-					(strbuf_get(buf), matches, nmatches, off);
+					(data, matches, nmatches, off);
 			} else
 				s = (char*)subst;
 
-			subst_len = strbuf_subst(buf,
-						 matches[i].rm_so + off,
-						 matches[i].rm_eo + off,
-						 s);
+			if (out == NULL) {
+				out = strbuf_new();
+				strbuf_reserve(out, len);
+			}
+
+			if (marks)
+				move_marks(marks, &next_mark, off, start,
+					   stop, strbuf_len(out));
+			strbuf_append_n(out, bufp, start - off);
+			subst_len = strlen(s);
 			match_count++;
 
+			/* bytes of the replacement which are not searched again */
+			done = 0;
+			if (subst_len >= stop - start)
+				done = subst_len - (stop - start) + 1;
+
+			if (done <= subst_len) {
+				strbuf_append_n(out, s, done);
+				off = stop - (subst_len - done);
+				(void)strbuf_subst(buf, off, stop, s + done);
+			} else {
+				/* empty match, the next character is skipped */
+				strbuf_append_n(out, s, subst_len);
+				if (marks)
+					move_marks(marks, &next_mark, stop,
+						   stop + 1, stop + 1,
+						   strbuf_len(out));
+				if (stop < len)
+					strbuf_append_n(out, data + stop, 1);
+				off = stop + 1;
+			}
+
 			if (regopt & _REG_EXEC)
 				yfree(s);
 
-			off += matches[i].rm_so;
-			if (subst_len >= 0)
-				off += subst_len + 1;
+			if (match_count % DEADLINE_MATCHES == 0 &&
+			    regex_deadline_passed())
+				break;
 		}
 	} while (regopt & _REG_GLOBAL);
 
-	regfree(&rx);
+	if (out != NULL) {
+		if (marks)
+			move_marks(marks, &next_mark, off, len + 1, len + 1,
+				   strbuf_len(out));
+		if (off < len)
+			strbuf_append_n(out, data + off, len - off);
+		strbuf_swap(buf, out);
+		strbuf_free(out);
+	}
+
+	if (!dfa)
+		regfree(&rx);
+	PROBE2(rule_end, regex, (long)match_count);
 	return match_count;
 }
 
@@ -168,7 +425,7 @@ char *image(const char *buf, regmatch_t matches[], size_t nmatch, size_t off)
 
 	pr_len = strlen(prefix);
 	len = matches[i].rm_eo - matches[i].rm_so;
-	po_len = strlen(prefix);
+	po_len = strlen(postfix);
 
 	match = ymalloc(pr_len + len + po_len + 1);
 	memcpy(match, prefix, pr_len);
@@ -192,62 +449,439 @@ static size_t charlen_utf8(const char *s)
 	return count;
 }
 
-STRBUF *wrap(STRBUF *buf, int width)
+/*
+ * Byte classes for wrap_n()
+ */
+#define WC_TEXT  0
+#define WC_SPACE 1
+#define WC_LF    2
+#define WC_LEAD  3  /* first byte of a multibyte sequence */
+
+static const unsigned char wrap_class[256] =
+	{
+		0,0,0,0,0,0,0,0,0,0,2,0,0,0,0,0, /* 0x00-0x0f */
+		0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0x10-0x1f */
+		1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0x20-0x2f */
+		0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0x30-0x3f */
+		0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0x40-0x4f */
+		0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0x50-0x5f */
+		0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0x60-0x6f */
+		0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0x70-0x7f */
+		0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0x80-0x8f */
+		0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0x90-0x9f */
+		0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0xa0-0xaf */
+		0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, /* 0xb0-0xbf */
+		3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3, /* 0xc0-0xcf */
+		3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3, /* 0xd0-0xdf */
+		3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3, /* 0xe0-0xef */
+		3,3,3,3,3,3,3,3,3,3,3,3,3,3,0,0  /* 0xf0-0xff */
+	};
+
+/*
+ * East Asian wide and fullwidth characters, which take two columns
+ */
+static const struct {
+	unsigned int first;
+	unsigned int last;
+} wide_chars[] = {
+	{ 0x1100,  0x115F  }, /* Hangul Jamo */
+	{ 0x2329,  0x232A  }, /* angle brackets */
+	{ 0x2E80,  0x303E  }, /* CJK radicals ... CJK symbols */
+	{ 0x3041,  0x33FF  }, /* Hiragana ... CJK compatibility */
+	{ 0x3400,  0x4DBF  }, /* CJK extension A */
+	{ 0x4E00,  0x9FFF  }, /* CJK unified ideographs */
+	{ 0xA000,  0xA4CF  }, /* Yi */
+	{ 0xA960,  0xA97F  }, /* Hangul Jamo extended A */
+	{ 0xAC00,  0xD7A3  }, /* Hangul syllables */
+	{ 0xF900,  0xFAFF  }, /* CJK compatibility ideographs */
+	{ 0xFE10,  0xFE19  }, /* vertical forms */
+	{ 0xFE30,  0xFE6F  }, /* CJK compatibility forms */
+	{ 0xFF00,  0xFF60  }, /* fullwidth forms */
+	{ 0xFFE0,  0xFFE6  },
+	{ 0x1F300, 0x1F64F }, /* pictographs, emoticons */
+	{ 0x1F900, 0x1F9FF },
+	{ 0x20000, 0x2FFFD }, /* CJK extensions B... */
+	{ 0x30000, 0x3FFFD },
+};
+
+/*
+ * Returns 1 if the UTF-8 sequence at s is a wide character.
+ */
+static int utf8_wide(const unsigned char *s, const unsigned char *end)
 {
-	const char *lf = "\n";
-	const size_t lflen = strlen(lf);
-	const char *bufp;
-	const char *last;
-	const char *lastspace = 0;
+	unsigned int c;
+	size_t lo = 0, hi = sizeof(wide_chars) / sizeof(wide_chars[0]);
+
+	if (*s < 0xE1 || *s > 0xF4)
+		return 0;  /* below U+1100 or invalid */
+
+	if (*s < 0xF0) {
+		if (end - s < 3 || (s[1] & 0xC0) != 0x80 ||
+		    (s[2] & 0xC0) != 0x80)
+			return 0;
+		c = (s[0] & 0x0F) << 12 | (s[1] & 0x3F) << 6 | (s[2] & 0x3F);
+	} else {
+		if (end - s < 4 || (s[1] & 0xC0) != 0x80 ||
+		    (s[2] & 0xC0) != 0x80 || (s[3] & 0xC0) != 0x80)
+			return 0;
+		c = (s[0] & 0x07) << 18 | (s[1] & 0x3F) << 12 |
+			(s[2] & 0x3F) << 6 | (s[3] & 0x3F);
+	}
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (c < wide_chars[mid].first)
+			hi = mid;
+		else if (c > wide_chars[mid].last)
+			lo = mid + 1;
+		else
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Appends a line feed to out.  Spaces at the end of the line are
+ * removed.
+ */
+static void wrap_lf(STRBUF *out)
+{
+	const char *data = strbuf_get(out);
+	size_t len = strbuf_len(out);
+
+	while (len > 0 && data[len - 1] == ' ')
+		len--;
+	strbuf_truncate(out, len);
+	strbuf_append_n(out, "\n", 1);
+}
+
+/*
+ * Appends the bytes from str to end to out.  Spaces in front of line
+ * feeds are removed.
+ */
+static void wrap_emit(STRBUF *out, const unsigned char *str,
+		      const unsigned char *end)
+{
+	const unsigned char *lf;
+
+	while ((lf = memchr(str, '\n', (size_t)(end - str)))) {
+		strbuf_append_n(out, (const char *)str, (size_t)(lf - str));
+		wrap_lf(out);
+		str = lf + 1;
+	}
+	strbuf_append_n(out, (const char *)str, (size_t)(end - str));
+}
+
+/*
+ * Returns the number of columns of the text from str to end, which
+ * is carried over to the next line.  For compatibility with the
+ * output of earlier versions, narrow non-ascii characters are
+ * counted by their bytes here and at the beginning of a line.
+ */
+static size_t wrap_carried(const unsigned char *str, const unsigned char *end,
+			   const unsigned char *limit)
+{
+	size_t len = (size_t)(end - str);
+	size_t n;
+
+	for (; str < end; str++) {
+		if (wrap_class[*str] != WC_LEAD || !utf8_wide(str, limit))
+			continue;
+
+		n = (size_t)utf8_length[*str - 0x80];
+		if ((size_t)(end - str) > n) {
+			len -= n - 1;
+			str += n;
+		} else {
+			/* the current character is counted by the caller */
+			len -= (size_t)(end - str);
+			break;
+		}
+	}
+	return len;
+}
+
+void wrap_n(STRBUF *out, const char *str, size_t len, int width)
+{
+	const unsigned char *bufp = (const unsigned char *)str;
+	const unsigned char *end = bufp + len;
+	const unsigned char *last = bufp;
+	const unsigned char *lastspace = NULL;
+	const unsigned char *linestart = bufp;
 	size_t linelen = 0;
-	STRBUF *out = strbuf_new();
+	size_t extra = 0;
+
+	PROBE2(wrap_begin, (long)len, (long)width);
 
-	bufp = strbuf_get(buf);
-	last = bufp;
+	/* wrapping only adds a few line feeds */
+	strbuf_reserve(out, len + len / 16 + 16);
 
 	if (width == -1) {
-		strbuf_append_n(out, strbuf_get(buf), strbuf_len(buf));
-		return out;
+		wrap_emit(out, bufp, end);
+		PROBE1(wrap_end, (long)strbuf_len(out));
+		return;
 	}
 
-	strbuf_append_n(out, lf, lflen);
-	while(bufp - strbuf_get(buf) < (ptrdiff_t)strbuf_len(buf)) {
-		if (*bufp == ' ')
+	while (bufp < end) {
+		switch (wrap_class[*bufp]) {
+		case WC_SPACE:
 			lastspace = bufp;
-		else if (*bufp == '\n') {
-			strbuf_append_n(out, last, (size_t)(bufp - last));
+			break;
+
+		case WC_LF:
+			wrap_emit(out, last, bufp);
 			do {
-				strbuf_append_n(out, lf, lflen);
-			} while (*++bufp == '\n');
+				wrap_lf(out);
+			} while (++bufp < end && *bufp == '\n');
 			lastspace = NULL;
 
-			while(*bufp == ' ') {
+			while (bufp < end && *bufp == ' ')
 				bufp++;
-			}
-			last = bufp;
+			last = linestart = bufp;
 			linelen = 0;
+			break;
 		}
 
 		if (NULL != lastspace && (int)linelen > width) {
-			strbuf_append_n(out, last, (size_t)(lastspace - last));
-			strbuf_append_n(out, lf, lflen);
+			wrap_emit(out, last, lastspace);
+			wrap_lf(out);
 			last = lastspace;
 			lastspace = NULL;
-			linelen = (size_t)(bufp - last);
+			linelen = wrap_carried(last, bufp, end);
 
-			while(*last == ' ') {
+			while (last < end && *last == ' ')
 				last++;
-			}
-			if(last > bufp)
-				bufp = last;
+			if (last > bufp)
+				bufp = linestart = last;
 		}
 
 		bufp++;
-		linelen++;
-		if ((unsigned char)*bufp > 0x80)
-			bufp += utf8_length[(unsigned char)*bufp - 0x80];
+		linelen += 1 + extra;
+		extra = 0;
+		if (bufp >= end)
+			break;
+
+		if (wrap_class[*bufp] == WC_LEAD) {
+			/* continue at the last byte of the character */
+			extra = utf8_wide(bufp, end);
+			bufp += utf8_length[*bufp - 0x80];
+		} else if (bufp - 1 == linestart &&
+			   wrap_class[*linestart] == WC_LEAD &&
+			   utf8_wide(linestart, end)) {
+			/* a wide character at the beginning of a line */
+			bufp = linestart + utf8_length[*linestart - 0x80];
+		}
+	}
+	PROBE1(wrap_end, (long)strbuf_len(out));
+}
+
+/*
+ * Punctuation and spaces beyond ASCII, which separate words
+ */
+static const struct {
+	unsigned int first;
+	unsigned int last;
+} separators[] = {
+	{ 0x0080, 0x00A9 }, /* controls, no-break space ... */
+	{ 0x00AB, 0x00B1 },
+	{ 0x00B4, 0x00B4 },
+	{ 0x00B6, 0x00B8 },
+	{ 0x00BB, 0x00BF },
+	{ 0x00D7, 0x00D7 }, /* multiplication sign */
+	{ 0x00F7, 0x00F7 }, /* division sign */
+	{ 0x2000, 0x206F }, /* general punctuation */
+	{ 0x3000, 0x3003 }, /* ideographic space and punctuation */
+	{ 0x3008, 0x3011 }, /* CJK brackets */
+	{ 0xFEFF, 0xFEFF }, /* byte order mark */
+	{ 0xFF01, 0xFF0F }, /* fullwidth punctuation */
+	{ 0xFF1A, 0xFF20 },
+	{ 0xFF3B, 0xFF40 },
+	{ 0xFF5B, 0xFF65 },
+	{ 0xFFFD, 0xFFFD }, /* replacement character */
+};
+
+/*
+ * Decodes the UTF-8 character at s into c and returns its length.
+ * An invalid byte is U+FFFD, of length 1.
+ */
+static size_t utf8_char(const unsigned char *s, const unsigned char *end,
+			unsigned int *c)
+{
+	size_t n, i;
+
+	if (*s < 0x80) {
+		*c = *s;
+		return 1;
+	}
+
+	n = (size_t)utf8_length[*s - 0x80];
+	if (n == 0 || (size_t)(end - s) <= n) {
+		*c = 0xFFFD;
+		return 1;
+	}
+	*c = *s & (0x3F >> n);
+	for (i = 1; i <= n; i++) {
+		if ((s[i] & 0xC0) != 0x80) {
+			*c = 0xFFFD;
+			return 1;
+		}
+		*c = *c << 6 | (s[i] & 0x3F);
+	}
+	return n + 1;
+}
+
+static int is_word_char(unsigned int c)
+{
+	size_t lo = 0, hi = sizeof(separators) / sizeof(separators[0]);
+
+	if (c < 0x80)
+		return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' &&
+						  (c | 0x20) <= 'z');
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (c < separators[mid].first)
+			hi = mid;
+		else if (c > separators[mid].last)
+			lo = mid + 1;
+		else
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Returns the lowercase letter of c in the Latin, Greek and Cyrillic
+ * alphabets, independent of the locale.  Other characters are
+ * returned as they are.
+ */
+static unsigned int lower_char(unsigned int c)
+{
+	if (c < 0x80)
+		return c >= 'A' && c <= 'Z' ? c + 0x20 : c;
+	if ((c >= 0xC0 && c <= 0xDE && c != 0xD7) ||
+	    (c >= 0x391 && c <= 0x3AB && c != 0x3A2) ||
+	    (c >= 0x410 && c <= 0x42F))
+		return c + 0x20;
+	if (c >= 0x400 && c <= 0x40F)
+		return c + 0x50;
+
+	/* Latin Extended-A has pairs of upper and lower case */
+	if ((c >= 0x100 && c <= 0x12F) || (c >= 0x132 && c <= 0x137) ||
+	    (c >= 0x14A && c <= 0x177))
+		return c | 1;
+	if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E))
+		return c & 1 ? c + 1 : c;
+	if (c == 0x178)
+		return 0xFF;
+	return c;
+}
+
+/*
+ * Appends the token from str to end, of chars characters, as a line
+ * of its own.
+ */
+static void token_put(STRBUF *out, const unsigned char *str,
+		      const unsigned char *end, size_t chars, int flags)
+{
+	char tmp[32];
+	unsigned int c;
+	size_t n;
+
+	if (flags & TOKENS_LENGTH) {
+		n = (size_t)snprintf(tmp, sizeof(tmp), "%lu ",
+				     (unsigned long)chars);
+		strbuf_append_n(out, tmp, n);
+	}
+
+	if (!(flags & TOKENS_LOWER)) {
+		strbuf_append_n(out, (const char *)str, (size_t)(end - str));
+		strbuf_append_n(out, "\n", 1);
+		return;
+	}
+
+	while (str < end) {
+		n = utf8_char(str, end, &c);
+		if (c < 0x80) {
+			tmp[0] = (char)lower_char(c);
+			strbuf_append_n(out, tmp, 1);
+		} else if (c < 0x800 && lower_char(c) != c) {
+			/* all lowercase letters have two bytes, too */
+			c = lower_char(c);
+			tmp[0] = (char)(0xC0 | c >> 6);
+			tmp[1] = (char)(0x80 | (c & 0x3F));
+			strbuf_append_n(out, tmp, 2);
+		} else {
+			strbuf_append_n(out, (const char *)str, n);
+		}
+		str += n;
 	}
 	strbuf_append_n(out, "\n", 1);
-	return out;
 }
 
+void tokenize_n(STRBUF *out, const char *str, size_t len, int flags,
+		int para, struct text_counts *counts)
+{
+	const unsigned char *p = (const unsigned char *)str;
+	const unsigned char *end = p + len;
+	const unsigned char *start = NULL;	/* of the current word */
+	size_t chars = 0;			/* in the current word */
+	int nl = para ? 2 : 1;
+	unsigned long words = counts->words;
+	unsigned int c;
+	size_t n;
+
+	PROBE2(tokens_begin, (long)len, (long)flags);
+
+	if (!(flags & TOKENS_COUNT))
+		strbuf_reserve(out, len);
+
+	while (p < end) {
+		n = utf8_char(p, end, &c);
+
+		if (c == '\n') {
+			nl++;
+		} else {
+			if (nl >= 2)
+				counts->paras++;
+			nl = 0;
+			counts->chars++;
+		}
+
+		if (is_word_char(c)) {
+			if (!start) {
+				start = p;
+				chars = 0;
+			}
+			chars++;
+		} else if (start) {
+			if (!(flags & TOKENS_COUNT))
+				token_put(out, start, p, chars, flags);
+			counts->words++;
+			start = NULL;
+		}
+		p += n;
+	}
+	if (start) {
+		if (!(flags & TOKENS_COUNT))
+			token_put(out, start, p, chars, flags);
+		counts->words++;
+	}
+
+	PROBE2(tokens_end, (long)len, (long)(counts->words - words));
+}
+
+STRBUF *wrap(STRBUF *buf, int width)
+{
+	STRBUF *out = strbuf_new();
+
+	if (width == -1) {
+		wrap_n(out, strbuf_get(buf), strbuf_len(buf), width);
+		return out;
+	}
+
+	strbuf_append_n(out, "\n", 1);
+	wrap_n(out, strbuf_get(buf), strbuf_len(buf), width);
+	wrap_lf(out);
+	return out;
+}
@@ -16,6 +16,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "strbuf.h"
 
@@ -26,18 +27,69 @@
 /*
  * Deletes match(es) of regex from *buf.
  *
- * Returns the number of matches that were deleted.
+ * Returns the number of matches that were deleted, or -1 like
+ * regex_subst().
  */
 int regex_rm(STRBUF *buf,
 	     const char *regex, int regopt);
 
 /*
  * Replaces match(es) of regex from *buf with subst.
+ *
+ * Returns the number of replaced matches, or -1 if regex can't be
+ * compiled.  *buf is unchanged then.
  */
 int regex_subst(STRBUF *buf,
 		const char *regex, int regopt,
 		const void *subst);
 
+/*
+ * Makes regex_subst() on the calling thread stop replacing anything
+ * once the CLOCK_MONOTONIC time deadline has passed, so that a
+ * document which takes too long is given up quickly.  deadline must
+ * stay valid until it is replaced.  NULL removes it.
+ */
+void regex_set_deadline(const struct timespec *deadline);
+
+/*
+ * Returns the deadline of the calling thread, or NULL.
+ */
+const struct timespec *regex_get_deadline(void);
+
+/*
+ * Returns whether the deadline of the calling thread has passed.
+ */
+int regex_deadline_passed(void);
+
+/*
+ * Offsets into a buffer, sorted, which regex_subst() keeps pointing
+ * at the same text while it replaces matches.  An offset inside a
+ * match moves to the start of its replacement.  This maps positions
+ * in the output of a series of replacements back to the input.
+ */
+struct regex_marks {
+	size_t *pos;
+	size_t n;
+};
+
+/*
+ * Makes regex_subst() on the calling thread move marks.  marks must
+ * stay valid until they are replaced.  NULL removes them.
+ */
+void regex_set_marks(struct regex_marks *marks);
+
+/*
+ * Returns the marks of the calling thread, or NULL.
+ */
+struct regex_marks *regex_get_marks(void);
+
+/*
+ * Moves the marks of the calling thread for code which changes the
+ * buffer without regex_subst(): each of the n single bytes at the
+ * sorted offsets at has been replaced by len bytes.
+ */
+void regex_move_marks(const size_t *at, size_t n, size_t len);
+
 /*
  * Returns a pointer to a new string with two lines. The first line
  * contains str, the second line contains strlen(str) copies of
@@ -62,10 +114,49 @@ char *image(const char *buf, regmatch_t matches[], size_t nmatch, size_t off);
 
 /*
  * Copies the contents of buf to a new string buffer, wrapped to a
- * maximal line width of width characters.
+ * maximal line width of width columns.  East Asian wide characters
+ * take two columns.  Spaces at the end of lines are removed.
  */
 STRBUF *wrap(STRBUF *buf, int width);
 
+/*
+ * Appends len bytes from str to out, wrapped like wrap() does, but
+ * without the line feeds wrap() adds at the beginning and the end.
+ *
+ * A text can be split after any line feed that is followed by
+ * neither another line feed nor a space, and the parts can be
+ * wrapped independently.  Each part except the last one must end
+ * with such a line feed.
+ */
+void wrap_n(STRBUF *out, const char *str, size_t len, int width);
+
+/*
+ * What tokenize_n() counts
+ */
+struct text_counts {
+	unsigned long words;
+	unsigned long chars;	/* without line feeds */
+	unsigned long paras;	/* separated by blank lines */
+};
+
+#define TOKENS_LOWER  1	/* lowercase the letters */
+#define TOKENS_LENGTH 2	/* put the number of characters in front */
+#define TOKENS_COUNT  4	/* only count */
+
+/*
+ * Appends the words of the len bytes from str to out, one per line,
+ * instead of wrapping them, and adds them, their characters and their
+ * paragraphs to counts.  Words are split at white space and
+ * punctuation.  With TOKENS_COUNT in flags, nothing is appended and
+ * out may be NULL.
+ *
+ * A text can be split like for wrap_n().  para tells whether str
+ * starts a paragraph, i.e. whether it starts the text or follows a
+ * blank line.
+ */
+void tokenize_n(STRBUF *out, const char *str, size_t len, int flags,
+		int para, struct text_counts *counts);
+
 /*
  * number of characters that follow in the byte sequence
  */
@@ -0,0 +1,146 @@
+/*
+ * ring.c: A single-producer/single-consumer ring of recycled buffers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+#ifndef NO_PTHREADS
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "mem.h"
+#include "ring.h"
+
+struct ring {
+	char **block;
+	size_t *len;
+	size_t nslots;
+
+	atomic_size_t head;	/* number of blocks put by the producer */
+	atomic_size_t tail;	/* number of blocks released by the consumer */
+	atomic_int closed;
+
+	/* only used to sleep on a full or empty ring */
+	atomic_int sleepers;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+RING *ring_new(size_t nslots, size_t blocksz)
+{
+	RING *ring = ymalloc(sizeof(RING));
+	size_t i;
+
+	ring->nslots = nslots;
+	ring->block = ymalloc(sizeof(char *) * nslots);
+	ring->len = ymalloc(sizeof(size_t) * nslots);
+	for (i = 0; i < nslots; i++)
+		ring->block[i] = ymalloc(blocksz);
+
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->closed, 0);
+	atomic_init(&ring->sleepers, 0);
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->cond, NULL);
+
+	return ring;
+}
+
+void ring_free(RING *ring)
+{
+	size_t i;
+
+	for (i = 0; i < ring->nslots; i++)
+		yfree(ring->block[i]);
+	yfree(ring->block);
+	yfree(ring->len);
+	pthread_mutex_destroy(&ring->lock);
+	pthread_cond_destroy(&ring->cond);
+	yfree(ring);
+}
+
+static int ring_has_free(RING *ring)
+{
+	return atomic_load(&ring->head) - atomic_load(&ring->tail)
+		< ring->nslots;
+}
+
+static int ring_has_data(RING *ring)
+{
+	return atomic_load(&ring->head) != atomic_load(&ring->tail)
+		|| atomic_load(&ring->closed);
+}
+
+/*
+ * The sleeper is counted before it checks the condition, and the
+ * other side publishes its change before it looks for sleepers, so a
+ * wakeup cannot get lost.
+ */
+static void ring_wait(RING *ring, int (*ready)(RING *ring))
+{
+	pthread_mutex_lock(&ring->lock);
+	atomic_fetch_add(&ring->sleepers, 1);
+	while (!ready(ring))
+		pthread_cond_wait(&ring->cond, &ring->lock);
+	atomic_fetch_sub(&ring->sleepers, 1);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+static void ring_wake(RING *ring)
+{
+	if (atomic_load(&ring->sleepers)) {
+		pthread_mutex_lock(&ring->lock);
+		pthread_cond_broadcast(&ring->cond);
+		pthread_mutex_unlock(&ring->lock);
+	}
+}
+
+char *ring_get_free(RING *ring)
+{
+	if (!ring_has_free(ring))
+		ring_wait(ring, ring_has_free);
+
+	return ring->block[atomic_load(&ring->head) % ring->nslots];
+}
+
+void ring_put(RING *ring, size_t len)
+{
+	size_t head = atomic_load(&ring->head);
+
+	ring->len[head % ring->nslots] = len;
+	atomic_store(&ring->head, head + 1);
+	ring_wake(ring);
+}
+
+void ring_close(RING *ring)
+{
+	atomic_store(&ring->closed, 1);
+	ring_wake(ring);
+}
+
+const char *ring_get(RING *ring, size_t *len)
+{
+	size_t tail;
+
+	if (!ring_has_data(ring))
+		ring_wait(ring, ring_has_data);
+
+	tail = atomic_load(&ring->tail);
+	if (tail == atomic_load(&ring->head))
+		return NULL;	/* closed and empty */
+
+	*len = ring->len[tail % ring->nslots];
+	return ring->block[tail % ring->nslots];
+}
+
+void ring_release(RING *ring)
+{
+	atomic_fetch_add(&ring->tail, 1);
+	ring_wake(ring);
+}
+
+#endif /* NO_PTHREADS */
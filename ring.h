@@ -0,0 +1,63 @@
+/*
+ * ring.h: A single-producer/single-consumer ring of recycled buffers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+
+/*
+ * The ring holds a fixed number of blocks of a fixed size.  Exactly
+ * one thread fills blocks and exactly one other thread reads them.
+ * Both sides only take a lock when they have to wait because the
+ * ring is full or empty.
+ */
+typedef struct ring RING;
+
+/*
+ * Creates a ring of nslots blocks of blocksz bytes each.
+ */
+RING *ring_new(size_t nslots, size_t blocksz);
+
+/*
+ * Frees the ring and all of its blocks.
+ */
+void ring_free(RING *ring);
+
+/*
+ * Producer: Returns the next free block, waiting until the consumer
+ * has released one if necessary.  Up to blocksz bytes can be written
+ * into it.
+ */
+char *ring_get_free(RING *ring);
+
+/*
+ * Producer: Hands the first len bytes of the block returned by the
+ * last call to ring_get_free() to the consumer.
+ */
+void ring_put(RING *ring, size_t len);
+
+/*
+ * Producer: Signals that no more blocks will follow.
+ */
+void ring_close(RING *ring);
+
+/*
+ * Consumer: Returns the next block and stores its length in *len,
+ * waiting for the producer if necessary.  Returns NULL once the ring
+ * has been closed and all blocks have been read.
+ */
+const char *ring_get(RING *ring, size_t *len);
+
+/*
+ * Consumer: Gives the block returned by the last call to ring_get()
+ * back to the producer.
+ */
+void ring_release(RING *ring);
+
+#endif /* RING_H */
@@ -0,0 +1,276 @@
+/*
+ * sched.c: Run jobs of different sizes under a memory budget
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef NO_PTHREADS
+#  include <pthread.h>
+#endif
+
+#include "mem.h"
+#include "sched.h"
+
+struct sched_job {
+	void *job;
+	size_t size;
+};
+
+/*
+ * The jobs of a worker, largest first.  The worker takes jobs from
+ * the head, others steal from the tail.
+ */
+struct sched_deque {
+	struct sched_job *jobs;
+	size_t head;
+	size_t tail;
+};
+
+struct sched {
+	int workers;
+	size_t budget;
+
+	struct sched_job *jobs;
+	size_t njobs;
+	size_t jobs_sz;
+
+#ifndef NO_PTHREADS
+	/* jobs are whole documents, so a single lock for all queues
+	   and the memory accounting is not contended */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct sched_deque *deques;
+	size_t left;		/* jobs not started yet */
+	size_t nrunning;	/* number of running jobs */
+	size_t running;		/* memory of the running jobs */
+	size_t reserved;	/* memory of the jobs waiting to start */
+	void (*fn)(void *job);
+#endif
+};
+
+SCHED *sched_new(int workers, size_t budget)
+{
+	SCHED *sched = ymalloc(sizeof(SCHED));
+
+	sched->workers = workers < 1 ? 1 : workers;
+	sched->budget = budget;
+	sched->jobs = NULL;
+	sched->njobs = 0;
+	sched->jobs_sz = 0;
+
+	return sched;
+}
+
+void sched_add(SCHED *sched, void *job, size_t size)
+{
+	if (sched->njobs == sched->jobs_sz) {
+		sched->jobs_sz = sched->jobs_sz ? sched->jobs_sz * 2 : 64;
+		sched->jobs = yrealloc(sched->jobs, sched->jobs_sz *
+				       sizeof(struct sched_job));
+	}
+
+	sched->jobs[sched->njobs].job = job;
+	sched->jobs[sched->njobs].size = size;
+	sched->njobs++;
+}
+
+static int sched_cmp(const void *a, const void *b)
+{
+	const struct sched_job *ja = a, *jb = b;
+
+	if (ja->size != jb->size)
+		return ja->size < jb->size ? 1 : -1;
+	return 0;
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * Whether a job of size bytes may start.  mine is the memory the
+ * caller has reserved for it.  If nothing runs, anything may start.
+ */
+static int sched_fits(SCHED *sched, size_t size, size_t mine)
+{
+	if (!sched->budget || !sched->nrunning)
+		return 1;
+	return sched->running + (sched->reserved - mine) + size
+		<= sched->budget;
+}
+
+/*
+ * Returns the next job for worker self, or NULL if all jobs have
+ * been started.  Called with the lock held, waits for memory.
+ */
+static struct sched_job *sched_take(SCHED *sched, int self)
+{
+	struct sched_deque *own = &sched->deques[self];
+	struct sched_job *job = NULL;
+	size_t mine = 0;
+	int i;
+
+	while (sched->left) {
+		if (own->head < own->tail) {
+			/* the largest job of our own */
+			job = &own->jobs[own->head];
+			if (sched_fits(sched, job->size, mine)) {
+				own->head++;
+				break;
+			}
+
+			/* keep the memory for it, so that smaller jobs
+			   don't keep it waiting forever */
+			if (!mine) {
+				mine = job->size;
+				sched->reserved += mine;
+			}
+			job = NULL;
+		} else {
+			/* the job we waited for may have been stolen */
+			sched->reserved -= mine;
+			mine = 0;
+
+			/* steal the smallest job of another worker */
+			for (i = 1; i < sched->workers && !job; i++) {
+				struct sched_deque *d =
+					&sched->deques[(self + i) % sched->workers];
+
+				if (d->head < d->tail &&
+				    sched_fits(sched, d->jobs[d->tail - 1].size, 0))
+					job = &d->jobs[--d->tail];
+			}
+			if (job)
+				break;
+		}
+
+		pthread_cond_wait(&sched->cond, &sched->lock);
+	}
+
+	sched->reserved -= mine;
+	if (job) {
+		sched->left--;
+		sched->nrunning++;
+		sched->running += job->size;
+	}
+	return job;
+}
+
+struct sched_worker {
+	SCHED *sched;
+	int self;
+};
+
+static void *sched_worker(void *p)
+{
+	SCHED *sched = ((struct sched_worker *)p)->sched;
+	int self = ((struct sched_worker *)p)->self;
+	struct sched_job *job;
+
+	pthread_mutex_lock(&sched->lock);
+	while ((job = sched_take(sched, self))) {
+		pthread_mutex_unlock(&sched->lock);
+
+		sched->fn(job->job);
+
+		pthread_mutex_lock(&sched->lock);
+		sched->nrunning--;
+		sched->running -= job->size;
+		pthread_cond_broadcast(&sched->cond);
+	}
+	pthread_mutex_unlock(&sched->lock);
+
+	return NULL;
+}
+
+void sched_run(SCHED *sched, void (*fn)(void *job))
+{
+	pthread_t *threads;
+	struct sched_worker *args;
+	int nthreads = 0;
+	int t, r;
+	size_t i;
+
+	qsort(sched->jobs, sched->njobs, sizeof(struct sched_job), sched_cmp);
+
+	if ((size_t)sched->workers > sched->njobs)
+		sched->workers = sched->njobs ? (int)sched->njobs : 1;
+
+	/* deal the jobs out, so that every worker starts with one of
+	   the largest and each queue stays sorted */
+	sched->deques = ymalloc(sizeof(struct sched_deque) *
+				(size_t)sched->workers);
+	for (t = 0; t < sched->workers; t++) {
+		struct sched_deque *d = &sched->deques[t];
+
+		d->jobs = ymalloc(sizeof(struct sched_job) *
+				  (sched->njobs / (size_t)sched->workers + 1));
+		d->head = d->tail = 0;
+		for (i = (size_t)t; i < sched->njobs; i += (size_t)sched->workers)
+			d->jobs[d->tail++] = sched->jobs[i];
+	}
+
+	pthread_mutex_init(&sched->lock, NULL);
+	pthread_cond_init(&sched->cond, NULL);
+	sched->left = sched->njobs;
+	sched->nrunning = 0;
+	sched->running = 0;
+	sched->reserved = 0;
+	sched->fn = fn;
+
+	/* the calling thread is the first worker */
+	threads = ymalloc(sizeof(pthread_t) * (size_t)sched->workers);
+	args = ymalloc(sizeof(struct sched_worker) * (size_t)sched->workers);
+	for (t = 0; t < sched->workers; t++) {
+		args[t].sched = sched;
+		args[t].self = t;
+	}
+	for (t = 1; t < sched->workers; t++) {
+		r = pthread_create(&threads[nthreads], NULL, sched_worker,
+				   &args[t]);
+		if (r) {
+			/* the jobs of this worker are stolen by the others */
+			fprintf(stderr, "warning: Can't create thread: %s\n",
+				strerror(r));
+			break;
+		}
+		nthreads++;
+	}
+
+	(void)sched_worker(&args[0]);
+
+	for (t = 0; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+
+	for (t = 0; t < sched->workers; t++)
+		yfree(sched->deques[t].jobs);
+	yfree(sched->deques);
+	yfree(threads);
+	yfree(args);
+	pthread_mutex_destroy(&sched->lock);
+	pthread_cond_destroy(&sched->cond);
+	if (sched->jobs)
+		yfree(sched->jobs);
+	yfree(sched);
+}
+
+#else
+
+void sched_run(SCHED *sched, void (*fn)(void *job))
+{
+	size_t i;
+
+	qsort(sched->jobs, sched->njobs, sizeof(struct sched_job), sched_cmp);
+
+	for (i = 0; i < sched->njobs; i++)
+		fn(sched->jobs[i].job);
+
+	if (sched->jobs)
+		yfree(sched->jobs);
+	yfree(sched);
+}
+
+#endif
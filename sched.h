@@ -0,0 +1,43 @@
+/*
+ * sched.h: Run jobs of different sizes under a memory budget
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stddef.h>
+
+/*
+ * A batch of jobs, each with the amount of memory it is expected to
+ * need at its peak.  The largest jobs are started first, so that a
+ * large job doesn't hold up the end of the batch.  Each worker has
+ * its own queue and takes the small jobs from the queues of the
+ * others when its own queue is empty.  Jobs are only started while
+ * the memory of all running jobs stays within the budget.  A job
+ * which is larger than the whole budget runs alone.
+ */
+typedef struct sched SCHED;
+
+/*
+ * Creates a batch for up to workers threads and a budget of
+ * budget bytes, 0 for no limit.
+ */
+SCHED *sched_new(int workers, size_t budget);
+
+/*
+ * Adds a job which needs size bytes.
+ */
+void sched_add(SCHED *sched, void *job, size_t size);
+
+/*
+ * Calls fn(job) for every job and returns after all calls have
+ * finished, then frees the batch.  Without thread support
+ * (NO_PTHREADS) the jobs are run one by one, largest first.
+ */
+void sched_run(SCHED *sched, void (*fn)(void *job));
+
+#endif /* SCHED_H */
@@ -8,7 +8,10 @@
  * version 2 as published by the Free Software Foundation
  */
 
+#include <errno.h>
+
 #include "strbuf.h"
+#include "probes.h"
 
 static const size_t strbuf_start_sz = 128;
 static const size_t strbuf_grow_sz = 128;
@@ -101,6 +104,19 @@ size_t strbuf_append(STRBUF *buf, const char *str)
 	return strbuf_append_n(buf, str, strlen(str));
 }
 
+void strbuf_truncate(STRBUF *buf, size_t len)
+{
+	strbuf_check(buf);
+
+	if (len >= buf->len)
+		return;
+
+	buf->len = len;
+	*(buf->data + buf->len) = 0;
+
+	strbuf_check(buf);
+}
+
 const char *strbuf_get(STRBUF *buf)
 {
 	strbuf_check(buf);
@@ -196,20 +212,81 @@ size_t strbuf_append_file(STRBUF *buf, FILE *in)
 	return len;
 }
 
+void strbuf_swap(STRBUF *a, STRBUF *b)
+{
+	char *data = a->data;
+	size_t len = a->len;
+	size_t buf_sz = a->buf_sz;
+
+	strbuf_check(a);
+	strbuf_check(b);
+
+	a->data = b->data;
+	a->len = b->len;
+	a->buf_sz = b->buf_sz;
+
+	b->data = data;
+	b->len = len;
+	b->buf_sz = buf_sz;
+}
+
+void strbuf_reserve(STRBUF *buf, size_t n)
+{
+	strbuf_check(buf);
+
+	if (buf->len + n + 1 <= buf->buf_sz)
+		return;
+
+	buf->buf_sz = buf->len + n + 1;
+	buf->data = yrealloc(buf->data, buf->buf_sz);
+
+	strbuf_check(buf);
+}
+
 size_t strbuf_append_inflate(STRBUF *buf, FILE *in)
+{
+	return strbuf_append_inflate_max(buf, in, 0, 0);
+}
+
+int inflate_exceeds(unsigned long out, unsigned long in, size_t max_len,
+		    unsigned long max_ratio)
+{
+	if (max_len && out > max_len)
+		return 1;
+	return max_ratio && out > INFLATE_RATIO_MIN && out / max_ratio > in;
+}
+
+static long read_stdio(void *in, char *buf, size_t len)
+{
+	size_t r = fread(buf, 1, len, in);
+	int f_err;
+
+	if (r < len && (f_err = ferror((FILE *)in))) {
+		fprintf(stderr, "stdio error: %d\n", f_err);
+		return -1;
+	}
+	return (long)r;
+}
+
+size_t strbuf_append_inflate_max(STRBUF *buf, FILE *in, size_t max_len,
+				 unsigned long max_ratio)
+{
+	return strbuf_append_inflate_fn(buf, read_stdio, in, max_len,
+					max_ratio);
+}
+
+size_t strbuf_append_inflate_fn(STRBUF *buf, strbuf_read_fn read_fn, void *in,
+				size_t max_len, unsigned long max_ratio)
 {
 	size_t len;
 	z_stream strm;
 	Bytef readbuf[1024];
 	int z_ret;
 	int nullok;
+	int err = 0;
 
 	strbuf_check(buf);
 
-	/* save NULLOK flag */
-	nullok = (buf->opt & STRBUF_NULLOK) ? 1 : 0;
-	strbuf_setopt(buf, STRBUF_NULLOK);
-
 	/* zlib init */
 	strm.zalloc   = Z_NULL;
 	strm.zfree    = Z_NULL;
@@ -219,22 +296,25 @@ size_t strbuf_append_inflate(STRBUF *buf, FILE *in)
 
 	z_ret = inflateInit2(&strm, -15);
 	if (z_ret != Z_OK) {
-		fprintf(stderr, "A: zlib returned error: %d\n", z_ret);
-		exit(EXIT_FAILURE);
+		fprintf(stderr, "zlib returned error: %d\n", z_ret);
+		errno = ENOMEM;
+		return (size_t)-1;
 	}
+	PROBE1(inflate_begin, (long)max_len);
 
-	do {
-		int f_err;
+	/* save NULLOK flag */
+	nullok = (buf->opt & STRBUF_NULLOK) ? 1 : 0;
+	strbuf_setopt(buf, STRBUF_NULLOK);
 
-		strm.avail_in = (uInt)fread(readbuf, 1, sizeof(readbuf), in);
+	do {
+		long r = read_fn(in, (char *)readbuf, sizeof(readbuf));
 
-		f_err = ferror(in);
-		if (f_err) {
-			(void)inflateEnd(&strm);
-			fprintf(stderr, "stdio error: %d\n", f_err);
-			exit(EXIT_FAILURE); /* TODO: errmsg? continue? */
+		if (r < 0) {
+			err = EIO;
+			break;
 		}
 
+		strm.avail_in = (uInt)r;
 		if (strm.avail_in == 0)
 			break;
 
@@ -253,17 +333,29 @@ size_t strbuf_append_inflate(STRBUF *buf, FILE *in)
 			case Z_NEED_DICT:
 			case Z_DATA_ERROR:
 			case Z_MEM_ERROR:
-				(void)inflateEnd(&strm);
-				fprintf(stderr, "B: zlib returned error: %d\n", z_ret);
-				exit(EXIT_FAILURE);
+				fprintf(stderr, "zlib returned error: %d\n", z_ret);
+				err = z_ret == Z_MEM_ERROR ? ENOMEM : EINVAL;
+				break;
 			}
+			if (err)
+				break;
 
 			bytes_inflated  = (buf->buf_sz - buf->len) - strm.avail_out;
 			buf->len       += bytes_inflated;
 
+			if (inflate_exceeds(strm.total_out, strm.total_in,
+					    max_len, max_ratio)) {
+				err = EFBIG;
+				break;
+			}
 		} while (strm.avail_out == 0);
 
-	} while (z_ret != Z_STREAM_END);
+	} while (z_ret != Z_STREAM_END && !err);
+
+	if (!err && z_ret != Z_STREAM_END) {
+		fprintf(stderr, "Compressed data is truncated\n");
+		err = EINVAL;
+	}
 
 	/* terminate buffer */
 	if (buf->len + 1 > buf->buf_sz)
@@ -277,16 +369,88 @@ size_t strbuf_append_inflate(STRBUF *buf, FILE *in)
 	strbuf_check(buf);
 
 	len = (size_t)strm.total_out;
+	PROBE3(inflate_end, (long)strm.total_in, (long)len, (long)err);
 	(void)inflateEnd(&strm);
 
-	if (z_ret != Z_STREAM_END) {
-		fprintf(stderr, "ERR\n");
-		exit(EXIT_FAILURE);
+	if (err) {
+		errno = err;
+		return (size_t)-1;
 	}
 
 	return len;
 }
 
+/* input and output per call of deflate(), which counts in uInt */
+#define GZIP_CHUNK (1UL << 30)
+
+/* the output starts at an eighth of the input plus this and is
+   doubled when it runs out, rather than allocated for the worst
+   case, which is larger than the input */
+#define GZIP_START 4096
+
+STRBUF *strbuf_gzip(STRBUF *buf, int level)
+{
+	STRBUF *out;
+	z_stream strm;
+	const char *in;
+	size_t left;
+	int z_ret;
+
+	strbuf_check(buf);
+
+	strm.zalloc   = Z_NULL;
+	strm.zfree    = Z_NULL;
+	strm.opaque   = Z_NULL;
+	strm.next_in  = Z_NULL;
+	strm.avail_in = 0;
+
+	/* 16 more window bits for a gzip header and trailer */
+	z_ret = deflateInit2(&strm, level, Z_DEFLATED, 15 + 16, 8,
+			     Z_DEFAULT_STRATEGY);
+	if (z_ret != Z_OK) {
+		fprintf(stderr, "zlib returned error: %d\n", z_ret);
+		return NULL;
+	}
+
+	out = strbuf_new();
+	strbuf_setopt(out, STRBUF_NULLOK);
+	strbuf_reserve(out, buf->len / 8 + GZIP_START);
+
+	in = buf->data;
+	left = buf->len;
+	do {
+		size_t room;
+
+		if (strm.avail_in == 0) {
+			strm.avail_in = (uInt)(left > GZIP_CHUNK ? GZIP_CHUNK : left);
+			strm.next_in  = (Bytef *)in;
+			in   += strm.avail_in;
+			left -= strm.avail_in;
+		}
+
+		if (out->buf_sz - out->len < GZIP_START)
+			strbuf_reserve(out, out->buf_sz);
+		room = out->buf_sz - out->len - 1;
+		if (room > GZIP_CHUNK)
+			room = GZIP_CHUNK;
+		strm.next_out  = (Bytef *)(out->data + out->len);
+		strm.avail_out = (uInt)room;
+
+		z_ret = deflate(&strm, left || strm.avail_in ? Z_NO_FLUSH : Z_FINISH);
+		out->len += room - strm.avail_out;
+	} while (z_ret == Z_OK);
+	(void)deflateEnd(&strm);
+
+	out->data[out->len] = '\0';
+	if (z_ret != Z_STREAM_END) {
+		fprintf(stderr, "zlib returned error: %d\n", z_ret);
+		strbuf_free(out);
+		return NULL;
+	}
+
+	return out;
+}
+
 static void strbuf_grow(STRBUF *buf)
 {
 	buf->buf_sz += strbuf_grow_sz;
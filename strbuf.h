@@ -49,12 +49,74 @@ size_t strbuf_append_n(STRBUF *buf, const char *str, size_t n);
  */
 size_t strbuf_append(STRBUF *buf, const char *str);
 
+/*
+ * Shortens the string buffer to len characters.  Does nothing if
+ * the contained string is not longer than len.
+ */
+void strbuf_truncate(STRBUF *buf, size_t len);
+
+/*
+ * Makes room for n more characters in the string buffer, so that
+ * appending them does not need to reallocate it.
+ */
+void strbuf_reserve(STRBUF *buf, size_t n);
+
+/*
+ * Exchanges the contents of two string buffers.  Their options are
+ * kept.
+ */
+void strbuf_swap(STRBUF *a, STRBUF *b);
+
 /*
  * Reads a zlib-compressed data stream from in and appends
- * it to the buffer out.  Returns the number of appended characters.
+ * it to the buffer out.  Returns the number of appended characters,
+ * or (size_t)-1 with errno set if the data is corrupted or
+ * truncated.  What has been inflated so far stays in the buffer.
  */
 size_t strbuf_append_inflate(STRBUF *buf, FILE *in);
 
+/*
+ * Like strbuf_append_inflate(), but gives up as soon as the inflated
+ * data exceeds the limits of inflate_exceeds().  Returns (size_t)-1
+ * with errno set to EFBIG in that case.
+ */
+size_t strbuf_append_inflate_max(STRBUF *buf, FILE *in, size_t max_len,
+				 unsigned long max_ratio);
+
+/*
+ * Reads up to len bytes from in into buf.  Returns their number, 0
+ * at the end of the data or -1 on errors.
+ */
+typedef long (*strbuf_read_fn)(void *in, char *buf, size_t len);
+
+/*
+ * Like strbuf_append_inflate_max(), but the compressed data comes
+ * from read_fn(), e.g. out of memory.
+ */
+size_t strbuf_append_inflate_fn(STRBUF *buf, strbuf_read_fn read_fn, void *in,
+				size_t max_len, unsigned long max_ratio);
+
+/*
+ * Returns a new buffer with the content of buf compressed in the
+ * gzip format at the given zlib level, or NULL if zlib fails.  The
+ * result may contain null bytes.
+ */
+STRBUF *strbuf_gzip(STRBUF *buf, int level);
+
+/*
+ * The compression ratio is only checked for data larger than this,
+ * as short runs of white space compress very well, too.
+ */
+#define INFLATE_RATIO_MIN (1024 * 1024)
+
+/*
+ * Returns whether out bytes inflated from in bytes are more than
+ * max_len bytes or more than max_ratio times as large as the
+ * compressed data.  0 means no limit.
+ */
+int inflate_exceeds(unsigned long out, unsigned long in, size_t max_len,
+		    unsigned long max_ratio);
+
 /*
  * Reads a data stream from in and appends it to the buffer out.
  * Returns the number of appended characters.
@@ -0,0 +1,79 @@
+/*
+ * bench-conv.c: Benchmarks of the conversion to the output encoding
+ *
+ * odt2txt.c is included to reach its static functions.
+ */
+
+#include "bench.h"
+
+#define main odt2txt_main
+#include "../odt2txt.c"
+#undef main
+
+static iconv_t bench_ic;
+
+static iconv_t bench_init_conv(void)
+{
+	iconv_t ic = init_conv("UTF-8", "ISO-8859-1");
+
+	if (ic == (iconv_t)-1)
+		exit(EXIT_FAILURE);
+	return ic;
+}
+
+static void *setup_text(size_t size)
+{
+	return bench_text(size);
+}
+
+static void cleanup_text(void *input)
+{
+	strbuf_free(input);
+}
+
+/*
+ * The text has characters which ISO-8859-1 lacks, so both the fast
+ * path of iconv() and the replacement of unknown characters are run.
+ */
+static void run_conv(void *input, size_t size)
+{
+	STRBUF *out;
+
+	(void)size;
+	if (!bench_ic)
+		bench_ic = bench_init_conv();
+	out = conv(bench_ic, input, NULL);
+	if (!out)
+		exit(EXIT_FAILURE);
+	bench_sink = strbuf_len(out);
+	strbuf_free(out);
+}
+
+/*
+ * The same with a mark every 64 bytes, as with --offsets.
+ */
+static void run_conv_marks(void *input, size_t size)
+{
+	struct regex_marks marks;
+	size_t i, n = size / 64;
+	STRBUF *out;
+
+	if (!bench_ic)
+		bench_ic = bench_init_conv();
+	marks.pos = ymalloc(n * sizeof(size_t));
+	marks.n = n;
+	for (i = 0; i < n; i++)
+		marks.pos[i] = i * 64;
+	out = conv(bench_ic, input, &marks);
+	if (!out)
+		exit(EXIT_FAILURE);
+	bench_sink = strbuf_len(out);
+	strbuf_free(out);
+	yfree(marks.pos);
+}
+
+const struct bench benchmarks[] = {
+	{ "conv",       setup_text, run_conv,       cleanup_text },
+	{ "conv/marks", setup_text, run_conv_marks, cleanup_text },
+	{ NULL, NULL, NULL, NULL }
+};
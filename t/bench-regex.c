@@ -0,0 +1,106 @@
+/*
+ * bench-regex.c: Benchmarks of regex_subst(), wrap() and
+ * charlen_utf8()
+ *
+ * regex.c is included to reach its static functions.
+ */
+
+#include "bench.h"
+
+#include "../regex.c"
+
+static void *setup_text(size_t size)
+{
+	return bench_text(size);
+}
+
+/*
+ * The text with a tag around every word, for patterns which rules.def
+ * does not list.
+ */
+static void *setup_tagged(size_t size)
+{
+	STRBUF *text = bench_text(size);
+	STRBUF *buf = strbuf_new();
+	const char *p = strbuf_get(text), *sp;
+
+	while ((sp = strchr(p, ' '))) {
+		strbuf_append(buf, "<text:span>");
+		strbuf_append_n(buf, p, (size_t)(sp - p));
+		strbuf_append(buf, "</text:span> ");
+		p = sp + 1;
+		if (strbuf_len(buf) >= size)
+			break;
+	}
+	strbuf_truncate(buf, size);
+	strbuf_free(text);
+	return buf;
+}
+
+static void cleanup_text(void *input)
+{
+	strbuf_free(input);
+}
+
+static STRBUF *copy(void *input)
+{
+	STRBUF *buf = strbuf_new();
+
+	strbuf_append_n(buf, strbuf_get(input), strbuf_len(input));
+	return buf;
+}
+
+/*
+ * A single match at the end of the text, as format_doc() trims it.
+ */
+static void run_subst_once(void *input, size_t size)
+{
+	STRBUF *buf = copy(input);
+
+	(void)size;
+	strbuf_append(buf, "\n\n\n");
+	bench_sink = (size_t)regex_subst(buf, "\n{2,}$", _REG_DEFAULT, "\n");
+	strbuf_free(buf);
+}
+
+static void run_subst_global(void *input, size_t size)
+{
+	STRBUF *buf = copy(input);
+
+	(void)size;
+	bench_sink = (size_t)regex_subst(buf, "&amp;", _REG_GLOBAL, "&");
+	strbuf_free(buf);
+}
+
+static void run_subst_regexec(void *input, size_t size)
+{
+	STRBUF *buf = copy(input);
+
+	(void)size;
+	bench_sink = (size_t)regex_subst(buf, "<[^>]*>", _REG_GLOBAL, "");
+	strbuf_free(buf);
+}
+
+static void run_wrap(void *input, size_t size)
+{
+	STRBUF *wbuf = wrap(input, 65);
+
+	(void)size;
+	bench_sink = strbuf_len(wbuf);
+	strbuf_free(wbuf);
+}
+
+static void run_charlen_utf8(void *input, size_t size)
+{
+	(void)size;
+	bench_sink = charlen_utf8(strbuf_get(input));
+}
+
+const struct bench benchmarks[] = {
+	{ "regex_subst/once",    setup_text,   run_subst_once,    cleanup_text },
+	{ "regex_subst/global",  setup_text,   run_subst_global,  cleanup_text },
+	{ "regex_subst/regexec", setup_tagged, run_subst_regexec, cleanup_text },
+	{ "wrap",                setup_text,   run_wrap,          cleanup_text },
+	{ "charlen_utf8",        setup_text,   run_charlen_utf8,  cleanup_text },
+	{ NULL, NULL, NULL, NULL }
+};
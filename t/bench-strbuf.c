@@ -0,0 +1,132 @@
+/*
+ * bench-strbuf.c: Benchmarks of the string buffer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "../mem.h"
+#include "../strbuf.h"
+#include "bench.h"
+
+static void *setup_text(size_t size)
+{
+	return bench_text(size);
+}
+
+static void cleanup_text(void *input)
+{
+	strbuf_free(input);
+}
+
+/*
+ * Appends the text in pieces of 1 to 64 bytes, as the formatter
+ * appends words and tags.
+ */
+static void run_append_n(void *input, size_t size)
+{
+	const char *text = strbuf_get(input);
+	STRBUF *buf = strbuf_new();
+	size_t off = 0, n = 0;
+
+	while (off < size) {
+		n = n % 64 + 1;
+		if (n > size - off)
+			n = size - off;
+		strbuf_append_n(buf, text + off, n);
+		off += n;
+	}
+	bench_sink = strbuf_len(buf);
+	strbuf_free(buf);
+}
+
+/*
+ * Replaces a byte every 256 bytes, front to back, alternately with
+ * two bytes and with none, as a loop over matches would.
+ */
+static void run_subst(void *input, size_t size)
+{
+	STRBUF *buf = strbuf_new();
+	size_t off;
+	int grow = 1;
+
+	strbuf_append_n(buf, strbuf_get(input), size);
+	for (off = 0; off + 1 < strbuf_len(buf); off += 256) {
+		strbuf_subst(buf, off, off + 1, grow ? "xy" : "");
+		grow = !grow;
+	}
+	bench_sink = strbuf_len(buf);
+	strbuf_free(buf);
+}
+
+/*
+ * The input of strbuf_append_inflate() is the text, deflated into a
+ * temporary file.
+ */
+static void *setup_inflate(size_t size)
+{
+	STRBUF *text = bench_text(size);
+	FILE *f = tmpfile();
+	unsigned char out[4096];
+	z_stream strm;
+	int z_ret;
+
+	if (!f) {
+		perror("tmpfile");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&strm, 0, sizeof(strm));
+	if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK)
+		exit(EXIT_FAILURE);
+	strm.next_in = (Bytef *)strbuf_get(text);
+	strm.avail_in = (uInt)strbuf_len(text);
+	do {
+		strm.next_out = out;
+		strm.avail_out = sizeof(out);
+		z_ret = deflate(&strm, Z_FINISH);
+		fwrite(out, 1, sizeof(out) - strm.avail_out, f);
+	} while (z_ret == Z_OK);
+	(void)deflateEnd(&strm);
+
+	strbuf_free(text);
+	return f;
+}
+
+static void run_inflate(void *input, size_t size)
+{
+	STRBUF *buf = strbuf_new();
+
+	rewind(input);
+	if (strbuf_append_inflate(buf, input) != size)
+		exit(EXIT_FAILURE);
+	bench_sink = strbuf_len(buf);
+	strbuf_free(buf);
+}
+
+static void cleanup_inflate(void *input)
+{
+	fclose(input);
+}
+
+static void run_gzip(void *input, size_t size)
+{
+	STRBUF *gz = strbuf_gzip(input, Z_DEFAULT_COMPRESSION);
+
+	(void)size;
+	if (!gz)
+		exit(EXIT_FAILURE);
+	bench_sink = strbuf_len(gz);
+	strbuf_free(gz);
+}
+
+const struct bench benchmarks[] = {
+	{ "strbuf_append_n",       setup_text,    run_append_n, cleanup_text },
+	{ "strbuf_subst",          setup_text,    run_subst,    cleanup_text },
+	{ "strbuf_append_inflate", setup_inflate, run_inflate,  cleanup_inflate },
+	{ "strbuf_gzip",           setup_text,    run_gzip,     cleanup_text },
+	{ NULL, NULL, NULL, NULL }
+};
@@ -0,0 +1,166 @@
+/*
+ * bench.c: Runs the microbenchmarks of a target on growing inputs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+/*
+ * Usage: t/bench-TARGET [-t ms] [-m bytes] [NAME...]
+ *
+ * Every benchmark, or the ones named, runs on inputs of 1 KB, 4 KB,
+ * 16 KB and so on up to bytes, 4 MB by default.  Each size is run as
+ * often as fits into ms milliseconds, 100 by default, and at least
+ * once.  A line per size shows the time per input byte and the
+ * allocations per operation.
+ *
+ * The last column is the exponent of the growth of the time per
+ * operation from the previous size: about 1 for linear behaviour and
+ * 2 for quadratic.  Exponents above 1.5 are marked with a "!", so
+ * that a super-linear slowdown stands out in the sweep.  Allocations
+ * are only counted when the code under test is compiled with
+ * MEMCOUNT, as the make target "bench" does.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../mem.h"
+#include "../strbuf.h"
+#include "bench.h"
+
+#define MIN_SIZE 1024
+
+static long opt_time = 100;		/* ms per size */
+static size_t opt_max = 4 << 20;	/* largest input */
+
+volatile size_t bench_sink;
+
+STRBUF *bench_text(size_t size)
+{
+	static const char *const words[] = {
+		"the", "document", "is", "a", "text", "with", "some",
+		"longer", "paragraphs", "and", "short", "ones", "&amp;",
+		"Stra\xc3\x9f" "e", "caf\xc3\xa9", "\xe2\x80\x94",
+		"\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e", "internationalization",
+	};
+	const size_t nwords = sizeof(words) / sizeof(words[0]);
+	STRBUF *buf = strbuf_new();
+	unsigned long seed = 1;
+	size_t len;
+
+	strbuf_reserve(buf, size + 32);
+	while (strbuf_len(buf) < size) {
+		seed = seed * 1103515245 + 12345;
+		strbuf_append(buf, words[(seed >> 16) % nwords]);
+		strbuf_append(buf, (seed >> 8) % 16 ? " " : "\n\n");
+	}
+
+	/* cut at a character boundary, then fill up with spaces */
+	len = size;
+	while (len > 0 && ((unsigned char)strbuf_get(buf)[len] & 0xC0) == 0x80)
+		len--;
+	strbuf_truncate(buf, len);
+	while (len++ < size)
+		strbuf_append_n(buf, " ", 1);
+	return buf;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_bench(const struct bench *b)
+{
+	double prev_op = 0;
+	size_t size;
+
+	for (size = MIN_SIZE; size <= opt_max; size *= 4) {
+		void *input = b->setup(size);
+		unsigned long allocs, ops = 0;
+		double start, end, op;
+
+#if defined(MEMCOUNT) && !defined(MEMDEBUG)
+		allocs = mem_allocs;
+#endif
+		start = end = now();
+		while (ops == 0 || end - start < opt_time / 1000.0) {
+			b->run(input, size);
+			ops++;
+			end = now();
+		}
+		op = (end - start) / ops;
+
+		printf("%-28s %9lu B %9.2f ns/B", size == MIN_SIZE ? b->name : "",
+		       (unsigned long)size, op * 1e9 / size);
+#if defined(MEMCOUNT) && !defined(MEMDEBUG)
+		printf(" %11.1f allocs/op", (double)(mem_allocs - allocs) / ops);
+#else
+		(void)allocs;
+		printf(" %11s allocs/op", "-");
+#endif
+		if (prev_op > 0 && op > 0) {
+			double e = log(op / prev_op) / log(4.0);
+
+			printf("   n^%.2f%s", e, e > 1.5 ? " !" : "");
+		}
+		printf("\n");
+		fflush(stdout);
+
+		prev_op = op;
+		b->cleanup(input);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-t ms] [-m bytes] [NAME...]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	const struct bench *b;
+	int c, i, found = 0;
+
+	while ((c = getopt(argc, argv, "t:m:")) != -1) {
+		switch (c) {
+		case 't':
+			opt_time = atol(optarg);
+			break;
+		case 'm':
+			opt_max = (size_t)atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	for (b = benchmarks; b->name; b++) {
+		if (optind < argc) {
+			for (i = optind; i < argc; i++) {
+				if (!strcmp(argv[i], b->name))
+					break;
+			}
+			if (i == argc)
+				continue;
+		}
+		run_bench(b);
+		found = 1;
+	}
+
+	if (!found) {
+		fprintf(stderr, "%s: no such benchmark\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
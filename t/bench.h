@@ -0,0 +1,47 @@
+/*
+ * bench.h: Interface between the benchmarks and t/bench.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+
+#include "../strbuf.h"
+
+struct bench {
+	const char *name;
+
+	/* returns the input of size bytes */
+	void *(*setup)(size_t size);
+
+	/* runs one operation on the input, which it must not change */
+	void (*run)(void *input, size_t size);
+
+	void (*cleanup)(void *input);
+};
+
+/*
+ * The benchmarks of a target, up to an entry without a name.  Each
+ * t/bench-*.c defines this array.
+ */
+extern const struct bench benchmarks[];
+
+/*
+ * Returns size bytes of text which looks like a formatted document:
+ * words of different lengths, some of them non-ascii or wide, and
+ * paragraphs.  The text is the same on every call.
+ */
+STRBUF *bench_text(size_t size);
+
+/*
+ * Keeps the compiler from dropping a computation whose result is not
+ * used otherwise.
+ */
+extern volatile size_t bench_sink;
+
+#endif /* BENCH_H */
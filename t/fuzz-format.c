@@ -0,0 +1,48 @@
+/*
+ * fuzz-format.c: Fuzz target for the formatting of odt2txt
+ *
+ * The input is a document in memory, a package or flat XML, which
+ * is converted like odt2txt does with a file.  odt2txt.c is included
+ * to reach its static functions.
+ */
+
+#include "fuzz.h"
+
+#define main odt2txt_main
+#include "../odt2txt.c"
+#undef main
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+	static iconv_t ic;
+	static int init;
+	struct anchors an;
+	STRBUF *outbuf;
+	size_t i;
+
+	if (!init) {
+		ic = init_conv("UTF-8", "UTF-8");
+		if (ic == (iconv_t)-1 || init_subst(ic) == -1)
+			exit(EXIT_FAILURE);
+		(void)init_skip();
+		init = 1;
+	}
+
+	/* every other input also gets the sections behind the text */
+	opt_sections = size & 1 ? SECTION_PAGES | SECTION_NOTES : 0;
+
+	/* broken documents fail without exiting */
+	outbuf = convert_buffer(ic, (const char *)data, size, &an, NULL);
+	if (outbuf) {
+		/* the anchors of --offsets point into the text, in order */
+		for (i = 0; i < an.marks.n; i++) {
+			if (an.marks.pos[i] >= strbuf_len(outbuf) ||
+			    (i && an.marks.pos[i] < an.marks.pos[i - 1]))
+				abort();
+		}
+		strbuf_free(outbuf);
+	}
+	anchors_free(&an);
+
+	return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * fuzz-kunzip.c: Fuzz target for kunzip
+ *
+ * The input is a zip archive.  content.xml is read once as a whole
+ * and once piece by piece from a file, the way odt2txt reads it, and
+ * once more from memory, the way it reads packages from stdin.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../mem.h"
+#include "../strbuf.h"
+#include "../kunzip/kunzip.h"
+#include "fuzz.h"
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+	char name[] = "/tmp/fuzz-kunzip-XXXXXX";
+	KUNZIP_ARCHIVE *zip;
+	KUNZIP_ENTRY *entry;
+	STRBUF *buf;
+	char readbuf[4096];
+	off_t offset;
+	int fd;
+
+	/* kunzip only reads from files */
+	fd = mkstemp(name);
+	if (fd == -1 || write(fd, data, size) != (ssize_t)size) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	offset = kunzip_get_offset_by_name(name, "content.xml", 3, -1);
+	if (offset != -1) {
+		entry = kunzip_entry_open(name, offset);
+		if (entry) {
+			while (kunzip_entry_read(entry, readbuf,
+						 sizeof(readbuf)) > 0)
+				;
+			kunzip_entry_close(entry);
+		}
+
+		buf = kunzip_next_tobuf(name, offset);
+		if (buf)
+			strbuf_free(buf);
+	}
+
+	unlink(name);
+
+	zip = kunzip_open_mem((const char *)data, size);
+	if (zip) {
+		offset = kunzip_archive_offset_by_name(zip, "content.xml",
+						       3, -1);
+		if (offset != -1) {
+			buf = kunzip_archive_tobuf(zip, offset);
+			if (buf)
+				strbuf_free(buf);
+		}
+		kunzip_close(zip);
+	}
+	return 0;
+}
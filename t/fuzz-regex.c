@@ -0,0 +1,53 @@
+/*
+ * fuzz-regex.c: Fuzz target for regex_subst()
+ *
+ * The first byte of the input selects a rule, the rest is the text.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mem.h"
+#include "../strbuf.h"
+#include "../regex.h"
+#include "fuzz.h"
+
+static const struct {
+	const char *regex;
+	int opt;
+	const void *subst;
+} rules[] = {
+	{ "<[^>]*>",                         _REG_GLOBAL, ""            },
+	{ "<text:s/>",                       _REG_GLOBAL, " "           },
+	{ "<text:tab/>",                     _REG_GLOBAL, "        "    },
+	{ "\n +",                            _REG_GLOBAL, "\n"          },
+	{ "\n{3,}",                          _REG_GLOBAL, "\n\n"        },
+	{ "&amp;",                           _REG_GLOBAL, "&"           },
+	{ "<text:p[^>]*>",                   _REG_GLOBAL, "\n\n"        },
+	{ "x*",                              _REG_GLOBAL, "y"           },
+	{ "^\n+",                            _REG_DEFAULT, ""           },
+	{ "\n{2,}$",                         _REG_DEFAULT, "\n"         },
+	{ "<text:h[^>]*>([^<]*)<[^>]*>",     _REG_EXEC | _REG_GLOBAL, &h2 },
+	{ "<draw:frame[^>]*draw:name=\"([^\"]*)\"[^>]*>",
+	                                     _REG_EXEC | _REG_GLOBAL, &image },
+};
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+	STRBUF *buf;
+	size_t i;
+
+	if (size < 1)
+		return 0;
+
+	i = data[0] % (sizeof(rules) / sizeof(rules[0]));
+
+	buf = strbuf_new();
+	strbuf_append_n(buf, (const char *)data + 1, size - 1);
+	(void)regex_subst(buf, rules[i].regex, rules[i].opt,
+			  rules[i].subst);
+	strbuf_free(buf);
+
+	return 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * fuzz-wrap.c: Fuzz target for wrap()
+ *
+ * The first byte of the input selects the width, the rest is the
+ * text.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mem.h"
+#include "../strbuf.h"
+#include "../regex.h"
+#include "fuzz.h"
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+	STRBUF *buf, *wbuf;
+	int width;
+
+	if (size < 1)
+		return 0;
+
+	width = data[0] % 100 - 1;
+
+	buf = strbuf_new();
+	strbuf_append_n(buf, (const char *)data + 1, size - 1);
+	wbuf = wrap(buf, width);
+	strbuf_free(wbuf);
+	strbuf_free(buf);
+
+	return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * fuzz-zipstream.c: Fuzz target for zipstream
+ *
+ * The input is a zip archive, which is read front to back like a
+ * package on stdin.  Every file is read up to content.xml.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../zipstream.h"
+#include "fuzz.h"
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+	FILE *in;
+	ZIPSTREAM *zs;
+	const char *name;
+	char readbuf[4096];
+
+	if (size == 0)
+		return 0;
+
+	in = fmemopen((void *)data, size, "rb");
+	if (!in) {
+		perror("fmemopen");
+		exit(EXIT_FAILURE);
+	}
+
+	zs = zipstream_open(in);
+	while (zipstream_next(zs, &name) == 1) {
+		if (strcmp(name, "content.xml"))
+			continue;
+		while (zipstream_read(zs, readbuf, sizeof(readbuf)) > 0)
+			;
+		break;
+	}
+	zipstream_close(zs);
+
+	fclose(in);
+	return 0;
+}
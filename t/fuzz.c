@@ -0,0 +1,343 @@
+/*
+ * fuzz.c: Runs a fuzz target with time and memory budgets
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+/*
+ * Usage: t/fuzz-TARGET [-v] [-t ms] [-m MB] [-n runs] [-l bytes]
+ *                      [-s seed] [-o dir] FILE|DIR...
+ *
+ * Every input from the given files and directories is run in a child
+ * process.  An input fails if it crashes, takes more than ms
+ * milliseconds of cpu time or uses more than MB megabytes.  The child
+ * is killed after four times the time budget, so hangs fail as well.
+ * -v prints the time of every input.
+ *
+ * With -n, the inputs are used as seeds for runs random mutations,
+ * which grow up to a maximum of bytes.  Failing mutations are saved
+ * to dir, $TMPDIR or /tmp by default, so that they can be added to
+ * the corpus in t/corpus/.
+ *
+ * Inputs may be gzip-compressed, which keeps the large ones in the
+ * corpus small.  A DEBUG build looks up every allocation in a list
+ * and takes far longer, so it only fails on inputs which hang.  A target which exits with an error message is not a
+ * failure, malformed input is expected to be rejected.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../mem.h"
+#include "../strbuf.h"
+#include "fuzz.h"
+
+static long opt_time = 500;       /* ms of cpu time per input */
+static long opt_mem = 256;        /* MB of address space, 0 for no limit */
+static long opt_runs = 0;         /* number of mutations */
+static size_t opt_len = 1 << 20;  /* maximal size of a mutation */
+static const char *opt_out = NULL; /* dir of failing mutations */
+static int opt_verbose = 0;
+
+#ifdef MEMDEBUG
+#  define TIME_SCALE 1000
+#else
+#  define TIME_SCALE 1
+#endif
+
+struct input {
+	char *name;
+	STRBUF *data;
+};
+
+static struct input *inputs;
+static size_t ninputs;
+
+static void add_input(const char *name)
+{
+	gzFile in;
+	STRBUF *data;
+	char buf[4096];
+	int r;
+
+	/* large inputs are stored compressed, gzread() reads both */
+	in = gzopen(name, "rb");
+	if (!in) {
+		fprintf(stderr, "Can't open %s: %s\n", name, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	data = strbuf_new();
+	strbuf_setopt(data, STRBUF_NULLOK);
+	while ((r = gzread(in, buf, sizeof(buf))) > 0)
+		strbuf_append_n(data, buf, (size_t)r);
+	if (r < 0) {
+		fprintf(stderr, "Can't read %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+	gzclose(in);
+
+	inputs = yrealloc(inputs, sizeof(struct input) * (ninputs + 1));
+	inputs[ninputs].name = ymalloc(strlen(name) + 1);
+	strcpy(inputs[ninputs].name, name);
+	inputs[ninputs].data = data;
+	ninputs++;
+}
+
+static void add_path(const char *path)
+{
+	struct stat st;
+	struct dirent *de;
+	DIR *dir;
+	char *name;
+
+	if (stat(path, &st) == -1) {
+		fprintf(stderr, "Can't stat %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		add_input(path);
+		return;
+	}
+
+	dir = opendir(path);
+	if (!dir) {
+		fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.')
+			continue;
+		name = ymalloc(strlen(path) + strlen(de->d_name) + 2);
+		sprintf(name, "%s/%s", path, de->d_name);
+		add_input(name);
+		yfree(name);
+	}
+	closedir(dir);
+}
+
+/*
+ * Runs data in a child process.  Returns NULL if it stayed in its
+ * budgets, or a description of the failure.
+ */
+static const char *run(const unsigned char *data, size_t size, long *ms)
+{
+	static char why[64];
+	struct rusage ru;
+	pid_t pid;
+	int status;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+
+	if (pid == 0) {
+		struct itimerval it;
+		long kill_ms = opt_time * TIME_SCALE * 4;
+
+		if (opt_mem > 0) {
+			struct rlimit rl;
+			rl.rlim_cur = rl.rlim_max = (rlim_t)opt_mem << 20;
+			(void)setrlimit(RLIMIT_AS, &rl);
+		}
+
+		memset(&it, 0, sizeof(it));
+		it.it_value.tv_sec = kill_ms / 1000;
+		it.it_value.tv_usec = (kill_ms % 1000) * 1000;
+		(void)setitimer(ITIMER_REAL, &it, NULL);
+
+		(void)freopen("/dev/null", "w", stdout);
+		(void)LLVMFuzzerTestOneInput(data, size);
+		_exit(EXIT_SUCCESS);
+	}
+
+	if (wait4(pid, &status, 0, &ru) == -1) {
+		perror("wait4");
+		exit(EXIT_FAILURE);
+	}
+
+	*ms = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000 +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000;
+
+	if (WIFSIGNALED(status)) {
+		if (WTERMSIG(status) == SIGALRM)
+			return "timeout";
+		sprintf(why, "killed by signal %d", WTERMSIG(status));
+		return why;
+	}
+	if (*ms > opt_time * TIME_SCALE)
+		return "over time budget";
+	if (opt_mem > 0 && ru.ru_maxrss / 1024 > opt_mem)
+		return "over memory budget";
+
+	return NULL;
+}
+
+/*
+ * Changes buf in one of a few random ways.  Repeating a chunk
+ * makes inputs grow, which is what uncovers quadratic behaviour.
+ */
+static void mutate(STRBUF *buf)
+{
+	STRBUF *tmp = strbuf_new();
+	const char *data = strbuf_get(buf);
+	size_t len = strbuf_len(buf);
+	size_t pos = len ? (size_t)rand() % len : 0;
+	size_t n = len - pos ? (size_t)rand() % (len - pos) + 1 : 0;
+	unsigned char c = (unsigned char)rand();
+	int i, times;
+
+	strbuf_setopt(tmp, STRBUF_NULLOK);
+	strbuf_append_n(tmp, data, pos);
+
+	switch (rand() % 5) {
+	case 0:		/* replace a byte */
+		strbuf_append_n(tmp, (char *)&c, 1);
+		if (pos < len)
+			pos++;
+		break;
+	case 1:		/* insert a byte */
+		strbuf_append_n(tmp, (char *)&c, 1);
+		break;
+	case 2:		/* remove a chunk */
+		pos += n;
+		break;
+	case 3:		/* repeat a chunk */
+		times = rand() % 64 + 1;
+		for (i = 0; i < times && strbuf_len(tmp) + n < opt_len; i++)
+			strbuf_append_n(tmp, data + pos, n);
+		break;
+	default:	/* splice in another input */
+		if (ninputs > 0) {
+			STRBUF *other = inputs[(size_t)rand() % ninputs].data;
+			strbuf_append_n(tmp, strbuf_get(other),
+					strbuf_len(other) / 2);
+		}
+		break;
+	}
+
+	strbuf_append_n(tmp, data + pos, len - pos);
+	if (strbuf_len(tmp) > opt_len)
+		strbuf_truncate(tmp, opt_len);
+
+	strbuf_swap(buf, tmp);
+	strbuf_free(tmp);
+}
+
+static void save(STRBUF *buf)
+{
+	char *name;
+	FILE *out;
+	unsigned int crc = strbuf_crc32(buf);
+
+	name = ymalloc(strlen(opt_out) + 16);
+	sprintf(name, "%s/slow-%08x", opt_out, crc);
+
+	out = fopen(name, "wb");
+	if (!out || fwrite(strbuf_get(buf), 1, strbuf_len(buf), out)
+	    != strbuf_len(buf)) {
+		fprintf(stderr, "Can't write %s: %s\n", name, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	fclose(out);
+
+	printf("saved %s\n", name);
+	yfree(name);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-v] [-t ms] [-m MB] [-n runs] [-l bytes] "
+		"[-s seed] [-o dir] FILE|DIR...\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	const char *why;
+	long ms;
+	size_t i;
+	int c, failed = 0;
+
+	srand(1);
+	while ((c = getopt(argc, argv, "t:m:n:l:s:o:v")) != -1) {
+		switch (c) {
+		case 't': opt_time = atol(optarg);            break;
+		case 'm': opt_mem = atol(optarg);             break;
+		case 'n': opt_runs = atol(optarg);            break;
+		case 'l': opt_len = (size_t)atol(optarg);     break;
+		case 's': srand((unsigned int)atol(optarg));  break;
+		case 'o': opt_out = optarg;                   break;
+		case 'v': opt_verbose = 1;                    break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind == argc || opt_time <= 0)
+		usage(argv[0]);
+	if (!opt_out && !(opt_out = getenv("TMPDIR")))
+		opt_out = "/tmp";
+
+	for (; optind < argc; optind++)
+		add_path(argv[optind]);
+
+	for (i = 0; i < ninputs; i++) {
+		STRBUF *data = inputs[i].data;
+
+		why = run((const unsigned char *)strbuf_get(data),
+			  strbuf_len(data), &ms);
+		if (why) {
+			printf("FAIL %s: %s (%ld ms)\n", inputs[i].name, why, ms);
+			failed++;
+		} else if (opt_verbose)
+			printf("ok %s (%ld ms)\n", inputs[i].name, ms);
+	}
+
+	for (; opt_runs > 0 && ninputs > 0; opt_runs--) {
+		STRBUF *buf = strbuf_new();
+		STRBUF *seed = inputs[(size_t)rand() % ninputs].data;
+		int n = rand() % 8 + 1;
+
+		strbuf_setopt(buf, STRBUF_NULLOK);
+		strbuf_append_n(buf, strbuf_get(seed), strbuf_len(seed));
+		while (n--)
+			mutate(buf);
+
+		why = run((const unsigned char *)strbuf_get(buf),
+			  strbuf_len(buf), &ms);
+		if (why) {
+			printf("FAIL mutation of %lu bytes: %s (%ld ms)\n",
+			       (unsigned long)strbuf_len(buf), why, ms);
+			save(buf);
+			failed++;
+		}
+		strbuf_free(buf);
+	}
+
+	printf("%s: %lu inputs, %d failed\n", argv[0],
+	       (unsigned long)ninputs, failed);
+
+	for (i = 0; i < ninputs; i++) {
+		yfree(inputs[i].name);
+		strbuf_free(inputs[i].data);
+	}
+	if (inputs)
+		yfree(inputs);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
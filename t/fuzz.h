@@ -0,0 +1,22 @@
+/*
+ * fuzz.h: Interface between the fuzz targets and t/fuzz.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stddef.h>
+
+/*
+ * Runs one input through the code under test.  Each t/fuzz-*.c
+ * defines this function.  The name is the one libFuzzer expects, so
+ * a target can also be linked with -fsanitize=fuzzer instead of
+ * t/fuzz.o.
+ */
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size);
+
+#endif /* FUZZ_H */
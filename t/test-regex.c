@@ -11,6 +11,7 @@
 int main(int argc, char **argv)
 {
 	STRBUF *buf;
+	STRBUF *wbuf;
 	char *test1 = "When shall we three meet again?";
 	char *test2 = "In thunder, lightning, or in rain?";
 	char *test3 =
@@ -75,6 +76,106 @@ int main(int argc, char **argv)
 	assert(!strcmp(c, ""));
 	yfree(c);
 
+	/* wrap 1: trailing spaces are removed */
+	buf = strbuf_new();
+	strbuf_append(buf, "aaa bbb  \nccc \n");
+	wbuf = wrap(buf, 5);
+	assert(!strcmp(strbuf_get(wbuf), "\naaa\nbbb\nccc\n\n"));
+	strbuf_free(wbuf);
+	wbuf = wrap(buf, -1);
+	assert(!strcmp(strbuf_get(wbuf), "aaa bbb\nccc\n"));
+	strbuf_free(wbuf);
+	strbuf_free(buf);
+
+	/* wrap 2: wide characters take two columns */
+	buf = strbuf_new();
+	strbuf_append(buf, "\xe6\x97\xa5\xe6\x9c\xac \xe6\x97\xa5\xe6\x9c\xac "
+		      "\xe6\x97\xa5\xe6\x9c\xac\n");
+	wbuf = wrap(buf, 8);
+	assert(!strcmp(strbuf_get(wbuf), "\n\xe6\x97\xa5\xe6\x9c\xac "
+		       "\xe6\x97\xa5\xe6\x9c\xac\n\xe6\x97\xa5\xe6\x9c\xac\n\n"));
+	strbuf_free(wbuf);
+	strbuf_free(buf);
+
+	/* tokens: words split at spaces and punctuation, lowercased */
+	{
+		struct text_counts counts = { 0, 0, 0 };
+		const char *text = "Der Stra\xc3\x9f" "e-Name\n\n\xc3\x84RGER, "
+			"\xd0\x94om\xe2\x80\x94x\nb";
+
+		buf = strbuf_new();
+		tokenize_n(buf, text, strlen(text), TOKENS_LOWER | TOKENS_LENGTH,
+			   1, &counts);
+		assert(!strcmp(strbuf_get(buf), "3 der\n6 stra\xc3\x9f" "e\n"
+			       "4 name\n5 \xc3\xa4rger\n3 \xd0\xb4om\n1 x\n1 b\n"));
+		assert(counts.words == 7 && counts.chars == 28 &&
+		       counts.paras == 2);
+		strbuf_free(buf);
+
+		/* the same counts in two parts, split behind a line feed */
+		memset(&counts, 0, sizeof(counts));
+		tokenize_n(NULL, text, 18, TOKENS_COUNT, 1, &counts);
+		tokenize_n(NULL, text + 18, strlen(text) - 18, TOKENS_COUNT,
+			   1, &counts);
+		assert(counts.words == 7 && counts.chars == 28 &&
+		       counts.paras == 2);
+	}
+
+	/* deadline: nothing is replaced once it has passed */
+	{
+		struct timespec deadline;
+
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += 3600;
+		regex_set_deadline(&deadline);
+		buf = strbuf_new();
+		strbuf_append(buf, "a1b2c3");
+		assert(3 == regex_rm(buf, "[0-9]", _REG_GLOBAL));
+		assert(!regex_deadline_passed());
+
+		deadline.tv_sec -= 7200;
+		assert(regex_deadline_passed());
+		assert(0 == regex_rm(buf, "[a-z]", _REG_GLOBAL));
+		assert(!strcmp(strbuf_get(buf), "abc"));
+		strbuf_free(buf);
+		regex_set_deadline(NULL);
+		assert(!regex_deadline_passed());
+	}
+
+	/* marks follow the text through replacements */
+	{
+		size_t pos[] = { 0, 3, 4, 9, 12 };
+		struct regex_marks marks = { pos, 5 };
+		size_t at[] = { 1 };
+
+		regex_set_marks(&marks);
+		buf = strbuf_new();
+		strbuf_append(buf, "ab <x>cd <yy>e");
+		assert(2 == regex_rm(buf, "<[^>]*>", _REG_GLOBAL));
+		assert(!strcmp(strbuf_get(buf), "ab cd e"));
+		assert(pos[0] == 0 && pos[1] == 3 && pos[2] == 3 &&
+		       pos[3] == 6 && pos[4] == 6);
+
+		assert(1 == regex_subst(buf, " cd", _REG_GLOBAL, "\n\ncd"));
+		assert(pos[0] == 0 && pos[1] == 2 && pos[4] == 7);
+
+		regex_move_marks(at, 1, 3);
+		assert(pos[0] == 0 && pos[1] == 4 && pos[4] == 9);
+		strbuf_free(buf);
+		regex_set_marks(NULL);
+	}
+
+	/* patterns from rules.def, unless built with NO_DFA */
+	buf = strbuf_new();
+	strbuf_append(buf, "\n\na&amp;amp;b\n\n\nc\xC2\xA0" "d\n\n\n");
+	assert(1 == regex_rm(buf, "^\n+", _REG_GLOBAL));
+	assert(2 == regex_subst(buf, "&amp;", _REG_GLOBAL, "&"));
+	assert(1 == regex_subst(buf, "\xC2\xA0", _REG_GLOBAL, " "));
+	assert(1 == regex_subst(buf, "\n{2,}$", _REG_DEFAULT, "\n"));
+	assert(!strcmp(strbuf_get(buf), "a&b\n\n\nc d\n"));
+	assert(0 == regex_rm(buf, "^\n+", _REG_GLOBAL));
+	assert(0 == regex_subst(buf, "\n{2,}$", _REG_DEFAULT, "\n"));
+	strbuf_free(buf);
 
 	printf("ALL HAPPY\n");
 	return(EXIT_SUCCESS);
@@ -0,0 +1,118 @@
+/*
+ * test-ring.c: Tests of the producer/consumer RING
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifndef NO_PTHREADS
+#  include <pthread.h>
+#endif
+
+#include "../ring.h"
+
+#ifndef NO_PTHREADS
+
+struct producer {
+	RING *ring;
+	size_t blocksz;
+	size_t nblocks;
+	int slow;	/* let the consumer wait for every block */
+};
+
+/*
+ * Block i has a length of 1 to blocksz bytes, all of them the low
+ * byte of i.
+ */
+static size_t block_len(size_t i, size_t blocksz)
+{
+	return i * 7 % blocksz + 1;
+}
+
+static void *produce(void *arg)
+{
+	struct producer *p = arg;
+	size_t i, len;
+	char *block;
+
+	for (i = 0; i < p->nblocks; i++) {
+		block = ring_get_free(p->ring);
+		assert(block);
+		len = block_len(i, p->blocksz);
+		memset(block, (int)(i & 0xff), len);
+		ring_put(p->ring, len);
+		if (p->slow)
+			usleep(100);
+	}
+	ring_close(p->ring);
+	return NULL;
+}
+
+/*
+ * Passes nblocks blocks through a ring of nslots slots and checks
+ * that they arrive complete and in order, followed by NULL.  A slow
+ * producer makes the consumer wait for blocks, a slow consumer makes
+ * the producer wait for free slots.
+ */
+static void pass_blocks(size_t nslots, size_t blocksz, size_t nblocks,
+			int slow_producer, int slow_consumer)
+{
+	struct producer p;
+	pthread_t thread;
+	const char *block;
+	size_t i = 0, len, k;
+
+	p.ring = ring_new(nslots, blocksz);
+	p.blocksz = blocksz;
+	p.nblocks = nblocks;
+	p.slow = slow_producer;
+	assert(!pthread_create(&thread, NULL, produce, &p));
+
+	while ((block = ring_get(p.ring, &len))) {
+		assert(i < nblocks);
+		assert(len == block_len(i, blocksz));
+		for (k = 0; k < len; k++)
+			assert((unsigned char)block[k] == (i & 0xff));
+		if (slow_consumer)
+			usleep(100);
+		ring_release(p.ring);
+		i++;
+	}
+	assert(i == nblocks);
+
+	/* it stays at the end */
+	assert(!ring_get(p.ring, &len));
+
+	assert(!pthread_join(thread, NULL));
+	ring_free(p.ring);
+}
+
+int main(int argc, char **argv)
+{
+	/* many more blocks than slots */
+	pass_blocks(4, 64, 1000, 0, 0);
+	pass_blocks(4, 64, 100, 1, 0);
+	pass_blocks(4, 64, 100, 0, 1);
+	pass_blocks(1, 16, 300, 0, 0);
+	pass_blocks(16, 65536, 200, 0, 0);
+
+	/* exactly full, and nothing at all */
+	pass_blocks(8, 32, 8, 0, 1);
+	pass_blocks(8, 32, 0, 0, 0);
+
+	printf("ALL HAPPY\n");
+	return(EXIT_SUCCESS);
+}
+
+#else
+
+int main(int argc, char **argv)
+{
+	/* the ring is only built with thread support */
+	printf("ALL HAPPY\n");
+	return(EXIT_SUCCESS);
+}
+
+#endif
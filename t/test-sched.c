@@ -0,0 +1,172 @@
+/*
+ * test-sched.c: Tests of the memory budget of SCHED
+ *
+ * sched.c is included to look at its accounting when it is done.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../mem.h"
+
+/*
+ * sched_run() frees the batch after the last job, when no memory
+ * may be left running or reserved, also that of the jobs which were
+ * stolen while their worker waited for them.
+ */
+static void check_done(void *p);
+
+static void free_checked(void *p)
+{
+	check_done(p);
+	yfree(p);
+}
+
+#undef yfree
+#define yfree(p) free_checked(p)
+
+#include "../sched.c"
+
+struct job {
+	size_t size;
+	int runs;
+};
+
+static SCHED *cur;		/* the batch being run */
+static size_t budget;
+static size_t unstarted;	/* bytes of the jobs not started yet */
+static size_t inflight;		/* bytes of the running jobs */
+static size_t peak;
+static int nrunning;
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+#  define LOCK()   pthread_mutex_lock(&lock)
+#  define UNLOCK() pthread_mutex_unlock(&lock)
+#else
+#  define LOCK()
+#  define UNLOCK()
+#endif
+
+static void run_job(void *p)
+{
+	struct job *job = p;
+
+	LOCK();
+	job->runs++;
+	unstarted -= job->size;
+	inflight += job->size;
+	nrunning++;
+	if (inflight > peak)
+		peak = inflight;
+
+	/* several jobs only run together within the budget, and a
+	   larger job only alone */
+	if (budget && nrunning > 1)
+		assert(inflight <= budget);
+	if (budget && job->size > budget)
+		assert(nrunning == 1);
+
+	UNLOCK();
+
+	/* long enough for the others to start or steal their jobs */
+	usleep((useconds_t)(job->size * 20));
+
+	LOCK();
+	if (budget && job->size > budget)
+		assert(nrunning == 1);
+	inflight -= job->size;
+	nrunning--;
+	UNLOCK();
+}
+
+static void check_done(void *p)
+{
+#ifndef NO_PTHREADS
+	if (p == cur)
+		assert(!cur->left && !cur->nrunning && !cur->running &&
+		       !cur->reserved);
+#endif
+}
+
+/*
+ * Runs the jobs of the given sizes on workers threads and checks
+ * that each one has run exactly once.  Returns the peak memory.
+ */
+static size_t run_batch(int workers, size_t b, const size_t *sizes,
+			size_t n)
+{
+	struct job *jobs = n ? ymalloc(sizeof(struct job) * n) : NULL;
+	size_t i;
+
+	budget = b;
+	unstarted = 0;
+	peak = 0;
+	cur = sched_new(workers, budget);
+	for (i = 0; i < n; i++) {
+		jobs[i].size = sizes[i];
+		jobs[i].runs = 0;
+		unstarted += sizes[i];
+		sched_add(cur, &jobs[i], sizes[i]);
+	}
+	sched_run(cur, run_job);
+
+	for (i = 0; i < n; i++)
+		assert(jobs[i].runs == 1);
+	assert(unstarted == 0 && inflight == 0 && nrunning == 0);
+	if (jobs)
+		yfree(jobs);
+	return peak;
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t mixed[] = {
+		70, 40, 30, 5, 60, 5, 10, 45, 20, 5, 35, 15, 5, 50, 25
+	};
+	static const size_t oversized[] = {
+		10, 250, 20, 30, 150, 10, 40
+	};
+	static const size_t equal[] = {
+		50, 50, 50, 50, 50, 50, 50, 50
+	};
+	size_t sizes[200];
+	size_t i;
+	int workers;
+
+	for (workers = 1; workers <= 4; workers++) {
+		/* within the budget */
+		assert(run_batch(workers, 100, mixed,
+				 sizeof(mixed) / sizeof(mixed[0])) <= 100);
+
+		/* the jobs which don't fit run alone */
+		assert(run_batch(workers, 100, oversized,
+				 sizeof(oversized) / sizeof(oversized[0]))
+		       == 250);
+
+		/* two at a time */
+		assert(run_batch(workers, 100, equal,
+				 sizeof(equal) / sizeof(equal[0])) <=
+		       (workers > 1 ? 100 : 50));
+
+		/* no limit */
+		assert(run_batch(workers, 0, mixed,
+				 sizeof(mixed) / sizeof(mixed[0])) <= 435);
+	}
+
+	/* many jobs which wait for each other and are stolen */
+	srand(1);
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		sizes[i] = (size_t)(rand() % 90) + 1;
+	assert(run_batch(4, 120, sizes, sizeof(sizes) / sizeof(sizes[0]))
+	       <= 120);
+
+	/* nothing to do */
+	assert(run_batch(4, 100, sizes, 0) == 0);
+
+	printf("ALL HAPPY\n");
+	return(EXIT_SUCCESS);
+}
@@ -3,13 +3,39 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <zlib.h>
 
 #include "../mem.h"
 #include "../strbuf.h"
 
+/*
+ * Inflates the gzip data in gz with zlib and compares it to the
+ * len bytes of expected.
+ */
+static void check_gunzip(STRBUF *gz, const char *expected, size_t len)
+{
+	z_stream strm;
+	char *out = ymalloc(len + 1);
+
+	memset(&strm, 0, sizeof(strm));
+	assert(inflateInit2(&strm, 15 + 16) == Z_OK);
+	strm.next_in = (Bytef *)strbuf_get(gz);
+	strm.avail_in = (uInt)strbuf_len(gz);
+	strm.next_out = (Bytef *)out;
+	strm.avail_out = (uInt)len + 1;
+	assert(inflate(&strm, Z_FINISH) == Z_STREAM_END);
+	assert(strm.total_out == len && strm.avail_in == 0);
+	assert(!memcmp(out, expected, len));
+	inflateEnd(&strm);
+	yfree(out);
+}
+
 int main(int argc, char **argv)
 {
 	STRBUF *buf;
+	STRBUF *wbuf;
+	size_t i;
+	int level;
 	char *test1 = "When shall we three meet again?";
 	char *test2 = "In thunder, lightning, or in rain?";
 	char *test3 =
@@ -74,10 +100,87 @@ int main(int argc, char **argv)
 	/* slurp */
 	c = ymalloc(strlen(test2) + 1);
 	memcpy(c, test2, strlen(test2) + 1);
-	buf = strbuf_create_slurp(c);
+	buf = strbuf_slurp(c);
 	assert(!strcmp(test2, strbuf_get(buf)));
 	strbuf_free(buf);
 
+	/* truncate, only ever shorter */
+	buf = strbuf_new();
+	strbuf_append(buf, test1);
+	strbuf_truncate(buf, 100);
+	assert(!strcmp(test1, strbuf_get(buf)));
+	strbuf_truncate(buf, 4);
+	assert(4 == strbuf_len(buf));
+	assert(!strcmp("When", strbuf_get(buf)));
+	strbuf_truncate(buf, 0);
+	assert(0 == strbuf_len(buf));
+	assert(!strcmp("", strbuf_get(buf)));
+	strbuf_free(buf);
+
+	/* reserve, then append without moving the data */
+	buf = strbuf_new();
+	strbuf_append(buf, test1);
+	strbuf_reserve(buf, 1000);
+	assert(buf->buf_sz >= strlen(test1) + 1000 + 1);
+	c = buf->data;
+	for (i = 0; i < 1000 / strlen(test2); i++)
+		strbuf_append(buf, test2);
+	assert(c == buf->data);
+	assert(!strncmp(test1, strbuf_get(buf), strlen(test1)));
+
+	/* which does nothing if there is room */
+	i = buf->buf_sz;
+	strbuf_reserve(buf, 1);
+	assert(i == buf->buf_sz);
+	strbuf_free(buf);
+
+	/* swap contents, but keep the options */
+	buf = strbuf_new();
+	wbuf = strbuf_new();
+	strbuf_setopt(wbuf, STRBUF_NULLOK);
+	strbuf_append(buf, test1);
+	strbuf_append(wbuf, test2);
+	strbuf_swap(buf, wbuf);
+	assert(!strcmp(test2, strbuf_get(buf)));
+	assert(!strcmp(test1, strbuf_get(wbuf)));
+	assert(!(buf->opt & STRBUF_NULLOK));
+	assert(wbuf->opt & STRBUF_NULLOK);
+	strbuf_swap(buf, wbuf);
+	assert(!strcmp(test1, strbuf_get(buf)));
+	strbuf_free(buf);
+	strbuf_free(wbuf);
+
+	/* gzip round trips, empty, short, and large enough for the
+	   output to grow several times */
+	buf = strbuf_new();
+	wbuf = strbuf_gzip(buf, Z_DEFAULT_COMPRESSION);
+	assert(wbuf);
+	check_gunzip(wbuf, "", 0);
+	strbuf_free(wbuf);
+
+	strbuf_append(buf, test3);
+	wbuf = strbuf_gzip(buf, 9);
+	assert(wbuf);
+	check_gunzip(wbuf, test3, strlen(test3));
+	strbuf_free(wbuf);
+
+	/* random bytes don't compress at all */
+	strbuf_truncate(buf, 0);
+	strbuf_setopt(buf, STRBUF_NULLOK);
+	srand(1);
+	for (i = 0; i < 300000; i++) {
+		char ch = (char)(rand() & 0xff);
+
+		strbuf_append_n(buf, &ch, 1);
+	}
+	for (level = 0; level <= 9; level += 9) {
+		wbuf = strbuf_gzip(buf, level);
+		assert(wbuf);
+		check_gunzip(wbuf, strbuf_get(buf), strbuf_len(buf));
+		strbuf_free(wbuf);
+	}
+	strbuf_free(buf);
+
 	printf("ALL HAPPY\n");
 	return(EXIT_SUCCESS);
 }
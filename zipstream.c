@@ -0,0 +1,434 @@
+/*
+ * zipstream.c: Read zip archives from a stream, e.g. a pipe
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "mem.h"
+#include "strbuf.h"
+#include "zipstream.h"
+
+#define ZS_BUF_SZ 65536  /* must hold the longest file name */
+
+#define SIG_LOCAL      0x04034b50
+#define SIG_DESCRIPTOR 0x08074b50
+#define SIG_CENTRAL    0x02014b50
+#define SIG_END        0x06054b50
+
+enum zs_state {
+	ZS_HEADER,   /* in front of a local header */
+	ZS_DATA,     /* in the data of a file */
+	ZS_END       /* at the central directory */
+};
+
+struct zipstream {
+	FILE *in;
+
+	/* input buffer, data which is not used yet stays in it */
+	unsigned char buf[ZS_BUF_SZ];
+	size_t pos;
+	size_t len;
+
+	enum zs_state state;
+
+	/* see zipstream_set_limits() */
+	size_t max_len;
+	unsigned long max_ratio;
+
+	/* the current file */
+	char *name;
+	int flags;
+	int method;
+	unsigned long crc;
+	uint64_t csize;
+	uint64_t consumed;       /* compressed bytes read so far */
+	int zip64;               /* the sizes in the descriptor have 8 bytes */
+	uLong checksum;
+	int done;
+	z_stream strm;
+};
+
+static unsigned long get_u32(const unsigned char *p)
+{
+	return (unsigned long)p[0] | (unsigned long)p[1] << 8 |
+		(unsigned long)p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static unsigned int get_u16(const unsigned char *p)
+{
+	return (unsigned int)p[0] | (unsigned int)p[1] << 8;
+}
+
+static uint64_t get_u64(const unsigned char *p)
+{
+	return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+/*
+ * Makes at least n bytes available at zs->buf + zs->pos.  Returns 0
+ * if the stream ends before.
+ */
+static int zs_need(ZIPSTREAM *zs, size_t n)
+{
+	size_t r;
+
+	if (zs->len - zs->pos >= n)
+		return 1;
+
+	memmove(zs->buf, zs->buf + zs->pos, zs->len - zs->pos);
+	zs->len -= zs->pos;
+	zs->pos = 0;
+
+	while (zs->len < n) {
+		r = fread(zs->buf + zs->len, 1, ZS_BUF_SZ - zs->len, zs->in);
+		if (r == 0)
+			return 0;
+		zs->len += r;
+	}
+	return 1;
+}
+
+static int zs_skip(ZIPSTREAM *zs, uint64_t n)
+{
+	size_t avail;
+
+	while (n > 0) {
+		if (!zs_need(zs, 1))
+			return -1;
+		avail = zs->len - zs->pos;
+		if (avail > n)
+			avail = (size_t)n;
+		zs->pos += avail;
+		n -= avail;
+	}
+	return 0;
+}
+
+static void zs_check_crc(ZIPSTREAM *zs)
+{
+	if (zs->checksum != zs->crc && zs->crc != 0)
+		fprintf(stderr,
+			"Warning: Checksum does not match: %d %d.\nPossibly the file"
+			" is corrupted otr truncated.\n", (int)zs->checksum,
+			(int)zs->crc);
+}
+
+/*
+ * Called at the end of the data of the current file.
+ */
+static int zs_finish_data(ZIPSTREAM *zs)
+{
+	size_t len = zs->zip64 ? 20 : 12;
+
+	zs->done = 1;
+
+	if (zs->flags & 8) {
+		/* the data descriptor, its signature is optional */
+		if (!zs_need(zs, len))
+			return -1;
+		if (get_u32(zs->buf + zs->pos) == SIG_DESCRIPTOR) {
+			zs->pos += 4;
+			if (!zs_need(zs, len))
+				return -1;
+		}
+		zs->crc = get_u32(zs->buf + zs->pos);
+		zs->pos += len;
+	}
+
+	zs_check_crc(zs);
+	return 0;
+}
+
+static long zs_read_stored(ZIPSTREAM *zs, char *buf, size_t len)
+{
+	size_t n;
+	int end_found;
+
+	if (!(zs->flags & 8)) {
+		if (len > zs->csize - zs->consumed)
+			len = (size_t)(zs->csize - zs->consumed);
+		if (!zs_need(zs, 1))
+			return -1;
+		n = zs->len - zs->pos;
+		if (n > len)
+			n = len;
+		end_found = zs->consumed + n == zs->csize;
+	} else {
+		/* the data ends at the first data descriptor whose
+		   compressed size matches */
+		const unsigned char *start, *p, *end;
+		size_t need = zs->zip64 ? 24 : 16;
+		uint64_t size;
+
+		if (!zs_need(zs, need))
+			return -1;
+		start = zs->buf + zs->pos;
+		end = zs->buf + zs->len - (need - 1);
+		if ((size_t)(end - start) > len)
+			end = start + len;
+
+		end_found = 0;
+		for (p = start; p < end; p++) {
+			p = memchr(p, 'P', (size_t)(end - p));
+			if (!p)
+				break;
+			if (get_u32(p) != SIG_DESCRIPTOR)
+				continue;
+			size = zs->zip64 ? get_u64(p + 8) : get_u32(p + 8);
+			if (size == zs->consumed + (uint64_t)(p - start)) {
+				end_found = 1;
+				break;
+			}
+		}
+		n = end_found ? (size_t)(p - start) : (size_t)(end - start);
+	}
+
+	memcpy(buf, zs->buf + zs->pos, n);
+	zs->pos += n;
+	zs->consumed += n;
+	zs->checksum = crc32(zs->checksum, (Bytef *)buf, (uInt)n);
+
+	if (inflate_exceeds((unsigned long)zs->consumed,
+			    (unsigned long)zs->consumed, zs->max_len, 0)) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	if (end_found && zs_finish_data(zs) == -1)
+		return -1;
+
+	return (long)n;
+}
+
+static long zs_read_deflated(ZIPSTREAM *zs, char *buf, size_t len)
+{
+	size_t avail;
+	int z_ret;
+
+	zs->strm.next_out = (Bytef *)buf;
+	zs->strm.avail_out = (uInt)len;
+
+	do {
+		if (!zs_need(zs, 1))
+			return -1;	/* truncated */
+
+		avail = zs->len - zs->pos;
+		if (!(zs->flags & 8) && avail > zs->csize - zs->consumed)
+			avail = (size_t)(zs->csize - zs->consumed);
+		if (avail == 0)
+			return -1;
+
+		zs->strm.next_in = zs->buf + zs->pos;
+		zs->strm.avail_in = (uInt)avail;
+
+		z_ret = inflate(&zs->strm, Z_NO_FLUSH);
+
+		avail -= zs->strm.avail_in;
+		zs->pos += avail;
+		zs->consumed += avail;
+
+		if (z_ret == Z_STREAM_END) {
+			zs->done = 1;
+			break;
+		}
+		if (z_ret != Z_OK && z_ret != Z_BUF_ERROR)
+			return -1;
+	} while (zs->strm.avail_out == (uInt)len);
+
+	if (inflate_exceeds(zs->strm.total_out, (unsigned long)zs->consumed,
+			    zs->max_len, zs->max_ratio)) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	len -= zs->strm.avail_out;
+	zs->checksum = crc32(zs->checksum, (Bytef *)buf, (uInt)len);
+
+	if (zs->done && zs_finish_data(zs) == -1)
+		return -1;
+
+	return (long)len;
+}
+
+long zipstream_read(ZIPSTREAM *zs, char *buf, size_t len)
+{
+	if (zs->state != ZS_DATA || zs->done || len == 0)
+		return 0;
+
+	if (zs->method == 0)
+		return zs_read_stored(zs, buf, len);
+	else if (zs->method == Z_DEFLATED)
+		return zs_read_deflated(zs, buf, len);
+
+	return -1;
+}
+
+/*
+ * Skips the rest of the current file.
+ */
+static int zs_skip_data(ZIPSTREAM *zs)
+{
+	char scratch[4096];
+	size_t max_len = zs->max_len;
+	long r;
+
+	if (!(zs->flags & 8))
+		return zs_skip(zs, zs->csize - zs->consumed);
+
+	/* the end is only found by reading the data.  It is not
+	   kept, so only the ratio is limited */
+	zs->max_len = 0;
+	while ((r = zipstream_read(zs, scratch, sizeof(scratch))) > 0)
+		;
+	zs->max_len = max_len;
+	return r == 0 && zs->done ? 0 : -1;
+}
+
+static void zs_end_file(ZIPSTREAM *zs)
+{
+	if (zs->method == Z_DEFLATED)
+		(void)inflateEnd(&zs->strm);
+	yfree(zs->name);
+	zs->name = NULL;
+	zs->state = ZS_HEADER;
+}
+
+/*
+ * Reads the ZIP64 extra field of the local header, at zs->buf +
+ * zs->pos.  Its presence means 8-byte sizes in the data descriptor.
+ * Sizes of 0xffffffff are in it, and then it must have both of them.
+ * Returns -1 if it is too short.
+ */
+static int zs_read_extra(ZIPSTREAM *zs, unsigned int extra_len,
+			 unsigned long usize)
+{
+	const unsigned char *p = zs->buf + zs->pos;
+	const unsigned char *end = p + extra_len;
+
+	for (; p + 4 <= end; p += 4 + get_u16(p + 2)) {
+		if (get_u16(p) != 0x0001)
+			continue;
+
+		zs->zip64 = 1;
+		if (usize == 0xffffffff || zs->csize == 0xffffffff) {
+			if (p + 4 + 16 > end)
+				return -1;
+			zs->csize = get_u64(p + 12);
+		}
+		break;
+	}
+	return 0;
+}
+
+int zipstream_next(ZIPSTREAM *zs, const char **name)
+{
+	const unsigned char *h;
+	unsigned long sig, usize;
+	unsigned int name_len, extra_len;
+	int r;
+
+	if (zs->state == ZS_DATA) {
+		r = zs_skip_data(zs);
+		zs_end_file(zs);
+		if (r == -1)
+			return -1;
+	}
+
+	if (zs->state == ZS_END || !zs_need(zs, 4))
+		return 0;
+
+	sig = get_u32(zs->buf + zs->pos);
+	if (sig == SIG_CENTRAL || sig == SIG_END) {
+		zs->state = ZS_END;
+		return 0;
+	}
+	if (sig != SIG_LOCAL || !zs_need(zs, 30))
+		return -1;
+
+	h = zs->buf + zs->pos;
+	zs->flags = (int)get_u16(h + 6);
+	zs->method = (int)get_u16(h + 8);
+	zs->crc = get_u32(h + 14);
+	zs->csize = get_u32(h + 18);
+	usize = get_u32(h + 22);
+	name_len = get_u16(h + 26);
+	extra_len = get_u16(h + 28);
+	zs->pos += 30;
+
+	if (!zs_need(zs, name_len))
+		return -1;
+	zs->name = ymalloc(name_len + 1);
+	memcpy(zs->name, zs->buf + zs->pos, name_len);
+	zs->name[name_len] = '\0';
+	zs->pos += name_len;
+
+	zs->state = ZS_DATA;
+	zs->consumed = 0;
+	zs->zip64 = 0;
+	zs->done = 0;
+	zs->checksum = crc32(0L, Z_NULL, 0);
+
+	if (zs->method == Z_DEFLATED) {
+		zs->strm.zalloc   = Z_NULL;
+		zs->strm.zfree    = Z_NULL;
+		zs->strm.opaque   = Z_NULL;
+		zs->strm.next_in  = Z_NULL;
+		zs->strm.avail_in = 0;
+
+		if (inflateInit2(&zs->strm, -15) != Z_OK) {
+			zs->method = -1;
+			zs_end_file(zs);
+			return -1;
+		}
+	} else if (zs->method != 0 && (zs->flags & 8)) {
+		/* can't find the end of this file */
+		zs_end_file(zs);
+		return -1;
+	}
+
+	if (!zs_need(zs, extra_len) ||
+	    zs_read_extra(zs, extra_len, usize) == -1)
+		return -1;
+	zs->pos += extra_len;
+
+	*name = zs->name;
+	return 1;
+}
+
+ZIPSTREAM *zipstream_open(FILE *in)
+{
+	ZIPSTREAM *zs = ymalloc(sizeof(ZIPSTREAM));
+
+	zs->in = in;
+	zs->pos = 0;
+	zs->len = 0;
+	zs->state = ZS_HEADER;
+	zs->name = NULL;
+	zs->max_len = 0;
+	zs->max_ratio = 0;
+
+	return zs;
+}
+
+void zipstream_set_limits(ZIPSTREAM *zs, size_t max_len,
+			  unsigned long max_ratio)
+{
+	zs->max_len = max_len;
+	zs->max_ratio = max_ratio;
+}
+
+void zipstream_close(ZIPSTREAM *zs)
+{
+	if (zs->state == ZS_DATA)
+		zs_end_file(zs);
+	yfree(zs);
+}
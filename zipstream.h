@@ -0,0 +1,59 @@
+/*
+ * zipstream.h: Read zip archives from a stream, e.g. a pipe
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License,
+ * version 2 as published by the Free Software Foundation
+ */
+
+#ifndef ZIPSTREAM_H
+#define ZIPSTREAM_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * A zip archive which is read from front to back, without seeking
+ * and without the central directory.  The files are found through
+ * their local headers.  Files whose sizes are only known from the
+ * data descriptor behind them (bit 3) are supported if they are
+ * deflated or if the data descriptor has a signature.
+ */
+typedef struct zipstream ZIPSTREAM;
+
+/*
+ * Starts reading an archive from in.  in is not closed by
+ * zipstream_close().
+ */
+ZIPSTREAM *zipstream_open(FILE *in);
+
+/*
+ * Limits the files to max_len uncompressed bytes and to max_ratio
+ * times their compressed size, see inflate_exceeds() in strbuf.h.
+ * 0 means no limit, which is the default.  zipstream_read() fails
+ * with errno set to EFBIG on larger files.
+ */
+void zipstream_set_limits(ZIPSTREAM *zs, size_t max_len,
+			  unsigned long max_ratio);
+
+/*
+ * Skips the rest of the current file and moves to the next one.
+ * Sets *name to its name, which is valid until the next call.
+ * Returns 1, 0 at the end of the archive or -1 if it is corrupted
+ * or truncated.
+ */
+int zipstream_next(ZIPSTREAM *zs, const char **name);
+
+/*
+ * Reads up to len uncompressed bytes of the current file.  Returns
+ * the number of bytes, 0 at the end of the file or -1 if it is
+ * corrupted, truncated or uses an unsupported compression method.
+ */
+long zipstream_read(ZIPSTREAM *zs, char *buf, size_t len);
+
+/*
+ * Frees all resources.
+ */
+void zipstream_close(ZIPSTREAM *zs);
+
+#endif /* ZIPSTREAM_H */